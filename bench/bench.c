@@ -0,0 +1,426 @@
+// Benchmark of the draw, diff and encode paths on the headless backend.
+//
+// Every workload draws a fixed number of frames at a fixed size, and one
+// line per workload is printed as CSV:
+//
+//   workload,width,height,frames,draw_ns_cell,diff_ns_cell,encode_ns_cell,
+//   cells_frame,bytes_frame,allocs_frame
+//
+// draw is the time from cg_begin_draw until the frame and its jobs are
+// done, diff is a scan of the frame for the cells which changed, the same
+// one the encoder does, and encode is the encoder itself, which includes
+// its own scan. Times are divided by the cells on the canvas. The first
+// frames of each workload are not counted.
+//
+// With -v the output of every frame is also fed to the virtual terminal
+// in vt.h, and the screen it shows is checked against the canvas. Each
+// workload then adds a line to stderr:
+//
+//   verify,workload,frames,frames_wrong,bytes
+//
+// and the exit status is 1 if any frame was wrong.
+//
+// usage: bench [-v] [-n frames] [-w width] [-h height] [-s seed] [workload ...]
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// count every allocation the library makes
+static atomic_size_t bench_allocs;
+
+static void *bench_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add(&bench_allocs, 1);
+    return calloc(count, size);
+}
+
+static void *bench_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&bench_allocs, 1);
+    return realloc(ptr, size);
+}
+
+#define _CG_CALLOC bench_calloc
+#define _CG_REALLOC bench_realloc
+#define _CG_FREE free
+
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
+
+#define VT_IMPLEMENTATION
+#include "vt.h"
+
+#define BENCH_FRAMES 500
+#define BENCH_WARMUP 10
+#define BENCH_WIDTH 200
+#define BENCH_HEIGHT 60
+#define BENCH_SPRITES 200
+#define BENCH_TEXT_LINES 97
+
+typedef struct
+{
+    cg_uint frame;
+    cg_uint w, h;
+} bench_ctx_t;
+
+typedef struct
+{
+    int x, y;
+    int vx, vy;
+    cg_rgb_t colour;
+} sprite_t;
+
+sprite_t sprites[BENCH_SPRITES];
+uint32_t *noise = NULL;
+cg_char text_lines[BENCH_TEXT_LINES][128];
+
+// full screen random colour, every cell changes every frame
+void noise_setup(bench_ctx_t *ctx)
+{
+    noise = (uint32_t *)realloc(noise, ctx->w * ctx->h * sizeof(uint32_t));
+    if (noise == NULL)
+    {
+        fprintf(stderr, "unable to allocate the noise buffer\n");
+        exit(1);
+    }
+}
+
+void noise_draw(bench_ctx_t *ctx)
+{
+    cg_rand_fill(noise, ctx->w * ctx->h);
+    for (cg_uint j = 0; j < ctx->h; j++)
+    {
+        for (cg_uint i = 0; i < ctx->w; i++)
+        {
+            uint32_t c = noise[j * ctx->w + i];
+            cg_stroke((cg_rgb_t){c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF});
+            cg_point(i, j);
+        }
+    }
+}
+
+// a small block moving over an empty canvas, a few cells change
+void sparse_setup(bench_ctx_t *ctx)
+{
+    (void)ctx;
+}
+
+void sparse_draw(bench_ctx_t *ctx)
+{
+    cg_uint span = ctx->w - 6;
+    cg_uint step = ctx->frame % (2 * span);
+    cg_uint x = (step < span) ? step : 2 * span - step;
+
+    cg_clear_canvas();
+    cg_stroke((cg_rgb_t){255, 255, 255});
+    cg_rect(x, ctx->h / 2 - 2, 5, 5);
+    cg_textf(0, ctx->h - 2, "Block Location: (%lu, %lu)", x, ctx->h / 2 - 2);
+}
+
+// many coloured sprites bouncing around
+void sprites_setup(bench_ctx_t *ctx)
+{
+    for (cg_uint i = 0; i < BENCH_SPRITES; i++)
+    {
+        sprite_t *s = &sprites[i];
+        s->x = cg_rand_int(0, ctx->w - 5);
+        s->y = cg_rand_int(0, ctx->h - 5);
+        s->vx = cg_rand_int(0, 1) ? 1 : -1;
+        s->vy = cg_rand_int(0, 1) ? 1 : -1;
+        s->colour = (cg_rgb_t){cg_rand_int(64, 255), cg_rand_int(64, 255), cg_rand_int(64, 255)};
+    }
+}
+
+void sprites_draw(bench_ctx_t *ctx)
+{
+    cg_clear_canvas();
+    for (cg_uint i = 0; i < BENCH_SPRITES; i++)
+    {
+        sprite_t *s = &sprites[i];
+        s->x += s->vx;
+        s->y += s->vy;
+        if (s->x <= 0 || s->x >= (int)ctx->w - 5)
+        {
+            s->vx = -s->vx;
+        }
+        if (s->y <= 0 || s->y >= (int)ctx->h - 5)
+        {
+            s->vy = -s->vy;
+        }
+        cg_stroke(s->colour);
+        cg_rect(s->x, s->y, 4, 4);
+    }
+}
+
+// a screen of text moving up by a line every frame
+void scroll_setup(bench_ctx_t *ctx)
+{
+    static const cg_char *words[] = {"frame", "terminal", "cell", "glyph", "colour", "canvas",
+                                     "encode", "diff", "write", "escape", "cursor", "row"};
+    cg_uint limit = (ctx->w < sizeof(text_lines[0])) ? ctx->w : sizeof(text_lines[0]) - 1;
+
+    for (cg_uint i = 0; i < BENCH_TEXT_LINES; i++)
+    {
+        size_t len = snprintf(text_lines[i], sizeof(text_lines[i]), "%4lu ", i);
+        while (len < limit)
+        {
+            const cg_char *word = words[cg_rand_int(0, 11)];
+            size_t n = strlen(word);
+            if (len + n + 1 > limit)
+            {
+                break;
+            }
+            memcpy(text_lines[i] + len, word, n);
+            text_lines[i][len + n] = ' ';
+            len += n + 1;
+        }
+        text_lines[i][len] = '\0';
+    }
+}
+
+void scroll_draw(bench_ctx_t *ctx)
+{
+    cg_clear_canvas();
+    cg_stroke((cg_rgb_t){200, 200, 200});
+    for (cg_uint j = 0; j < ctx->h; j++)
+    {
+        cg_text(text_lines[(ctx->frame + j) % BENCH_TEXT_LINES], 0, j);
+    }
+}
+
+// the same frame over and over, nothing changes
+void static_setup(bench_ctx_t *ctx)
+{
+    (void)ctx;
+}
+
+void static_draw(bench_ctx_t *ctx)
+{
+    for (cg_uint j = 0; j < ctx->h; j++)
+    {
+        cg_stroke((cg_rgb_t){0, j * 255 / ctx->h, 128});
+        for (cg_uint i = 0; i < ctx->w; i++)
+        {
+            cg_point(i, j);
+        }
+    }
+    cg_stroke((cg_rgb_t){255, 255, 255});
+    cg_text("A static frame", 1, 1);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*setup)(bench_ctx_t *ctx);
+    void (*draw)(bench_ctx_t *ctx);
+} workload_t;
+
+workload_t workloads[] = {
+    {"noise", noise_setup, noise_draw},
+    {"sparse", sparse_setup, sparse_draw},
+    {"sprites", sprites_setup, sprites_draw},
+    {"scroll", scroll_setup, scroll_draw},
+    {"static", static_setup, static_draw},
+};
+
+// the terminal the output is checked on, NULL if not checking
+vt_t *vt = NULL;
+
+// feed the output of the frame to the terminal, and check the screen
+bool verify_frame(workload_t *workload, cg_uint frame)
+{
+    size_t length;
+    const cg_char *output = cg_get_headless_output(&length);
+    vt_feed(vt, output, length);
+
+    // the frame just written is the previous canvas now
+    cg_uint x = 0, y = 0;
+    cg_uint differ = vt_compare_canvas(vt, canvas_previous, &x, &y);
+    if (differ > 0)
+    {
+        fprintf(stderr, "%s: frame %lu has %lu cells wrong, the first at (%lu, %lu)\n",
+                workload->name, frame, differ, x, y);
+        return false;
+    }
+    return true;
+}
+
+// scan the frame for changed cells the way the encoder does
+cg_uint bench_diff(cg_canvas_t *current, cg_canvas_t *previous)
+{
+    cg_uint w = current->width;
+    cg_uint changed = 0;
+
+    for (cg_uint i = 0; i < current->height; i++)
+    {
+        cg_cell_t *cur = current->cells + (i * w);
+        cg_cell_t *prev = previous->cells + (i * w);
+        if (memcmp(cur, prev, w * sizeof(cg_cell_t)) == 0)
+        {
+            continue;
+        }
+        for (cg_uint j = 0; j < w; j++)
+        {
+            changed += _cg_encode_cell_changed(cur, prev, j, w);
+        }
+    }
+    return changed;
+}
+
+int run_workload(workload_t *workload, cg_uint frames, unsigned int seed)
+{
+    bench_ctx_t ctx = {0, width, height};
+    uint64_t draw = 0, diff = 0, encode = 0, bytes = 0, cells = 0;
+    size_t allocs = 0;
+    volatile cg_uint changed = 0;
+    cg_uint wrong = 0;
+    uint64_t vt_bytes = (vt != NULL) ? vt->bytes : 0;
+
+    cg_seed_random(seed);
+    workload->setup(&ctx);
+
+    for (cg_uint f = 0; f < BENCH_WARMUP + frames; f++)
+    {
+        ctx.frame = f;
+        size_t allocs_before = atomic_load(&bench_allocs);
+
+        uint64_t start = _cg_now_nanos();
+        cg_begin_draw();
+        workload->draw(&ctx);
+        cg_wait_jobs();
+        uint64_t drawn = _cg_now_nanos();
+        changed = bench_diff(canvas_current, canvas_previous);
+        uint64_t diffed = _cg_now_nanos();
+        cg_end_draw();
+
+        size_t allocs_after = atomic_load(&bench_allocs);
+        cg_frame_stats_t stats = cg_get_frame_stats();
+        if (vt != NULL && !verify_frame(workload, f))
+        {
+            wrong++;
+        }
+        cg_clear_headless_output();
+        if (f < BENCH_WARMUP)
+        {
+            continue;
+        }
+        draw += drawn - start;
+        diff += diffed - drawn;
+        encode += stats.stats[CG_STAT_ENCODE].last;
+        bytes += stats.stats[CG_STAT_BYTES].last;
+        cells += stats.stats[CG_STAT_CELLS].last;
+        allocs += allocs_after - allocs_before;
+    }
+    (void)changed;
+
+    double per_cell = (double)frames * ctx.w * ctx.h;
+    printf("%s,%lu,%lu,%lu,%.3f,%.3f,%.3f,%.1f,%.1f,%.2f\n", workload->name, ctx.w, ctx.h, frames,
+           draw / per_cell, diff / per_cell, encode / per_cell,
+           (double)cells / frames, (double)bytes / frames, (double)allocs / frames);
+    fflush(stdout);
+
+    if (vt != NULL)
+    {
+        fprintf(stderr, "verify,%s,%lu,%lu,%llu\n", workload->name, BENCH_WARMUP + frames, wrong,
+                (unsigned long long)(vt->bytes - vt_bytes));
+    }
+    return (wrong == 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    cg_uint frames = BENCH_FRAMES;
+    cg_uint w = BENCH_WIDTH;
+    cg_uint h = BENCH_HEIGHT;
+    unsigned int seed = 1;
+    bool verify = false;
+    int first = argc;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            first = i;
+            break;
+        }
+        if (strcmp(argv[i], "-v") == 0)
+        {
+            verify = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "usage: %s [-v] [-n frames] [-w width] [-h height] [-s seed] [workload ...]\n", argv[0]);
+            return 1;
+        }
+        cg_uint value = (cg_uint)strtoul(argv[++i], NULL, 10);
+        switch (argv[i - 1][1])
+        {
+        case 'n':
+            frames = value;
+            break;
+        case 'w':
+            w = value;
+            break;
+        case 'h':
+            h = value;
+            break;
+        case 's':
+            seed = (unsigned int)value;
+            break;
+        default:
+            fprintf(stderr, "unknown option %s\n", argv[i - 1]);
+            return 1;
+        }
+    }
+    if (frames == 0 || w < 8 || h < 8)
+    {
+        fprintf(stderr, "need at least one frame and a canvas of 8x8\n");
+        return 1;
+    }
+
+    // run unthrottled, with every frame encoded and written in place
+    if (cg_set_headless(w, h, -1) != 0)
+    {
+        fprintf(stderr, "unable to set up the headless backend\n");
+        return 1;
+    }
+    cg_frame_rate(0);
+    cg_set_present_thread(0);
+    if (cg_create_graphics_fullscreen() != 0)
+    {
+        return 1;
+    }
+    if (verify)
+    {
+        vt = vt_create(w, h);
+        if (vt == NULL)
+        {
+            fprintf(stderr, "unable to create the virtual terminal\n");
+            return 1;
+        }
+    }
+
+    printf("workload,width,height,frames,draw_ns_cell,diff_ns_cell,encode_ns_cell,cells_frame,bytes_frame,allocs_frame\n");
+    size_t count = sizeof(workloads) / sizeof(workloads[0]);
+    int status = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        bool selected = (first == argc);
+        for (int j = first; j < argc; j++)
+        {
+            selected = selected || strcmp(argv[j], workloads[i].name) == 0;
+        }
+        if (selected)
+        {
+            if (run_workload(&workloads[i], frames, seed) != 0)
+            {
+                status = 1;
+            }
+        }
+    }
+
+    cg_destroy_graphics();
+    vt_destroy(vt);
+    free(noise);
+    return status;
+}
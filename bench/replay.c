@@ -0,0 +1,383 @@
+// Play back a recording made with cg_record_start.
+//
+// The recording is an asciicast v2 file. Its output events are decoded up
+// front, then written to the sink either with their recorded timing or as
+// fast as the sink takes them. In a congfx recording \u0080 to \u00ff are
+// bytes which were not UTF-8, they are written back as those bytes. The
+// throughput is printed to stderr as CSV:
+//
+//   file,events,bytes,seconds,mb_per_s,events_per_s
+//
+// usage: replay [-r] [-o sink] [-n loops] recording.cast
+//
+//   -r  play back in real time, the default is as fast as possible
+//   -o  write to this file instead of stdout, e.g. /dev/null
+//   -n  play the recording this many times
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
+
+typedef struct
+{
+    uint64_t time;  // nanoseconds from the start of the recording
+    size_t offset;  // where the output is in the data
+    size_t length;
+} replay_event_t;
+
+typedef struct
+{
+    replay_event_t *events;
+    cg_uint count;
+    cg_uint capacity;
+    cg_char *data;
+    size_t length;
+    size_t capacity_data;
+    bool raw_bytes; // \u0080 to \u00ff are single bytes, as congfx records them
+} replay_t;
+
+int replay_add_bytes(replay_t *replay, const cg_char *bytes, size_t length)
+{
+    if (replay->length + length > replay->capacity_data)
+    {
+        size_t capacity = (replay->capacity_data == 0) ? 64 * 1024 : replay->capacity_data;
+        while (replay->length + length > capacity)
+        {
+            capacity *= 2;
+        }
+        cg_char *data = (cg_char *)realloc(replay->data, capacity);
+        if (data == NULL)
+        {
+            return -1;
+        }
+        replay->data = data;
+        replay->capacity_data = capacity;
+    }
+    memcpy(replay->data + replay->length, bytes, length);
+    replay->length += length;
+    return 0;
+}
+
+// add a code point as utf-8
+int replay_add_utf8(replay_t *replay, unsigned long cp)
+{
+    cg_char out[4];
+    size_t n;
+    if (cp < 0x80)
+    {
+        out[0] = (cg_char)cp;
+        n = 1;
+    }
+    else if (cp < 0x800)
+    {
+        out[0] = (cg_char)(0xC0 | (cp >> 6));
+        out[1] = (cg_char)(0x80 | (cp & 0x3F));
+        n = 2;
+    }
+    else if (cp < 0x10000)
+    {
+        out[0] = (cg_char)(0xE0 | (cp >> 12));
+        out[1] = (cg_char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (cg_char)(0x80 | (cp & 0x3F));
+        n = 3;
+    }
+    else
+    {
+        out[0] = (cg_char)(0xF0 | (cp >> 18));
+        out[1] = (cg_char)(0x80 | ((cp >> 12) & 0x3F));
+        out[2] = (cg_char)(0x80 | ((cp >> 6) & 0x3F));
+        out[3] = (cg_char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    return replay_add_bytes(replay, out, n);
+}
+
+// decode the json string starting after its opening quote, returns the
+// position after the closing quote, or NULL if it is malformed
+const cg_char *replay_decode_string(replay_t *replay, const cg_char *p)
+{
+    for (;;)
+    {
+        const cg_char *run = p;
+        while (*p != '\0' && *p != '"' && *p != '\\')
+        {
+            p++;
+        }
+        if (replay_add_bytes(replay, run, p - run) == -1 || *p == '\0')
+        {
+            return NULL;
+        }
+        if (*p == '"')
+        {
+            return p + 1;
+        }
+
+        // an escape
+        p++;
+        cg_char c = *p++;
+        cg_char plain = 0;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            plain = c;
+            break;
+        case 'b':
+            plain = '\b';
+            break;
+        case 'f':
+            plain = '\f';
+            break;
+        case 'n':
+            plain = '\n';
+            break;
+        case 'r':
+            plain = '\r';
+            break;
+        case 't':
+            plain = '\t';
+            break;
+        case 'u':
+        {
+            cg_char hex[5] = {0};
+            memcpy(hex, p, 4);
+            if (strlen(hex) != 4)
+            {
+                return NULL;
+            }
+            unsigned long cp = strtoul(hex, NULL, 16);
+            p += 4;
+            // a surrogate pair is one code point
+            if (cp >= 0xD800 && cp < 0xDC00 && p[0] == '\\' && p[1] == 'u')
+            {
+                memcpy(hex, p + 2, 4);
+                unsigned long low = strtoul(hex, NULL, 16);
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            if (replay->raw_bytes && cp >= 0x80 && cp <= 0xFF)
+            {
+                plain = (cg_char)cp;
+                break;
+            }
+            if (replay_add_utf8(replay, cp) == -1)
+            {
+                return NULL;
+            }
+            continue;
+        }
+        default:
+            return NULL;
+        }
+        if (replay_add_bytes(replay, &plain, 1) == -1)
+        {
+            return NULL;
+        }
+    }
+}
+
+// decode one event line, other events than output are skipped
+int replay_decode_line(replay_t *replay, const cg_char *line)
+{
+    cg_char *end;
+    const cg_char *p = line;
+    while (*p == ' ' || *p == '[')
+    {
+        p++;
+    }
+    double seconds = strtod(p, &end);
+    if (end == p)
+    {
+        return -1;
+    }
+    p = strchr(end, '"');
+    if (p == NULL)
+    {
+        return -1;
+    }
+    if (strncmp(p, "\"o\"", 3) != 0)
+    {
+        return 0;
+    }
+    p = strchr(p + 3, '"');
+    if (p == NULL)
+    {
+        return -1;
+    }
+
+    if (replay->count == replay->capacity)
+    {
+        cg_uint capacity = (replay->capacity == 0) ? 1024 : replay->capacity * 2;
+        replay_event_t *events = (replay_event_t *)realloc(replay->events, capacity * sizeof(replay_event_t));
+        if (events == NULL)
+        {
+            return -1;
+        }
+        replay->events = events;
+        replay->capacity = capacity;
+    }
+    replay_event_t *event = &replay->events[replay->count];
+    event->time = (uint64_t)(seconds * 1e9);
+    event->offset = replay->length;
+    if (replay_decode_string(replay, p + 1) == NULL)
+    {
+        return -1;
+    }
+    event->length = replay->length - event->offset;
+    replay->count++;
+    return 0;
+}
+
+int replay_load(replay_t *replay, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    size_t capacity = 64 * 1024;
+    cg_char *line = (cg_char *)malloc(capacity);
+    cg_uint number = 0;
+    int err = 0;
+    while (line != NULL && err == 0)
+    {
+        // read a whole line, however long the frame in it is
+        size_t length = 0;
+        line[0] = '\0';
+        while (fgets(line + length, (int)(capacity - length), file) != NULL)
+        {
+            length += strlen(line + length);
+            if (length > 0 && line[length - 1] == '\n')
+            {
+                break;
+            }
+            capacity *= 2;
+            cg_char *bigger = (cg_char *)realloc(line, capacity);
+            if (bigger == NULL)
+            {
+                err = -1;
+                break;
+            }
+            line = bigger;
+        }
+        if (length == 0 || err != 0)
+        {
+            break;
+        }
+
+        // the first line is the header
+        number++;
+        if (number == 1)
+        {
+            if (strstr(line, "\"version\": 2") == NULL && strstr(line, "\"version\":2") == NULL)
+            {
+                fprintf(stderr, "%s: not an asciicast v2 recording\n", path);
+                err = -1;
+            }
+            replay->raw_bytes = (strstr(line, "\"congfx\"") != NULL);
+            continue;
+        }
+        if (replay_decode_line(replay, line) == -1)
+        {
+            fprintf(stderr, "%s:%lu: malformed event\n", path, number);
+            err = -1;
+        }
+    }
+    free(line);
+    fclose(file);
+    return (line == NULL) ? -1 : err;
+}
+
+int main(int argc, char *argv[])
+{
+    bool real_time = false;
+    const char *sink = NULL;
+    cg_uint loops = 1;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            real_time = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            sink = argv[++i];
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            loops = (cg_uint)strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && path == NULL)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || loops == 0)
+    {
+        fprintf(stderr, "usage: %s [-r] [-o sink] [-n loops] recording.cast\n", argv[0]);
+        return 1;
+    }
+
+    replay_t replay = {0};
+    if (replay_load(&replay, path) == -1)
+    {
+        fprintf(stderr, "%s: unable to read the recording\n", path);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (sink != NULL)
+    {
+        out = fopen(sink, "wb");
+        if (out == NULL)
+        {
+            fprintf(stderr, "%s: unable to open the sink\n", sink);
+            return 1;
+        }
+    }
+
+    uint64_t start = _cg_now_nanos();
+    uint64_t bytes = 0;
+    for (cg_uint loop = 0; loop < loops; loop++)
+    {
+        uint64_t loop_start = _cg_now_nanos();
+        for (cg_uint i = 0; i < replay.count; i++)
+        {
+            replay_event_t *event = &replay.events[i];
+            if (real_time)
+            {
+                _cg_sleep_until(loop_start + event->time);
+            }
+            // one write per event, as the frames were written
+            if (fwrite(replay.data + event->offset, 1, event->length, out) != event->length || fflush(out) != 0)
+            {
+                fprintf(stderr, "unable to write to the sink\n");
+                return 1;
+            }
+            bytes += event->length;
+        }
+    }
+    double seconds = (_cg_now_nanos() - start) / 1e9;
+
+    fprintf(stderr, "file,events,bytes,seconds,mb_per_s,events_per_s\n");
+    fprintf(stderr, "%s,%lu,%llu,%.6f,%.2f,%.1f\n", path, replay.count * loops, (unsigned long long)bytes, seconds,
+            (seconds > 0) ? bytes / seconds / 1e6 : 0.0, (seconds > 0) ? replay.count * loops / seconds : 0.0);
+
+    if (sink != NULL)
+    {
+        fclose(out);
+    }
+    free(replay.events);
+    free(replay.data);
+    return 0;
+}
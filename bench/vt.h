@@ -0,0 +1,623 @@
+/**
+ * @file vt.h
+ * @brief A minimal virtual terminal, to check what congfx writes.
+ *
+ * The terminal parses the output the way a terminal would and keeps the
+ * grid of cells it ends up with, so that it can be compared with the
+ * canvas the output was encoded from. It knows cursor movement, erasing,
+ * true colour, 256 and 16 colour SGR, line wrapping and scrolling, and
+ * skips every other sequence. Text is split into grapheme clusters the
+ * way congfx splits it.
+ *
+ * Include congfx.h first, and define VT_IMPLEMENTATION in one file.
+ */
+#ifndef __VT_H__
+#define __VT_H__
+
+// the colour of a cell nothing has set a colour for
+#define VT_COLOUR_DEFAULT 0xFFFFFFFF
+
+/**
+ * A cell of the virtual terminal.
+ */
+typedef struct
+{
+    cg_char bytes[_CG_GLYPH_MAX_BYTES]; // the grapheme cluster shown
+    uint8_t len;
+    bool continuation; // the right half of a wide glyph
+    uint32_t fg;       // 0xRRGGBB, or VT_COLOUR_DEFAULT
+    uint32_t bg;
+} vt_cell_t;
+
+/**
+ * The virtual terminal.
+ */
+typedef struct
+{
+    cg_uint width;
+    cg_uint height;
+    vt_cell_t *cells;
+    cg_uint x, y;      // the cursor
+    bool wrap_pending; // the last column was written, the next glyph wraps
+    uint32_t fg;       // the colours set by SGR
+    uint32_t bg;
+    int state;             // where the parser is in a sequence
+    cg_char params[64];    // the parameters of the CSI sequence so far
+    size_t params_len;
+    cg_char held[2 * _CG_GLYPH_MAX_BYTES]; // text at the end of a feed the next one may add to
+    size_t held_len;
+    uint64_t bytes;        // bytes fed since created
+    uint64_t sequences;    // escape sequences fed since created
+} vt_t;
+
+/**
+ * Create a virtual terminal with every cell blank.
+ *
+ * @param width The width in cells.
+ * @param height The height in cells.
+ * @return The terminal, NULL if it could not be allocated.
+ */
+vt_t *vt_create(cg_uint width, cg_uint height);
+
+/**
+ * Free a virtual terminal.
+ *
+ * @param vt The terminal.
+ */
+void vt_destroy(vt_t *vt);
+
+/**
+ * Parse output into the terminal. Sequences may be split between calls.
+ *
+ * @param vt The terminal.
+ * @param bytes The output.
+ * @param length The number of bytes.
+ */
+void vt_feed(vt_t *vt, const cg_char *bytes, size_t length);
+
+/**
+ * Get a cell of the terminal.
+ *
+ * @param vt The terminal.
+ * @param x The column.
+ * @param y The row.
+ * @return The cell.
+ */
+vt_cell_t *vt_cell(vt_t *vt, cg_uint x, cg_uint y);
+
+/**
+ * Compare the terminal with a canvas, cell by cell. Glyphs, wide glyph
+ * halves and both colours must be the same.
+ *
+ * @param vt The terminal.
+ * @param canvas The canvas the output was encoded from.
+ * @param x Set to the column of the first cell which differs, may be NULL.
+ * @param y Set to the row of the first cell which differs, may be NULL.
+ * @return The number of cells which differ, all of them if the sizes differ.
+ */
+cg_uint vt_compare_canvas(vt_t *vt, cg_canvas_t *canvas, cg_uint *x, cg_uint *y);
+
+#ifdef VT_IMPLEMENTATION
+
+enum
+{
+    _VT_GROUND,
+    _VT_ESCAPE,
+    _VT_CSI,
+    _VT_OSC,
+    _VT_OSC_ESCAPE,
+};
+
+vt_cell_t *vt_cell(vt_t *vt, cg_uint x, cg_uint y)
+{
+    return &vt->cells[y * vt->width + x];
+}
+
+void _vt_blank(vt_t *vt, vt_cell_t *cell)
+{
+    cell->bytes[0] = ' ';
+    cell->len = 1;
+    cell->continuation = false;
+    cell->fg = vt->fg;
+    // erased cells take the background colour, as xterm does
+    cell->bg = vt->bg;
+}
+
+vt_t *vt_create(cg_uint width, cg_uint height)
+{
+    vt_t *vt = (vt_t *)calloc(1, sizeof(vt_t));
+    if (vt == NULL)
+    {
+        return NULL;
+    }
+    vt->cells = (vt_cell_t *)calloc((size_t)width * height, sizeof(vt_cell_t));
+    if (vt->cells == NULL)
+    {
+        free(vt);
+        return NULL;
+    }
+    vt->width = width;
+    vt->height = height;
+    vt->fg = VT_COLOUR_DEFAULT;
+    vt->bg = VT_COLOUR_DEFAULT;
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        _vt_blank(vt, &vt->cells[i]);
+    }
+    return vt;
+}
+
+void vt_destroy(vt_t *vt)
+{
+    if (vt != NULL)
+    {
+        free(vt->cells);
+        free(vt);
+    }
+}
+
+void _vt_erase(vt_t *vt, cg_uint x0, cg_uint y0, cg_uint x1, cg_uint y1)
+{
+    // from (x0, y0) up to, not including, (x1, y1), in reading order
+    size_t from = (size_t)y0 * vt->width + x0;
+    size_t to = (size_t)y1 * vt->width + x1;
+    for (size_t i = from; i < to; i++)
+    {
+        _vt_blank(vt, &vt->cells[i]);
+    }
+}
+
+void _vt_line_feed(vt_t *vt)
+{
+    if (vt->y + 1 < vt->height)
+    {
+        vt->y++;
+        return;
+    }
+    // at the bottom the screen scrolls up
+    memmove(vt->cells, vt->cells + vt->width, (size_t)vt->width * (vt->height - 1) * sizeof(vt_cell_t));
+    _vt_erase(vt, 0, vt->height - 1, 0, vt->height);
+}
+
+void _vt_move(vt_t *vt, long x, long y)
+{
+    vt->x = (x < 0) ? 0 : ((x >= (long)vt->width) ? vt->width - 1 : (cg_uint)x);
+    vt->y = (y < 0) ? 0 : ((y >= (long)vt->height) ? vt->height - 1 : (cg_uint)y);
+    vt->wrap_pending = false;
+}
+
+void _vt_break_wide(vt_t *vt, cg_uint x, cg_uint y)
+{
+    // overwriting half of a wide glyph blanks the other half
+    vt_cell_t *cell = vt_cell(vt, x, y);
+    if (cell->continuation && x > 0)
+    {
+        _vt_blank(vt, vt_cell(vt, x - 1, y));
+    }
+    else if (!cell->continuation && x + 1 < vt->width && vt_cell(vt, x + 1, y)->continuation)
+    {
+        _vt_blank(vt, vt_cell(vt, x + 1, y));
+    }
+}
+
+void _vt_print(vt_t *vt, const cg_char *bytes, cg_uint len, int width)
+{
+    if (vt->wrap_pending || (width == 2 && vt->x + 1 >= vt->width))
+    {
+        vt->x = 0;
+        vt->wrap_pending = false;
+        _vt_line_feed(vt);
+    }
+
+    _vt_break_wide(vt, vt->x, vt->y);
+    vt_cell_t *cell = vt_cell(vt, vt->x, vt->y);
+    memcpy(cell->bytes, bytes, len);
+    cell->len = (uint8_t)len;
+    cell->continuation = false;
+    cell->fg = vt->fg;
+    cell->bg = vt->bg;
+    if (width == 2)
+    {
+        _vt_break_wide(vt, vt->x + 1, vt->y);
+        vt_cell_t *right = cell + 1;
+        right->len = 0;
+        right->continuation = true;
+        right->fg = vt->fg;
+        right->bg = vt->bg;
+    }
+
+    if (vt->x + width >= vt->width)
+    {
+        vt->x = vt->width - 1;
+        vt->wrap_pending = true;
+    }
+    else
+    {
+        vt->x += width;
+    }
+}
+
+uint32_t _vt_palette(int index)
+{
+    // the xterm palette
+    static const uint32_t basic[16] = {
+        0x000000, 0xCD0000, 0x00CD00, 0xCDCD00, 0x0000EE, 0xCD00CD, 0x00CDCD, 0xE5E5E5,
+        0x7F7F7F, 0xFF0000, 0x00FF00, 0xFFFF00, 0x5C5CFF, 0xFF00FF, 0x00FFFF, 0xFFFFFF};
+    if (index < 16)
+    {
+        return basic[index];
+    }
+    if (index < 232)
+    {
+        static const int level[6] = {0, 95, 135, 175, 215, 255};
+        index -= 16;
+        return ((uint32_t)level[index / 36] << 16) | ((uint32_t)level[(index / 6) % 6] << 8) | level[index % 6];
+    }
+    uint32_t grey = 8 + (index - 232) * 10;
+    return (grey << 16) | (grey << 8) | grey;
+}
+
+int _vt_params(vt_t *vt, long *values, int max)
+{
+    int count = 0;
+    const cg_char *p = vt->params;
+    const cg_char *end = vt->params + vt->params_len;
+    while (p < end && (*p == '?' || *p == '>' || *p == '<' || *p == '='))
+    {
+        p++;
+    }
+    values[0] = 0;
+    while (p <= end && count < max)
+    {
+        long value = 0;
+        bool given = false;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            value = value * 10 + (*p - '0');
+            given = true;
+            p++;
+        }
+        values[count++] = given ? value : -1;
+        if (p >= end || (*p != ';' && *p != ':'))
+        {
+            break;
+        }
+        p++;
+    }
+    return count;
+}
+
+void _vt_sgr(vt_t *vt)
+{
+    long v[32];
+    int n = _vt_params(vt, v, 32);
+    for (int i = 0; i < n; i++)
+    {
+        long code = (v[i] < 0) ? 0 : v[i];
+        if (code == 0)
+        {
+            vt->fg = VT_COLOUR_DEFAULT;
+            vt->bg = VT_COLOUR_DEFAULT;
+        }
+        else if (code == 38 || code == 48)
+        {
+            uint32_t *target = (code == 38) ? &vt->fg : &vt->bg;
+            if (i + 4 < n && v[i + 1] == 2)
+            {
+                *target = ((uint32_t)(v[i + 2] & 0xFF) << 16) | ((uint32_t)(v[i + 3] & 0xFF) << 8) | (uint32_t)(v[i + 4] & 0xFF);
+                i += 4;
+            }
+            else if (i + 2 < n && v[i + 1] == 5)
+            {
+                *target = _vt_palette((int)(v[i + 2] & 0xFF));
+                i += 2;
+            }
+        }
+        else if (code == 39)
+        {
+            vt->fg = VT_COLOUR_DEFAULT;
+        }
+        else if (code == 49)
+        {
+            vt->bg = VT_COLOUR_DEFAULT;
+        }
+        else if (code >= 30 && code <= 37)
+        {
+            vt->fg = _vt_palette((int)code - 30);
+        }
+        else if (code >= 40 && code <= 47)
+        {
+            vt->bg = _vt_palette((int)code - 40);
+        }
+        else if (code >= 90 && code <= 97)
+        {
+            vt->fg = _vt_palette((int)code - 90 + 8);
+        }
+        else if (code >= 100 && code <= 107)
+        {
+            vt->bg = _vt_palette((int)code - 100 + 8);
+        }
+        // bold, underline and the rest do not change the grid
+    }
+}
+
+void _vt_csi(vt_t *vt, cg_char final)
+{
+    long v[4];
+    int n = _vt_params(vt, v, 4);
+    long a = (n > 0 && v[0] > 0) ? v[0] : 1;
+    long b = (n > 1 && v[1] > 0) ? v[1] : 1;
+    long mode = (n > 0 && v[0] > 0) ? v[0] : 0;
+    bool private_mode = vt->params_len > 0 && (vt->params[0] < '0' || vt->params[0] > ';');
+
+    if (private_mode)
+    {
+        // modes, keyboard protocols and queries, none change the grid
+        return;
+    }
+
+    switch (final)
+    {
+    case 'H':
+    case 'f':
+        _vt_move(vt, b - 1, a - 1);
+        break;
+    case 'A':
+        _vt_move(vt, vt->x, (long)vt->y - a);
+        break;
+    case 'B':
+        _vt_move(vt, vt->x, (long)vt->y + a);
+        break;
+    case 'C':
+        _vt_move(vt, (long)vt->x + a, vt->y);
+        break;
+    case 'D':
+        _vt_move(vt, (long)vt->x - a, vt->y);
+        break;
+    case 'G':
+        _vt_move(vt, a - 1, vt->y);
+        break;
+    case 'd':
+        _vt_move(vt, vt->x, a - 1);
+        break;
+    case 'J':
+        if (mode == 0)
+        {
+            _vt_erase(vt, vt->x, vt->y, 0, vt->height);
+        }
+        else if (mode == 1)
+        {
+            _vt_erase(vt, 0, 0, vt->x + 1, vt->y);
+        }
+        else
+        {
+            _vt_erase(vt, 0, 0, 0, vt->height);
+        }
+        break;
+    case 'K':
+        if (mode == 0)
+        {
+            _vt_erase(vt, vt->x, vt->y, vt->width, vt->y);
+        }
+        else if (mode == 1)
+        {
+            _vt_erase(vt, 0, vt->y, vt->x + 1, vt->y);
+        }
+        else
+        {
+            _vt_erase(vt, 0, vt->y, vt->width, vt->y);
+        }
+        break;
+    case 'X':
+        _vt_erase(vt, vt->x, vt->y, ((cg_uint)(vt->x + a) > vt->width) ? vt->width : (cg_uint)(vt->x + a), vt->y);
+        break;
+    case 'm':
+        _vt_sgr(vt);
+        break;
+    default:
+        break;
+    }
+}
+
+size_t _vt_text_length(const cg_char *bytes, size_t length)
+{
+    // the text runs up to the next control character
+    size_t n = 0;
+    while (n < length && (unsigned char)bytes[n] >= 0x20 && bytes[n] != 0x7f)
+    {
+        n++;
+    }
+    return n;
+}
+
+size_t _vt_text(vt_t *vt, const cg_char *bytes, size_t length, size_t stop, bool more)
+{
+    // print the grapheme clusters of the text, at least up to stop, and
+    // if more text may follow hold back the last one, the next feed may
+    // add a combining mark or the rest of a utf-8 sequence to it
+    size_t end = length;
+    if (more)
+    {
+        // a utf-8 sequence cut off at the end is not decoded yet
+        for (size_t back = 1; back <= 3 && back <= length; back++)
+        {
+            unsigned char c = (unsigned char)bytes[length - back];
+            if ((c & 0xC0) != 0x80)
+            {
+                size_t need = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+                end = (need > back) ? length - back : length;
+                break;
+            }
+        }
+    }
+
+    size_t i = 0;
+    while (i < end && i < stop)
+    {
+        int width;
+        cg_uint len = _cg_utf8_grapheme(bytes + i, end - i, &width);
+        if (more && i + len == end)
+        {
+            break;
+        }
+        _vt_print(vt, bytes + i, len, width);
+        i += len;
+    }
+    if (more && i < length && length - i <= sizeof(vt->held))
+    {
+        memmove(vt->held, bytes + i, length - i);
+        vt->held_len = length - i;
+        return length;
+    }
+    return i;
+}
+
+void vt_feed(vt_t *vt, const cg_char *bytes, size_t length)
+{
+    vt->bytes += length;
+
+    // text held back by the last feed goes first, joined with the text
+    // this one starts with, as far as a cluster can reach
+    if (vt->held_len > 0 && length > 0)
+    {
+        cg_char joined[4 * _CG_GLYPH_MAX_BYTES];
+        size_t held = vt->held_len;
+        size_t run = _vt_text_length(bytes, length);
+        size_t take = (run < sizeof(joined) - held) ? run : sizeof(joined) - held;
+        memcpy(joined, vt->held, held);
+        memcpy(joined + held, bytes, take);
+        vt->held_len = 0;
+        size_t used = _vt_text(vt, joined, held + take, held, take == length);
+        bytes += used - held;
+        length -= used - held;
+    }
+
+    size_t i = 0;
+    while (i < length)
+    {
+        cg_char c = bytes[i];
+        switch (vt->state)
+        {
+        case _VT_GROUND:
+            if (c == '\033')
+            {
+                vt->state = _VT_ESCAPE;
+                vt->sequences++;
+                i++;
+            }
+            else if (c == '\r')
+            {
+                _vt_move(vt, 0, vt->y);
+                i++;
+            }
+            else if (c == '\n')
+            {
+                vt->wrap_pending = false;
+                _vt_line_feed(vt);
+                i++;
+            }
+            else if (c == '\b')
+            {
+                _vt_move(vt, (long)vt->x - 1, vt->y);
+                i++;
+            }
+            else if ((unsigned char)c < 0x20 || c == 0x7f)
+            {
+                i++;
+            }
+            else
+            {
+                size_t run = _vt_text_length(bytes + i, length - i);
+                i += _vt_text(vt, bytes + i, run, run, i + run == length);
+            }
+            break;
+        case _VT_ESCAPE:
+            i++;
+            if (c == '[')
+            {
+                vt->state = _VT_CSI;
+                vt->params_len = 0;
+            }
+            else if (c == ']')
+            {
+                vt->state = _VT_OSC;
+            }
+            else
+            {
+                // a two byte sequence, none of them change the grid
+                vt->state = _VT_GROUND;
+            }
+            break;
+        case _VT_CSI:
+            i++;
+            if (c >= 0x40 && c <= 0x7e)
+            {
+                _vt_csi(vt, c);
+                vt->state = _VT_GROUND;
+            }
+            else if (vt->params_len < sizeof(vt->params))
+            {
+                vt->params[vt->params_len++] = c;
+            }
+            break;
+        case _VT_OSC:
+            i++;
+            if (c == '\a')
+            {
+                vt->state = _VT_GROUND;
+            }
+            else if (c == '\033')
+            {
+                vt->state = _VT_OSC_ESCAPE;
+            }
+            break;
+        case _VT_OSC_ESCAPE:
+            i++;
+            vt->state = (c == '\\') ? _VT_GROUND : _VT_OSC;
+            break;
+        }
+    }
+}
+
+cg_uint vt_compare_canvas(vt_t *vt, cg_canvas_t *canvas, cg_uint *x, cg_uint *y)
+{
+    if (canvas->width != vt->width || canvas->height != vt->height)
+    {
+        return vt->width * vt->height;
+    }
+
+    cg_uint differ = 0;
+    for (cg_uint j = 0; j < vt->height; j++)
+    {
+        for (cg_uint i = 0; i < vt->width; i++)
+        {
+            cg_cell_t *cell = cg_get_cell(canvas, i, j);
+            vt_cell_t *shown = vt_cell(vt, i, j);
+            bool same = (cell->fg & 0xFFFFFF) == shown->fg && (cell->bg & 0xFFFFFF) == shown->bg;
+            if (cell->glyph == CG_GLYPH_CONTINUATION)
+            {
+                same = same && shown->continuation;
+            }
+            else
+            {
+                cg_uint len;
+                const cg_char *bytes = cg_glyph_bytes(cell->glyph, &len);
+                same = same && !shown->continuation && shown->len == len && memcmp(shown->bytes, bytes, len) == 0;
+            }
+            if (!same)
+            {
+                if (differ == 0 && x != NULL && y != NULL)
+                {
+                    *x = i;
+                    *y = j;
+                }
+                differ++;
+            }
+        }
+    }
+    return differ;
+}
+
+#endif // VT_IMPLEMENTATION
+
+#endif // __VT_H__
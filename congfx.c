@@ -0,0 +1,5 @@
+// The library compiled once, e.g. into libcongfx.a with make lib. Files
+// linking against it include congfx.h without defining
+// CONGFX_IMPLEMENTATION.
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
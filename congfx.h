@@ -89,6 +89,9 @@ pictures.
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 
 #if CG_PLATFORM_WINDOWS
 #include <windows.h>
@@ -98,21 +101,107 @@ pictures.
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <limits.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+// macOS has SO_NOSIGPIPE on the socket instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 #else
 #error Unsupported platform
 #endif
 
 // defaults
 #define _CG_DEFAULT_FPS 30 // times per second
+// frame time added to the fixed step accumulator is capped at this many
+// steps, so a long stall does not lead to a burst of catch up updates
+#define _CG_MAX_STEPS_PER_FRAME 8
 #define _CG_DEFAULT_BACKGROUND_CHAR ' '
-
+// waits for the terminal to take output are cut into steps of this many
+// milliseconds, so a terminal which stopped reading can not hold up a
+// shutdown, which waits at most _CG_SHUTDOWN_DRAIN_MS for it
+#define _CG_DRAIN_STEP_MS 100
+#define _CG_SHUTDOWN_DRAIN_MS 1000
+// a stream which has not taken its pending output in this many
+// milliseconds is taken as gone, and the output dropped
+#define _CG_STREAM_STALL_MS 1000
+
+// the allocator can be replaced by defining these before including the
+// library, e.g. to count allocations
+#ifndef _CG_CALLOC
 #define _CG_CALLOC calloc
+#endif
+#ifndef _CG_REALLOC
 #define _CG_REALLOC realloc
+#endif
+#ifndef _CG_FREE
 #define _CG_FREE free
+#endif
+
+// the globals are defined in the file with the implementation, every other
+// file including the header sees them as extern, so the library can be
+// compiled once, e.g. congfx.c into libcongfx.a, and linked from many files
+#ifdef CONGFX_IMPLEMENTATION
+#define _CG_EXTERN
+#define _CG_INIT(...) = __VA_ARGS__
+#else
+#define _CG_EXTERN extern
+#define _CG_INIT(...)
+#endif
+
+// kernels which gain from wider vectors are also compiled for avx2, the
+// loader picks the one the cpu runs. Builds for a given cpu, e.g. with
+// -march=native, have no need for it, nor do builds with CG_NO_DISPATCH.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && \
+    !defined(__AVX2__) && !defined(CG_NO_DISPATCH)
+#define _CG_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define _CG_KERNEL
+#endif
 
 #define _CG_TERM_COMMAND_BUFFER_START_SIZE 10 * 1024
 #define _CG_TERM_COMMAND_BUFFER_FLUSH_LIMIT (_CG_TERM_COMMAND_BUFFER_START_SIZE - 1)
 
+// glyph table limits, a glyph is one grapheme cluster stored as utf-8 bytes
+#define _CG_GLYPH_MAX_BYTES 14
+#define _CG_GLYPH_PAGE_SIZE 256
+#define _CG_GLYPH_MAX_PAGES 255
+#define _CG_GLYPH_HASH_START_SIZE 512
+
+// formatted text is built on the stack up to this size
+#define _CG_TEXTF_STACK_SIZE 256
+
+// parallel work is split in about this many tasks per worker
+#define _CG_POOL_TASKS_PER_WORKER 4
+// areas with fewer cells than this are not worth splitting
+#define _CG_POOL_MIN_PARALLEL_CELLS 2048
+// the frame encoder splits the rows in about this many bands per worker
+#define _CG_ENCODE_BANDS_PER_WORKER 2
+// starting size of a worker task queue, must be a power of two
+#define _CG_DEQUE_START_SIZE 64
+// job slot limits, slots are allocated a page at a time
+#define _CG_JOB_PAGE_SIZE 256
+#define _CG_JOB_MAX_PAGES 256
+
+// input events queued by the input thread, must be a power of two
+#define _CG_INPUT_RING_SIZE 1024
+// starting size of the list of input events for one frame
+#define _CG_INPUT_START_SIZE 128
+// bytes of terminal input read at once
+#define _CG_INPUT_READ_SIZE 4096
+// how long an escape sequence may take to arrive before the escape is
+// taken to be a key press on its own
+#define _CG_ESCAPE_TIMEOUT_MS 25
+// starting size of the buffer of a paste
+#define _CG_PASTE_START_SIZE 4096
+
 // Define some useful keys
 typedef enum
 {
@@ -124,9 +213,75 @@ typedef enum
     CG_KEY_UP,
     CG_KEY_DOWN,
     CG_KEY_RIGHT,
-    CG_KEY_LEFT
+    CG_KEY_LEFT,
+    CG_KEY_TAB,
+    CG_KEY_BACKSPACE,
+    CG_KEY_INSERT,
+    CG_KEY_DELETE,
+    CG_KEY_HOME,
+    CG_KEY_END,
+    CG_KEY_PAGE_UP,
+    CG_KEY_PAGE_DOWN,
+    CG_KEY_F1,
+    CG_KEY_F2,
+    CG_KEY_F3,
+    CG_KEY_F4,
+    CG_KEY_F5,
+    CG_KEY_F6,
+    CG_KEY_F7,
+    CG_KEY_F8,
+    CG_KEY_F9,
+    CG_KEY_F10,
+    CG_KEY_F11,
+    CG_KEY_F12,
+    CG_KEY_MOUSE, // a mouse event, see the mouse fields of the input
+    CG_KEY_PASTE  // pasted text, see the text of the input
 } cg_key_type_t;
 
+// Modifier keys held during a key press or mouse event, a mask
+typedef enum
+{
+    CG_MOD_NONE = 0,
+    CG_MOD_SHIFT = 1,
+    CG_MOD_ALT = 2,
+    CG_MOD_CTRL = 4
+} cg_key_mod_t;
+
+// What a mouse event reports
+typedef enum
+{
+    CG_MOUSE_NONE = 0,
+    CG_MOUSE_PRESS,
+    CG_MOUSE_RELEASE,
+    CG_MOUSE_DRAG, // moved with a button held
+    CG_MOUSE_MOVE, // moved with no button held, only in CG_MOUSE_ALL_MOTION
+    CG_MOUSE_WHEEL_UP,
+    CG_MOUSE_WHEEL_DOWN
+} cg_mouse_action_t;
+
+// Whether a key went down, repeated or went up
+typedef enum
+{
+    CG_KEY_PRESS = 0,
+    CG_KEY_REPEAT, // auto repeat, or pressed again while held
+    CG_KEY_RELEASE // only seen by the key state, never by cg_get_key_pressed
+} cg_key_action_t;
+
+typedef enum
+{
+    CG_MOUSE_LEFT = 0,
+    CG_MOUSE_MIDDLE,
+    CG_MOUSE_RIGHT
+} cg_mouse_button_t;
+
+// Which mouse events the terminal reports
+typedef enum
+{
+    CG_MOUSE_OFF = 0,
+    CG_MOUSE_BUTTONS,   // presses, releases, drags and the wheel
+    CG_MOUSE_ALL_MOTION // also moves with no button held
+} cg_mouse_mode_t;
+
 #define _CG_TERM_KEY_ESCAPE '\x1b'
 
 /*--------- BEGIN TYPE DEFINITIONS -----------*/
@@ -171,14 +326,54 @@ typedef struct
     cg_uint b;
 } cg_rgb_t;
 
+/**
+ * Define a colour type with an alpha (opacity) component,
+ * 0 is fully transparent and 255 fully opaque.
+ */
+typedef struct
+{
+    cg_uint r;
+    cg_uint g;
+    cg_uint b;
+    cg_uint a;
+} cg_rgba_t;
+
+/**
+ * A colour packed into 32 bits as 0x00RRGGBB, as stored in the cells.
+ */
+typedef uint32_t cg_colour32_t;
+
+/**
+ * Blend modes used when writing a translucent colour over a cell.
+ */
+typedef enum
+{
+    CG_BLEND_NORMAL = 0, // mix the colours by alpha
+    CG_BLEND_ADD,        // add the colour scaled by alpha, saturating
+    CG_BLEND_MULTIPLY    // multiply the colours, mixed by alpha
+} cg_blend_mode_t;
+
+/**
+ * A glyph id, an index into the interned glyph table.
+ * The ids 0-127 are reserved for the ASCII characters, so that
+ * a plain cg_char can be used as a glyph id directly.
+ */
+typedef uint16_t cg_glyph_t;
+
+/**
+ * The glyph id stored in the cell to the right of a double width glyph.
+ * The cell is covered by the wide glyph and is never written on its own.
+ */
+#define CG_GLYPH_CONTINUATION ((cg_glyph_t)0xFFFF)
+
 /**
  * Define a cell contents type
  */
 typedef struct
 {
-    cg_char c;
-    cg_rgb_t bg;
-    cg_rgb_t fg;
+    cg_colour32_t fg;
+    cg_colour32_t bg;
+    cg_glyph_t glyph;
 } cg_cell_t;
 
 /**
@@ -209,6 +404,20 @@ typedef struct
     size_t size;
 } _cg_term_command_buffer_t;
 
+/**
+ * A chunk of output, written out in order with the other chunks
+ * of a frame.
+ */
+#if CG_PLATFORM_POSIX
+typedef struct iovec _cg_iovec_t;
+#else
+typedef struct
+{
+    void *iov_base;
+    size_t iov_len;
+} _cg_iovec_t;
+#endif
+
 /*--------- END TYPE DEFINITIONS -----------*/
 
 /*--------- BEGIN PUBLIC FUNCTION PROTOTYPES -----------*/
@@ -282,6 +491,24 @@ void cg_set_cell_fg(cg_cell_t *cell, cg_rgb_t fg);
  */
 void cg_set_cell_char(cg_cell_t *cell, cg_char c);
 
+/**
+ * Get the glyph id of a cell.
+ *
+ * @param cell The cell to get the glyph of.
+ * @return The glyph id of the cell.
+ */
+cg_glyph_t cg_get_cell_glyph(cg_cell_t *cell);
+
+/**
+ * Set the glyph id of a cell.
+ * This only touches the given cell, use cg_point_glyph to draw wide
+ * glyphs so that the continuation cell is tracked.
+ *
+ * @param cell The cell to set the glyph of.
+ * @param glyph The glyph id to set.
+ */
+void cg_set_cell_glyph(cg_cell_t *cell, cg_glyph_t glyph);
+
 /**
  * Dispose of a cell.
  *
@@ -300,6 +527,38 @@ int cg_compare_cells(cg_cell_t *cell1, cg_cell_t *cell2);
 
 /*+++++++++ END Cell TYPE FUNCTIONS +++++++++*/
 
+/*+++++++++ BEGIN Glyph TYPE FUNCTIONS +++++++++*/
+
+/**
+ * Intern the first grapheme cluster of a utf-8 string in the glyph table.
+ * A grapheme here is a base character followed by any zero width
+ * characters (combining marks, variation selectors, zero width joiner
+ * sequences). Interning the same bytes again returns the same id.
+ *
+ * @param utf8 The utf-8 encoded string.
+ * @return The glyph id, or the id of '?' if the table is full.
+ */
+cg_glyph_t cg_intern_glyph(const cg_char *utf8);
+
+/**
+ * Get the display width (1 or 2 columns) of a glyph.
+ *
+ * @param glyph The glyph id.
+ * @return The number of terminal columns the glyph covers.
+ */
+cg_uint cg_glyph_width(cg_glyph_t glyph);
+
+/**
+ * Get the utf-8 bytes of a glyph.
+ *
+ * @param glyph The glyph id.
+ * @param len Set to the number of bytes (may be NULL).
+ * @return Pointer to the bytes in the glyph table (not null terminated).
+ */
+const cg_char *cg_glyph_bytes(cg_glyph_t glyph, cg_uint *len);
+
+/*+++++++++ END Glyph TYPE FUNCTIONS +++++++++*/
+
 /*+++++++++ BEGIN Canvas TYPE FUNCTIONS +++++++++*/
 
 /**
@@ -362,7 +621,26 @@ cg_uint cg_number_to_uinteger(cg_number x);
 // number utility functions
 
 /**
- * Generate a random integer between two values.
+ * Seed the random numbers. Every thread has a generator of its own, the
+ * calling thread and each worker draw their own reproducible sequence
+ * from the seed. Other threads are given a sequence of their own the
+ * first time they draw, in the order they do. Without a seed,
+ * cg_create_graphics seeds from the time.
+ *
+ * @param seed The seed.
+ */
+void cg_seed_random(uint64_t seed);
+
+/**
+ * Generate 32 random bits, from the generator of the calling thread.
+ *
+ * @return The random bits.
+ */
+uint32_t cg_rand_u32();
+
+/**
+ * Generate a random integer between two values, both included. Every
+ * value in the range is equally likely.
  *
  * @param from The lower bound of the random integer.
  * @param to The upper bound of the random integer.
@@ -370,6 +648,15 @@ cg_uint cg_number_to_uinteger(cg_number x);
  */
 int cg_rand_int(int from, int to);
 
+/**
+ * Fill a buffer with random bits in one pass, much faster than one call
+ * per value, e.g. the low 24 bits of each value make a random colour.
+ *
+ * @param out The buffer to fill.
+ * @param count The number of values.
+ */
+void cg_rand_fill(uint32_t *out, size_t count);
+
 /*+++++++++ END Number TYPE FUNCTIONS +++++++++*/
 
 /*+++++++++ BEGIN math FUNCTIONS +++++++++*/
@@ -426,13 +713,96 @@ void cg_begin_draw();
  */
 void cg_end_draw();
 
+/**
+ * Enable or disable the presentation thread.
+ * When enabled, cg_end_draw hands the finished canvas to a thread which
+ * encodes and writes it, and returns right away. A third canvas lets the
+ * next frame be drawn while the previous one is written; cg_end_draw only
+ * waits if the frame before that is still being written. The canvas the
+ * next frame is drawn on starts as a copy of the frame just finished, so
+ * programs which only draw what changed work as they do without it.
+ *
+ * @param enabled 1 to enable, 0 to disable (the default)
+ */
+void cg_set_present_thread(int enabled);
+
+/**
+ * Get the number of bytes of output the terminal has not taken yet.
+ * While this is not 0, new frames are skipped, and the next frame that
+ * is written only holds the changes since the last one written.
+ *
+ * @return The number of bytes waiting to be written.
+ */
+size_t cg_get_output_pending();
+
+/**
+ * Get the number of frames skipped because the terminal could not
+ * keep up.
+ *
+ * @return The number of frames skipped since the graphics were created.
+ */
+cg_uint cg_get_frames_skipped();
+
+/**
+ * The statistics kept for every frame. Times are in nanoseconds.
+ * The input statistics are only kept for frames with input. Without
+ * the input thread, input is read as the frame starts, so the wait for
+ * the frame is only seen with it.
+ */
+typedef enum
+{
+    CG_STAT_BEGIN,  // cg_begin_draw, reading input
+    CG_STAT_DRAW,   // between cg_begin_draw and cg_end_draw
+    CG_STAT_JOBS,   // waiting for the jobs of the frame
+    CG_STAT_ENCODE, // diffing the frame and encoding the changed cells
+    CG_STAT_WRITE,  // writing the frame to the terminal, or queueing what it does not take
+    CG_STAT_SLEEP,  // waiting for the next frame
+    CG_STAT_FRAME,  // the whole frame
+    CG_STAT_BYTES,  // bytes encoded for the frame, the terminal may not have taken them yet
+    CG_STAT_CELLS,  // cells changed in the frame
+    CG_STAT_INPUT_WAIT,    // from reading the oldest input of a frame to the frame taking it
+    CG_STAT_INPUT_LATENCY, // from reading the oldest input of a frame to the frame being written out
+    CG_STAT_COUNT
+} cg_stat_id_t;
+
+/**
+ * A summary of the recent values of one statistic.
+ */
+typedef struct
+{
+    uint64_t last;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+} cg_stat_t;
+
+/**
+ * Frame statistics over the most recent frames.
+ */
+typedef struct
+{
+    cg_stat_t stats[CG_STAT_COUNT]; // indexed by cg_stat_id_t
+    cg_uint frames;                 // frames the summaries are over
+    uint64_t total_bytes;           // bytes encoded since the graphics were created, see cg_get_output_pending
+    cg_uint frames_skipped;
+} cg_frame_stats_t;
+
+/**
+ * Get the timing of each phase of the recent frames, and how much
+ * output they took. With the presentation thread, the encode and write
+ * phases are timed on that thread.
+ *
+ * @return The frame statistics.
+ */
+cg_frame_stats_t cg_get_frame_stats();
+
 /**
  * Destroy the graphics system
  */
 void cg_destroy_graphics();
 
 /**
- * Exit the graphics system
+ * Exit the graphics system, safe to call from any thread
  */
 void cg_exit_graphics();
 
@@ -469,12 +839,127 @@ cg_uint cg_get_deltatime_millis();
 /*+++++++++ BEGIN Graphics FUNCTIONS +++++++++*/
 
 // Graphics System functions
+
+/**
+ * Switch to the event driven loop. cg_end_draw then waits until there
+ * is input, the redraw timer fires or a redraw is requested, instead of
+ * drawing the next frame right away. An idle loop uses no cpu.
+ * The frame rate still caps how often frames are drawn.
+ */
 void cg_no_loop();
 
+/**
+ * Switch back to drawing frames continuously, the default.
+ */
 void cg_loop();
 
+/**
+ * Ask for another frame to be drawn in the event driven loop. Can be
+ * called from any thread.
+ */
+void cg_request_redraw();
+
+/**
+ * Set a timer which draws a frame at a fixed interval in the event
+ * driven loop, for clocks and dashboards which change on their own.
+ *
+ * @param millis The interval in milliseconds, 0 to disable.
+ */
+void cg_redraw_every(cg_uint millis);
+
+/**
+ * The events a watched file descriptor can be ready for.
+ */
+typedef enum
+{
+    CG_FD_READ = 1,  // data can be read
+    CG_FD_WRITE = 2, // data can be written
+    CG_FD_ERROR = 4, // the fd hung up or failed, only ever reported
+} cg_fd_event_t;
+
+/**
+ * A callback for a watched file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param events The events it is ready for, a mask of cg_fd_event_t.
+ * @param userdata The pointer given to cg_watch_fd.
+ */
+typedef void (*cg_fd_fn)(int fd, int events, void *userdata);
+
+/**
+ * Watch a file descriptor, such as a pipe or a socket, from the draw
+ * loop. The callback runs on the draw thread when the fd is ready,
+ * always before the next frame is drawn: in cg_begin_draw, at most once
+ * while cg_end_draw waits for the next frame, and in the event driven
+ * loop, where it also wakes the loop to draw a frame.
+ * CG_FD_ERROR is reported once, after which the fd is no longer polled;
+ * the callback should then call cg_unwatch_fd.
+ * Watching an fd already watched replaces its events and callback.
+ *
+ * @param fd The file descriptor.
+ * @param events The events to wait for, a mask of CG_FD_READ and CG_FD_WRITE.
+ * @param fn The callback.
+ * @param userdata Passed to the callback.
+ * @return 0 if successful, -1 otherwise.
+ */
+int cg_watch_fd(int fd, int events, cg_fd_fn fn, void *userdata);
+
+/**
+ * Stop watching a file descriptor. Can be called from its callback.
+ *
+ * @param fd The file descriptor.
+ */
+void cg_unwatch_fd(int fd);
+
+/**
+ * Set the frame rate cg_end_draw paces the draw loop to. Frames are
+ * paced to absolute deadlines, so sleeping late one frame does not
+ * push back the frames after it. Can be changed while running.
+ *
+ * @param fps Frames per second, 0 to run as fast as possible.
+ */
 void cg_frame_rate(cg_uint fps);
 
+/**
+ * Set a fixed update step, independent of the frame rate. Each frame
+ * adds its time to an accumulator, cg_step then hands it out in fixed
+ * steps, so the simulation advances the same way at any frame rate:
+ *
+ *     cg_begin_draw();
+ *     while (cg_step())
+ *         update(cg_get_step_micros());
+ *     draw(cg_get_step_alpha());
+ *     cg_end_draw();
+ *
+ * Can be called before cg_create_graphics, or changed while running,
+ * which starts the accumulator over.
+ *
+ * @param hz Steps per second, 0 to disable.
+ */
+void cg_fixed_step(cg_uint hz);
+
+/**
+ * Take one fixed step from the accumulator, if a whole one is left.
+ *
+ * @return 1 if an update step should run, 0 otherwise.
+ */
+int cg_step();
+
+/**
+ * Get the length of a fixed step.
+ *
+ * @return The step length in microseconds.
+ */
+cg_uint cg_get_step_micros();
+
+/**
+ * Get how far the time is between the last step and the next one, to
+ * interpolate what is drawn between the two.
+ *
+ * @return The fraction of a step left in the accumulator, in [0, 1).
+ */
+double cg_get_step_alpha();
+
 // Terminal utility functions
 void cg_cls();
 
@@ -487,6 +972,50 @@ void cg_background(cg_rgb_t c);
 void cg_stroke(cg_rgb_t c);
 void cg_fill(cg_rgb_t c);
 void cg_set_colour(cg_rgb_t c);
+
+/**
+ * Set a translucent stroke colour, glyphs drawn with it blend
+ * their foreground with the foreground already in the cell.
+ *
+ * @param c The stroke colour with alpha
+ */
+void cg_stroke_rgba(cg_rgba_t c);
+
+/**
+ * Set a translucent fill colour, used by cg_fill_rect and cg_fade_rect.
+ *
+ * @param c The fill colour with alpha
+ */
+void cg_fill_rgba(cg_rgba_t c);
+
+/**
+ * Set the blend mode used for the stroke and fill colours.
+ *
+ * @param mode The blend mode
+ */
+void cg_blend_mode(cg_blend_mode_t mode);
+
+/**
+ * Blend the fill colour into the background of a rectangle of cells,
+ * leaving the glyphs and foreground as they are (e.g. highlight bars).
+ *
+ * @param x The x-coordinate of the top left cell
+ * @param y The y-coordinate of the top left cell
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ */
+void cg_fill_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h);
+
+/**
+ * Blend the fill colour into both the foreground and background of a
+ * rectangle of cells (e.g. fading out a region or the whole screen).
+ *
+ * @param x The x-coordinate of the top left cell
+ * @param y The y-coordinate of the top left cell
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ */
+void cg_fade_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h);
 void cg_show_canvas();
 void cg_swap_canvas();
 void cg_clear_canvas();
@@ -497,10 +1026,44 @@ void cg_clear_canvas();
 // drawing functions
 void cg_point(cg_uint x1, cg_uint y1);
 void cg_point_char(cg_uint x1, cg_uint y1, cg_char c);
+
+/**
+ * Draw a glyph at the given position using the stroke colour.
+ * A double width glyph also covers the cell to its right.
+ *
+ * @param x1 The x-coordinate
+ * @param y1 The y-coordinate
+ * @param glyph The glyph id to draw
+ */
+void cg_point_glyph(cg_uint x1, cg_uint y1, cg_glyph_t glyph);
+
 void cg_line(cg_uint x1, cg_uint y1, cg_uint x2, cg_uint y2);
 void cg_rect(cg_uint x1, cg_uint y1, cg_uint width, cg_uint height);
 void cg_text(cg_char *t, cg_uint x, cg_uint y);
 
+/**
+ * Draw the first len bytes of a utf-8 string.
+ * The string is clipped to the canvas once and the visible part is
+ * written as one span, it need not be null terminated.
+ *
+ * @param t The utf-8 string
+ * @param len The number of bytes to draw
+ * @param x The x-coordinate of the first character
+ * @param y The y-coordinate of the text
+ */
+void cg_text_n(const cg_char *t, cg_uint len, cg_uint x, cg_uint y);
+
+/**
+ * Draw printf style formatted text.
+ * Short strings are formatted on the stack, longer ones in a scratch
+ * buffer which is reused across calls, so no allocation happens per frame.
+ *
+ * @param x The x-coordinate of the first character
+ * @param y The y-coordinate of the text
+ * @param fmt The printf format string
+ */
+void cg_textf(cg_uint x, cg_uint y, const cg_char *fmt, ...);
+
 /**
  * Set the draw character used by drawing functions.
  *
@@ -515,1369 +1078,7552 @@ void cg_set_draw_char(cg_char c);
  */
 cg_char cg_get_draw_char();
 
+/**
+ * Set the draw glyph used by drawing functions.
+ *
+ * @param glyph The glyph id to use for drawing
+ */
+void cg_set_draw_glyph(cg_glyph_t glyph);
+
+/**
+ * Get the current draw glyph.
+ *
+ * @return The current draw glyph id
+ */
+cg_glyph_t cg_get_draw_glyph();
+
 /*========= END Graphics Drawing FUNCTIONS =========*/
 
 /*+++++++++ BEGIN Internal Drawing FUNCTIONS +++++++++*/
 
 /**
  * Internal implementation of point drawing.
- * If c is NULL, uses the current draw_char; otherwise uses the provided character.
+ * If c is NULL, uses the current draw_glyph; otherwise uses the provided character.
  *
  * @param x1 The x-coordinate
  * @param y1 The y-coordinate
- * @param c Pointer to character to draw, or NULL to use draw_char
+ * @param c Pointer to character to draw, or NULL to use draw_glyph
  */
 void _cg_point_impl(cg_uint x1, cg_uint y1, const cg_char *c);
 
+/**
+ * Write a glyph and colours into a canvas cell, keeping wide glyphs
+ * and their continuation cells consistent.
+ * The coordinates must be inside the canvas.
+ *
+ * @param canvas The canvas to write to
+ * @param x The x-coordinate
+ * @param y The y-coordinate
+ * @param glyph The glyph id to write
+ * @param fg The foreground colour
+ * @param bg The background colour
+ */
+void _cg_canvas_put(cg_canvas_t *canvas, cg_uint x, cg_uint y,
+                    cg_glyph_t glyph, cg_colour32_t fg, cg_colour32_t bg);
+
+/**
+ * Get the foreground colour for a glyph drawn over a cell with the
+ * current stroke colour, blend mode and alpha.
+ *
+ * @param dst The current foreground colour of the cell
+ * @return The new foreground colour
+ */
+cg_colour32_t _cg_stroke_over(cg_colour32_t dst);
+
 /*+++++++++ END Internal Drawing FUNCTIONS +++++++++++*/
 
 /*+++++++++ END Graphics FUNCTIONS +++++++++*/
 
-/*+++++++++ BEGIN Input FUNCTIONS +++++++++*/
-
-typedef struct
-{
-    cg_key_type_t key;
-    cg_char char_value;
-} cg_keyboard_input_t;
+/*+++++++++ BEGIN Shader FUNCTIONS +++++++++*/
 
-cg_keyboard_input_t cg_get_key_pressed();
-int cg_is_key_pressed(cg_key_type_t key);
+/**
+ * A cell shader, computes the glyph, fg and bg of one cell.
+ * The cell holds the current contents when the shader is called.
+ * Shaders run on worker threads, several at a time, so they must
+ * only touch the cell they are given.
+ *
+ * @param x The x-coordinate of the cell
+ * @param y The y-coordinate of the cell
+ * @param cell The cell to write
+ * @param userdata The userdata passed to cg_shade
+ */
+typedef void (*cg_shader_fn)(cg_uint x, cg_uint y, cg_cell_t *cell, void *userdata);
 
-/*+++++++++ END Input FUNCTIONS +++++++++*/
+/**
+ * A row shader, computes n consecutive cells of one row.
+ *
+ * @param x The x-coordinate of the first cell
+ * @param y The y-coordinate of the row
+ * @param n The number of cells
+ * @param cells The cells to write
+ * @param userdata The userdata passed to cg_shade_rows
+ */
+typedef void (*cg_row_shader_fn)(cg_uint x, cg_uint y, cg_uint n, cg_cell_t *cells, void *userdata);
 
-/*--------- END PUBLIC FUNCTION PROTOTYPES -----------*/
+/**
+ * Pack a colour for writing into cell fg/bg from a shader.
+ *
+ * @param r The red component (0-255)
+ * @param g The green component (0-255)
+ * @param b The blue component (0-255)
+ * @return The packed colour
+ */
+cg_colour32_t cg_rgb32(cg_uint r, cg_uint g, cg_uint b);
 
-/*--------- BEGIN PUBLIC VARIABLES -----------*/
+/**
+ * Run a cell shader over a rectangle of the canvas.
+ * The rows are split in bands which are shaded in parallel on the worker
+ * pool, writing directly into the canvas. Returns when all cells are done.
+ *
+ * @param x The x-coordinate of the top left cell
+ * @param y The y-coordinate of the top left cell
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ * @param fn The shader
+ * @param userdata Passed to the shader
+ */
+void cg_shade(cg_uint x, cg_uint y, cg_uint w, cg_uint h, cg_shader_fn fn, void *userdata);
 
-cg_uint width;
-cg_uint height;
+/**
+ * Run a row shader over a rectangle of the canvas, see cg_shade.
+ *
+ * @param x The x-coordinate of the top left cell
+ * @param y The y-coordinate of the top left cell
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ * @param fn The row shader, called once per row
+ * @param userdata Passed to the shader
+ */
+void cg_shade_rows(cg_uint x, cg_uint y, cg_uint w, cg_uint h, cg_row_shader_fn fn, void *userdata);
 
-/*--------- END PUBLIC VARIABLES -----------*/
+/**
+ * Set the number of threads used for parallel work, including the
+ * calling thread. 0 (the default) uses one per cpu, 1 runs everything
+ * on the calling thread.
+ *
+ * @param n The number of threads
+ */
+void cg_set_worker_count(cg_uint n);
 
-/*--------- BEGIN PRIVATE VARIABLES -----------*/
-
-// system variables
-
-typedef struct
-{
-    cg_char read_buf[20];
-    cg_keyboard_input_t keys_pressed[128];
-    cg_uint key_counter;
-    struct timespec start_time, prev_time, current_time, after_draw_time;
-    cg_uint delta_time_ideal;
-    cg_uint dt;
-    cg_uint should_exit;
-#if CG_PLATFORM_WINDOWS
-    DWORD _cg_orig_in_mode;
-    HANDLE _cg_hin;
-    HANDLE _cg_hout;
-    LARGE_INTEGER _cg_qpc_freq;
-#endif
-} _cg_graphics_context_t;
+/**
+ * Get the number of threads used for parallel work, including the
+ * calling thread.
+ *
+ * @return The number of threads
+ */
+cg_uint cg_get_worker_count();
 
-_cg_graphics_context_t *_cg_gfx_context = NULL;
-
-int _loop = 1;
-cg_uint _fps = _CG_DEFAULT_FPS;
-cg_char background_char = _CG_DEFAULT_BACKGROUND_CHAR;
-cg_char draw_char = '#';
-cg_rgb_t default_bg_colour = {0, 0, 0};
-cg_rgb_t default_fg_colour = {255, 255, 255};
-cg_rgb_t background_colour = {0, 0, 0};
-cg_rgb_t stroke_colour = {255, 255, 255};
-cg_rgb_t fill_colour = {255, 255, 255};
-// canvas variables for the current and previous canvas
-cg_canvas_t *canvas_previous = NULL;
-cg_canvas_t *canvas_current = NULL;
+/*+++++++++ END Shader FUNCTIONS +++++++++*/
 
-// command buffer for the terminal
-_cg_term_command_buffer_t *_cg_buffer = NULL;
+/*+++++++++ BEGIN Job FUNCTIONS +++++++++*/
 
+/**
+ * A handle to a submitted job. A zeroed handle refers to no job and
+ * always reads as done.
+ */
 typedef struct
 {
-    cg_char str[4];
-    size_t len;
-} _cg_num_str_t;
+    cg_uint index;
+    cg_uint generation;
+} cg_job_t;
 
-_cg_num_str_t _cg_num_lookup[256];
-
-/*--------- END PRIVATE VARIABLES -----------*/
+/**
+ * A job function.
+ *
+ * @param userdata The pointer passed to cg_job_submit.
+ */
+typedef void (*cg_job_fn)(void *userdata);
 
-/*--------- BEGIN INTERNAL FUNCTION PROTOTYPES -----------*/
+/**
+ * A range function for cg_parallel_for, called for [begin, end).
+ *
+ * @param begin The first index.
+ * @param end One past the last index.
+ * @param userdata The pointer passed to cg_parallel_for.
+ */
+typedef void (*cg_range_fn)(cg_uint begin, cg_uint end, void *userdata);
 
-// Internal terminal utility functions
 /**
- * Enable raw mode for the terminal.
- * see https://viewsourcecode.org/snaptoken/kilo/02.enteringRawMode.html
+ * Split [0, count) in ranges and run fn on them on the worker threads
+ * and the calling thread, returning when all of them are done. Can be
+ * called from within jobs.
+ *
+ * @param count The number of indices.
+ * @param grain The most indices in one range, 0 to pick a size which
+ *              gives every worker a few ranges.
+ * @param fn The range function.
+ * @param userdata Passed to fn.
  */
-void _cg_term_enable_raw_mode();
+void cg_parallel_for(cg_uint count, cg_uint grain, cg_range_fn fn, void *userdata);
 
 /**
- * Disable raw mode for the terminal.
- * see https://viewsourcecode.org/snaptoken/kilo/02.enteringRawMode.html
+ * Submit a job to run on the worker threads once all of its
+ * dependencies are done.
+ *
+ * @param fn The job function.
+ * @param userdata Passed to fn.
+ * @param deps The jobs to wait for, may be NULL if dep_count is 0.
+ * @param dep_count The number of jobs in deps.
+ * @return A handle to the job.
  */
-void _cg_term_disable_raw_mode();
+cg_job_t cg_job_submit(cg_job_fn fn, void *userdata, const cg_job_t *deps, cg_uint dep_count);
 
-// Platform specific versions
-#if CG_PLATFORM_WINDOWS
-void _cg_win_term_enable_raw_mode();
-void _cg_win_term_disable_raw_mode();
-int _cg_win_get_cursor_position(int *rows, int *cols);
-int _cg_win_get_window_size(int *rows, int *cols);
-void _cg_win_read_key();
+/**
+ * Check if a job is done.
+ *
+ * @param job The job.
+ * @return 1 if the job is done, 0 otherwise.
+ */
+int cg_job_done(cg_job_t job);
 
-void _cg_win_time_init(void)
-{
-    QueryPerformanceFrequency(&(_cg_gfx_context->_cg_qpc_freq));
-}
+/**
+ * Wait for a job to be done, running other jobs in the meantime.
+ *
+ * @param job The job.
+ */
+void cg_job_wait(cg_job_t job);
 
-void _cg_win_clock_gettime(struct timespec *ts)
-{
-    LARGE_INTEGER counter;
-    QueryPerformanceCounter(&counter);
+/**
+ * Wait for all submitted jobs to be done, running jobs in the meantime.
+ * cg_end_draw calls this before showing the frame.
+ */
+void cg_wait_jobs();
 
-    double seconds = (double)counter.QuadPart /
-                     (double)((_cg_gfx_context->_cg_qpc_freq).QuadPart);
+/*+++++++++ END Job FUNCTIONS +++++++++*/
 
-    ts->tv_sec = (time_t)seconds;
-    ts->tv_nsec = (long)((seconds - ts->tv_sec) * 1e9);
-}
+/*+++++++++ BEGIN Input FUNCTIONS +++++++++*/
 
-int _cg_win_nanosleep(const struct timespec *req, struct timespec *rem)
+/**
+ * An input event, a key press or a mouse event.
+ * Control characters are reported as the letter with CG_MOD_CTRL, and
+ * keys typed with alt held as the key with CG_MOD_ALT.
+ */
+typedef struct
 {
-    (void)rem; // Windows Sleep has no remaining-time reporting
-
-    DWORD ms =
-        (DWORD)(req->tv_sec * 1000 +
-                req->tv_nsec / 1000000);
-
-    Sleep(ms);
-    return 0;
-}
-
-#endif
+    cg_key_type_t key;
+    cg_char char_value;
+    int modifiers;            // a mask of cg_key_mod_t
+    cg_key_action_t action;   // a first press or a repeat
+    uint64_t time;            // when it was read, monotonic nanoseconds
+    cg_mouse_action_t mouse;  // for CG_KEY_MOUSE
+    cg_mouse_button_t button; // the button pressed, released or dragged
+    cg_uint x;                // the cell of a mouse event
+    cg_uint y;
+    cg_char *text;            // the text of a CG_KEY_PASTE, valid until the next cg_begin_draw
+    size_t text_length;
+} cg_keyboard_input_t;
 
-#if CG_PLATFORM_POSIX
-void _cg_posix_term_enable_raw_mode();
-void _cg_posix_term_disable_raw_mode();
-int _cg_posix_get_cursor_position(int *rows, int *cols);
-int _cg_posix_get_window_size(int *rows, int *cols);
-void _cg_posix_read_key();
+cg_keyboard_input_t cg_get_key_pressed();
 
-struct termios orig_termios;
-int _cg_term_orig_flags;
+/**
+ * Check if a key was pressed, or repeated, this frame.
+ *
+ * @param key The key, CG_KEY_ALPHANUM for any character key, see
+ *            cg_is_char_pressed for a given one.
+ * @return 1 if it was pressed, 0 otherwise.
+ */
+int cg_is_key_pressed(cg_key_type_t key);
 
-#endif
+/**
+ * Check if a key is held down.
+ * Terminals which only report presses are tracked by the key repeat,
+ * a key is held until it has not repeated for a while, see
+ * cg_set_key_repeat. Terminals with the kitty keyboard protocol, and
+ * the Windows console, report releases and are tracked exactly.
+ *
+ * @param key The key.
+ * @return 1 if it is held, 0 otherwise.
+ */
+int cg_is_key_held(cg_key_type_t key);
 
 /**
- * Create a new command buffer for the terminal.
+ * Check if a key was released this frame.
  *
- * @param buffer The command buffer to create.
- * @return 0 if successful, -1 otherwise.
+ * @param key The key.
+ * @return 1 if it was released, 0 otherwise.
  */
-int _cg_term_create_command_buffer(_cg_term_command_buffer_t **buffer);
+int cg_is_key_released(cg_key_type_t key);
 
 /**
- * Expand the command buffer for the terminal.
+ * Check if a character key was pressed, or repeated, this frame.
+ * Letters are matched without case.
  *
- * @param buffer The command buffer to expand.
- * @param more_required The additional space required.
- * @return 0 if successful, -1 otherwise.
+ * @param c The character.
+ * @return 1 if it was pressed, 0 otherwise.
  */
-int _cg_term_expand_command_buffer(_cg_term_command_buffer_t *buffer, size_t more_required);
+int cg_is_char_pressed(cg_char c);
 
 /**
- * Dispose of a command buffer for the terminal.
+ * Check if a character key is held down, see cg_is_key_held.
  *
- * @param buffer The command buffer to dispose of.
+ * @param c The character.
+ * @return 1 if it is held, 0 otherwise.
  */
-void _cg_term_dispose_command_buffer(_cg_term_command_buffer_t *buffer);
+int cg_is_char_held(cg_char c);
 
 /**
- * Add a command to the command buffer for the terminal.
+ * Check if a character key was released this frame.
  *
- * @param buffer The command buffer to add to.
- * @param command The command to add.
- * @param length The length of the command. (if 0, then the length is calculated)
- * @return 0 if successful, -1 otherwise.
+ * @param c The character.
+ * @return 1 if it was released, 0 otherwise.
  */
-int _cg_term_buffer_command(_cg_term_command_buffer_t *buffer,
-                            cg_string command, size_t length);
+int cg_is_char_released(cg_char c);
 
 /**
- * Flush the command buffer for the terminal.
- * The commands are written to the terminal, and the buffer is reset.
+ * Set the key repeat timing used to tell when a key is let go on
+ * terminals which do not report releases. A key pressed once is held
+ * for the delay, a key repeating for the interval after each repeat.
+ * Both should be a bit longer than the keyboard's own settings.
  *
- * @param buffer The command buffer to flush.
- * @return 0 if successful, -1 otherwise.
+ * @param delay_ms The time before a key starts repeating, 600 by default.
+ * @param interval_ms The time between repeats, 100 by default.
  */
-int _cg_term_flush_command_buffer(_cg_term_command_buffer_t *buffer);
+void cg_set_key_repeat(cg_uint delay_ms, cg_uint interval_ms);
 
 /**
- * Reset the terminal to its default state.
+ * Enable or disable the input thread.
+ * When enabled, a thread waits on the terminal and queues key presses
+ * as they arrive, instead of reading them once per frame in
+ * cg_begin_draw. cg_get_key_pressed also picks up keys which arrived
+ * after the frame started.
+ *
+ * @param enabled 1 to enable, 0 to disable (the default)
  */
-void _cg_term_reset();
+void cg_set_input_thread(int enabled);
 
-void _cg_term_set_foreground_colour(cg_rgb_t colour);
+/**
+ * Choose which mouse events the terminal reports, as CG_KEY_MOUSE
+ * inputs. Motion is coalesced, a burst of moves read at once is
+ * reported as the last one.
+ *
+ * @param mode The mouse mode, CG_MOUSE_OFF by default.
+ */
+void cg_set_mouse(cg_mouse_mode_t mode);
 
-void _cg_term_set_background_colour(cg_rgb_t colour);
+/*+++++++++ END Input FUNCTIONS +++++++++*/
 
-void _cg_term_move_to(cg_uint x, cg_uint y);
+/*+++++++++ BEGIN Headless FUNCTIONS +++++++++*/
 
-void _cg_term_write_char(cg_char c);
+/**
+ * Run without a terminal, for tests, benchmarks and services. The
+ * graphics have a fixed size, raw mode and the terminal are left
+ * alone, and the frames are encoded exactly as for a terminal and
+ * written to a memory buffer or to a file descriptor. Input only comes
+ * from cg_headless_input. Call before cg_create_graphics.
+ *
+ * @param width The width in cells, 0 to go back to the terminal.
+ * @param height The height in cells, 0 to go back to the terminal.
+ * @param fd The file descriptor to write to, -1 for the memory buffer.
+ *           Only the memory buffer is supported on Windows.
+ * @return 0 if successful, -1 otherwise.
+ */
+int cg_set_headless(cg_uint width, cg_uint height, int fd);
 
-void _cg_hide_cursor();
+/**
+ * Get the output written to the memory buffer of the headless backend.
+ *
+ * @param length Set to the number of bytes, may be NULL.
+ * @return The output, valid until the next frame is written.
+ */
+const cg_char *cg_get_headless_output(size_t *length);
 
-void _cg_show_cursor();
+/**
+ * Empty the memory buffer of the headless backend.
+ */
+void cg_clear_headless_output();
 
 /**
- * Get the cursor position in the terminal.
- * see https://viewsourcecode.org/snaptoken/kilo/03.rawInputAndOutput.html#window-size-the-hard-way
- * @param rows The row position of the cursor.
- * @param cols The column position of the cursor.
+ * Queue input for the headless backend, as the bytes a terminal would
+ * send. It is decoded by the next cg_begin_draw, escape sequences must
+ * be given whole. Call from the draw thread.
+ *
+ * @param bytes The input.
+ * @param length The number of bytes.
  * @return 0 if successful, -1 otherwise.
  */
-int _cg_get_cursor_position(int *rows, int *cols);
+int cg_headless_input(const cg_char *bytes, size_t length);
+
+/*+++++++++ END Headless FUNCTIONS +++++++++*/
+
+/*+++++++++ BEGIN Backend FUNCTIONS +++++++++*/
 
 /**
- * Get the window size of the terminal.
- * see https://viewsourcecode.org/snaptoken/kilo/03.rawInputAndOutput.html#window-size-the-hard-way
- * @param rows The number of rows in the terminal.
- * @param cols The number of columns in the terminal.
- * @return 0 if successful, -1 otherwise.
+ * Draw on a terminal other than the one the program was started in,
+ * e.g. a pty the program opened, or /dev/tty when stdin and stdout are
+ * redirected. The terminal is read and written, put in raw mode and
+ * its size read, just as stdin and stdout are, and its settings are
+ * restored when the program exits. Call before cg_create_graphics.
+ *
+ * @param fd The terminal, -1 to go back to stdin and stdout.
+ * @return 0 if successful, -1 if fd is not a terminal. Only stdin and
+ *         stdout are supported on Windows.
  */
-int _cg_get_window_size(int *rows, int *cols);
+int cg_set_terminal(int fd);
 
 /**
- * Read a key press from the terminal.
+ * Draw over a stream, a connected unix domain socket or a pair of
+ * pipes, for a client at the other end to show on its terminal. The
+ * client sends the bytes its terminal sends as input. Both fds are
+ * non-blocking while the graphics run, cg_destroy_graphics gives them
+ * the flags they had back. Frames are handed to the kernel straight from
+ * the buffers they were encoded in, with sendmsg on a socket. When the
+ * client hangs up, cg_should_exit returns 1; a pipe raises SIGPIPE
+ * unless it is ignored. Call before cg_create_graphics.
+ *
+ * @param in_fd The fd input is read from, -1 for no input.
+ * @param out_fd The fd the frames are written to, may be in_fd.
+ * @param width The width of the client terminal in cells.
+ * @param height The height of the client terminal in cells.
+ * @return 0 if successful, -1 otherwise. Not supported on Windows.
  */
-void _cg_read_key();
+int cg_set_stream(int in_fd, int out_fd, cg_uint width, cg_uint height);
 
-// internal functions
+/*+++++++++ END Backend FUNCTIONS +++++++++*/
+
+/*+++++++++ BEGIN Recording FUNCTIONS +++++++++*/
 
 /**
- * Calculate the difference in time between two timespec structures.
+ * Record everything written to the terminal, with the time it was
+ * written, to an asciicast v2 file. Each write, usually a whole frame,
+ * is one output event. The recording can be played back with any
+ * asciicast player, or with bench/replay as fast as possible. Bytes
+ * which are not UTF-8 are written as \u0080 to \u00ff, which the header
+ * marks as single bytes; bench/replay writes them back as they were,
+ * other players show them as Latin-1.
  *
- * @param time1 The first time.
- * @param time2 The second time.
- * @return The difference in time in microseconds.
+ * @param path The file to record to, it is overwritten.
+ * @return 0 if successful, -1 otherwise.
  */
-cg_uint _diff_time_micros(struct timespec time1, struct timespec time2);
+int cg_record_start(const cg_char *path);
 
-void _cg_clock_get_time(struct timespec *t);
+/**
+ * Stop recording and close the recording file.
+ */
+void cg_record_stop();
 
-void _cg_init_num_lookup();
+/*+++++++++ END Recording FUNCTIONS +++++++++*/
 
-/*--------- END INTERNAL FUNCTION PROTOTYPES -----------*/
+/*--------- END PUBLIC FUNCTION PROTOTYPES -----------*/
 
-#ifdef CONGFX_IMPLEMENTATION
+/*--------- BEGIN PUBLIC VARIABLES -----------*/
 
-int cg_compare_colour(cg_rgb_t colour1, cg_rgb_t colour2)
-{
-    if (colour1.r != colour2.r || colour1.g != colour2.g || colour1.b != colour2.b)
-    {
-        return -1;
-    }
-    return 0;
-}
+_CG_EXTERN cg_uint width;
+_CG_EXTERN cg_uint height;
 
-cg_cell_t *cg_make_cell(cg_char c, cg_rgb_t bg, cg_rgb_t fg)
-{
-    cg_cell_t *cell = (cg_cell_t *)_CG_CALLOC(1, sizeof(cg_cell_t));
-    if (cell == NULL)
-    {
-        printf("FATAL Error: Unable to allocate cg_cell_t.\n");
-        exit(-1);
-    }
-    cell->c = c;
-    cell->bg = bg;
-    cell->fg = fg;
-    return cell;
-}
+/*--------- END PUBLIC VARIABLES -----------*/
 
-cg_rgb_t cg_get_cell_bg(cg_cell_t *cell)
-{
-    if (cell != NULL)
-    {
-        return cell->bg;
-    }
-    return (cg_rgb_t){0, 0, 0};
-}
+/*--------- BEGIN PRIVATE VARIABLES -----------*/
 
-cg_rgb_t cg_get_cell_fg(cg_cell_t *cell)
-{
-    if (cell != NULL)
-    {
-        return cell->fg;
-    }
-    return (cg_rgb_t){255, 255, 255};
-}
+// system variables
 
-cg_char cg_get_cell_char(cg_cell_t *cell)
+typedef struct
 {
-    if (cell != NULL)
-    {
-        return cell->c;
-    }
-    return ' ';
-}
+    cg_char read_buf[20];
+    cg_keyboard_input_t *keys_pressed; // key presses for this frame
+    cg_uint key_count;
+    cg_uint key_capacity;
+    cg_uint key_counter; // next key returned by cg_get_key_pressed
+    struct timespec start_time, prev_time, current_time, after_draw_time;
+    uint64_t frame_period;   // nanoseconds per frame, 0 when unthrottled
+    uint64_t frame_deadline; // monotonic nanoseconds the current frame ends at
+    uint64_t step_period;    // nanoseconds per fixed step, 0 when disabled
+    uint64_t step_accumulator;
+    cg_uint dt;
+    atomic_uint should_exit; // set from any thread, the stream may hang up on one
+#if CG_PLATFORM_WINDOWS
+    DWORD _cg_orig_in_mode;
+    HANDLE _cg_hin;
+    HANDLE _cg_hout;
+    LARGE_INTEGER _cg_qpc_freq;
+#endif
+} _cg_graphics_context_t;
 
-void cg_set_cell_bg(cg_cell_t *cell, cg_rgb_t bg)
-{
-    if (cell != NULL)
-    {
-        cell->bg = bg;
-    }
-}
+_CG_EXTERN _cg_graphics_context_t *_cg_gfx_context _CG_INIT(NULL);
 
-void cg_set_cell_fg(cg_cell_t *cell, cg_rgb_t fg)
+// threading primitives
+#if CG_PLATFORM_WINDOWS
+typedef HANDLE _cg_thread_t;
+typedef SRWLOCK _cg_mutex_t;
+typedef CONDITION_VARIABLE _cg_cond_t;
+#define _CG_MUTEX_INITIALIZER SRWLOCK_INIT
+#define _CG_COND_INITIALIZER CONDITION_VARIABLE_INIT
+#elif CG_PLATFORM_POSIX
+typedef pthread_t _cg_thread_t;
+typedef pthread_mutex_t _cg_mutex_t;
+typedef pthread_cond_t _cg_cond_t;
+#define _CG_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define _CG_COND_INITIALIZER PTHREAD_COND_INITIALIZER
+#endif
+
+/**
+ * A task run by the worker pool, called once for every index.
+ */
+typedef void (*_cg_pool_task_fn)(void *ctx, cg_uint index);
+
+/**
+ * A unit of work in a worker deque, run(arg, begin, end).
+ */
+typedef struct
 {
-    if (cell != NULL)
-    {
-        cell->fg = fg;
-    }
-}
+    void (*run)(void *arg, cg_uint begin, cg_uint end);
+    void *arg;
+    cg_uint begin;
+    cg_uint end;
+} _cg_task_t;
+
+/**
+ * A double ended queue of tasks. The owning thread pushes and pops at
+ * the bottom, other threads steal the oldest tasks from the top.
+ */
+typedef struct
+{
+    _cg_mutex_t lock;
+    _cg_task_t *tasks;
+    cg_uint capacity; // a power of two
+    cg_uint top;
+    cg_uint bottom;
+} _cg_deque_t;
+
+/**
+ * The worker pool. Every worker has a deque of tasks, threads outside
+ * the pool push to a shared one. Idle workers steal from the others,
+ * threads waiting for work to finish run tasks in the meantime.
+ */
+typedef struct
+{
+    _cg_thread_t *threads;
+    cg_uint thread_count;
+    cg_uint requested; // requested thread count including the caller, 0 for auto
+    bool started;
+    bool shutdown;
+    _cg_mutex_t start_lock; // held while starting or stopping the workers
+    _cg_mutex_t lock;
+    _cg_cond_t cond; // signalled when tasks are queued or work finishes
+    _cg_deque_t *deques; // one per worker
+    _cg_deque_t inject; // tasks from threads outside the pool
+    atomic_uint queued; // tasks in all the deques
+} _cg_pool_t;
+
+_CG_EXTERN _cg_pool_t _cg_pool _CG_INIT({
+    .start_lock = _CG_MUTEX_INITIALIZER,
+    .lock = _CG_MUTEX_INITIALIZER,
+    .cond = _CG_COND_INITIALIZER,
+    .inject = {.lock = _CG_MUTEX_INITIALIZER}});
+
+// index of the worker deque owned by this thread, -1 outside the pool
+#if defined(_MSC_VER)
+_CG_EXTERN __declspec(thread) int _cg_worker_index _CG_INIT(-1);
+#else
+_CG_EXTERN _Thread_local int _cg_worker_index _CG_INIT(-1);
+#endif
+
+// lanes of the batch generator, run side by side so they vectorise
+#define _CG_RAND_LANES 4
+
+/**
+ * The random number generator of a thread, xoshiro256**, with a set of
+ * independent lanes for filling buffers.
+ */
+typedef struct
+{
+    uint64_t s[4];
+    uint64_t lanes[4][_CG_RAND_LANES]; // lanes[i][j] is word i of lane j
+    uint64_t generation;               // the seed the state is from
+} _cg_rand_t;
+
+// the seed every thread generator starts from, bumping the generation
+// has each thread reseed before its next number
+_CG_EXTERN uint64_t _cg_rand_seed;
+_CG_EXTERN atomic_uint_fast64_t _cg_rand_generation _CG_INIT(1);
+_CG_EXTERN bool _cg_rand_seeded;
+
+// streams of threads outside the pool are numbered from here up, in the
+// order they first draw, the workers keep the streams of their index
+#define _CG_RAND_THREAD_STREAMS (1ULL << 32)
+_CG_EXTERN atomic_uint_fast64_t _cg_rand_streams;
+
+#if defined(_MSC_VER)
+_CG_EXTERN __declspec(thread) _cg_rand_t _cg_rand;
+_CG_EXTERN __declspec(thread) uint64_t _cg_rand_stream;
+#else
+_CG_EXTERN _Thread_local _cg_rand_t _cg_rand;
+_CG_EXTERN _Thread_local uint64_t _cg_rand_stream;
+#endif
+
+/**
+ * A batch of tasks from one parallel for, the caller waits until
+ * remaining drops to zero.
+ */
+typedef struct
+{
+    cg_range_fn range_fn;
+    _cg_pool_task_fn index_fn;
+    void *ctx;
+    atomic_uint remaining;
+} _cg_batch_t;
+
+/**
+ * A job slot. Slots are reused, the generation is bumped when a job
+ * finishes so older handles to the slot read as done.
+ */
+typedef struct
+{
+    cg_job_fn fn;
+    void *userdata;
+    atomic_uint generation;
+    cg_uint pending; // unfinished dependencies
+    cg_uint *dependents; // slots waiting on this job
+    cg_uint dependent_count;
+    cg_uint dependent_capacity;
+    cg_uint next_free; // next free slot + 1, 0 for none
+} _cg_job_slot_t;
+
+/**
+ * The job slots, in pages which never move once allocated.
+ */
+typedef struct
+{
+    _cg_mutex_t lock;
+    _cg_job_slot_t *pages[_CG_JOB_MAX_PAGES];
+    cg_uint page_count;
+    cg_uint free_head; // first free slot + 1, 0 for none
+    atomic_uint outstanding; // jobs submitted and not finished
+} _cg_jobs_t;
+
+_CG_EXTERN _cg_jobs_t _cg_jobs _CG_INIT({.lock = _CG_MUTEX_INITIALIZER});
+
+// guards the glyph table, glyphs can be interned from shaders
+_CG_EXTERN _cg_mutex_t _cg_glyph_lock _CG_INIT(_CG_MUTEX_INITIALIZER);
+
+// frame statistics are kept for this many frames
+#define _CG_STATS_WINDOW 256
+
+/**
+ * The recent values of every frame statistic, in rings.
+ */
+typedef struct
+{
+    _cg_mutex_t lock;
+    uint64_t samples[CG_STAT_COUNT][_CG_STATS_WINDOW];
+    cg_uint count[CG_STAT_COUNT]; // values recorded, the ring position
+    uint64_t total_bytes;
+    uint64_t mark; // when the phase being timed started
+    uint64_t frame_input; // when the oldest input of this frame was read, 0 if none
+} _cg_stats_t;
+
+_CG_EXTERN _cg_stats_t _cg_stats _CG_INIT({.lock = _CG_MUTEX_INITIALIZER});
+
+// guards the command buffer and terminal output, the presentation
+// thread writes frames while the draw thread may queue commands
+_CG_EXTERN _cg_mutex_t _cg_out_lock _CG_INIT(_CG_MUTEX_INITIALIZER);
+
+/**
+ * Output the terminal has not taken yet. Writes never block, whatever
+ * does not fit is kept here and written before anything else.
+ */
+typedef struct
+{
+    _cg_term_command_buffer_t *pending;
+    size_t offset; // bytes of pending already written
+    cg_uint frames_skipped;
+    bool full_redraw; // the next frame is written in full
+    bool stale; // the last frame was skipped, the terminal is behind
+    uint64_t input_unwritten; // the oldest input of the frames skipped
+    uint64_t input_writing;   // the oldest input of the frame in pending
+} _cg_output_t;
+
+_CG_EXTERN _cg_output_t _cg_output _CG_INIT({.full_redraw = true});
+
+/**
+ * The operations of a backend, where the graphics read and write: a
+ * terminal, the headless backend, or a stream to a client over pipes
+ * or a socket.
+ */
+typedef struct
+{
+    // write chunks without blocking, at most IOV_MAX of them
+    long (*write_iov)(const _cg_iovec_t *iov, int count); // bytes taken, -1 with errno set
+    void (*read_input)();                  // read and decode the input which arrived
+    int (*get_size)(int *rows, int *cols); // the size in cells, -1 on error
+    int (*begin)();                        // set the fds up for the graphics, -1 on error
+    void (*end)();                         // give the fds their settings back
+    bool stream;                           // a client which may hang up or stop reading
+} _cg_backend_ops_t;
+
+extern const _cg_backend_ops_t _cg_backend_tty;
+extern const _cg_backend_ops_t _cg_backend_headless;
+#if CG_PLATFORM_POSIX
+extern const _cg_backend_ops_t _cg_backend_stream;
+extern const _cg_backend_ops_t _cg_backend_socket;
+#endif
+
+/**
+ * The backend in use and what its operations work on.
+ */
+typedef struct
+{
+    const _cg_backend_ops_t *ops;
+    cg_uint width;  // the size of the headless or stream graphics
+    cg_uint height;
+    int in_fd;                         // the fd read from, -1 for none
+    int out_fd;                        // the fd written to, -1 for the sink
+    bool socket;                       // the headless out_fd is a socket
+    atomic_bool hung_up;               // in_fd went away, it is not read any more
+    bool begun;                        // the stream fds are non-blocking
+    int orig_in_flags;                 // the stream fd flags before, -1 if not changed
+    int orig_out_flags;
+    _cg_term_command_buffer_t *sink;   // the headless memory buffer
+    _cg_term_command_buffer_t *script; // headless input not decoded yet
+} _cg_backend_t;
+
+// stdin and stdout, the terminal
+_CG_EXTERN _cg_backend_t _cg_backend _CG_INIT({.ops = &_cg_backend_tty, .in_fd = 0, .out_fd = 1});
+
+/**
+ * The recording of the output, see cg_record_start. Guarded by the
+ * output lock.
+ */
+typedef struct
+{
+    FILE *file;
+    uint64_t start;                  // event times are from here
+    bool header;                     // the header is written with the first event
+    _cg_term_command_buffer_t *line; // the event being put together
+} _cg_recorder_t;
+
+_CG_EXTERN _cg_recorder_t _cg_recorder;
+
+#define _CG_WATCH_START_SIZE 8
+
+/**
+ * A file descriptor watched by the draw loop.
+ */
+typedef struct
+{
+    int fd;
+    int events;
+    cg_fd_fn fn;
+    void *userdata;
+    bool failed; // the error was reported, the fd is not polled again
+} _cg_watch_t;
+
+/**
+ * The wait point of the event driven loop.
+ */
+typedef struct
+{
+    atomic_bool redraw; // a redraw was requested
+    bool open;
+#if CG_PLATFORM_WINDOWS
+    HANDLE wake; // set to wake the loop
+#elif CG_PLATFORM_POSIX
+    int wake[2]; // written to wake the loop
+    struct pollfd *fds; // the fds polled, the loop's own then the watches
+    cg_uint fds_capacity;
+#endif
+    uint64_t timer_period; // nanoseconds, 0 when there is no timer
+    uint64_t timer_deadline;
+    _cg_watch_t *watches;
+    cg_uint watch_count;
+    cg_uint watch_capacity;
+} _cg_events_t;
+
+_CG_EXTERN _cg_events_t _cg_events;
+
+/**
+ * The presentation thread and its canvases. Together with canvas_current
+ * (being drawn) there are three canvases: the last frame written to the
+ * terminal (screen), and one which is either waiting to be written
+ * (pending), being written, or free for the next frame (spare).
+ */
+typedef struct
+{
+    bool enabled;
+    bool running;
+    bool shutdown;
+    _cg_thread_t thread;
+    _cg_mutex_t lock;
+    _cg_cond_t cond;
+    cg_canvas_t *pending;
+    uint64_t pending_input; // the oldest input of the pending frame
+    cg_canvas_t *screen;
+    cg_canvas_t *spare;
+} _cg_presenter_t;
+
+_CG_EXTERN _cg_presenter_t _cg_presenter _CG_INIT({
+    .lock = _CG_MUTEX_INITIALIZER,
+    .cond = _CG_COND_INITIALIZER});
+
+/**
+ * The input thread and the ring it queues events on. The input thread
+ * is the only writer of head, the draw thread the only writer of tail.
+ */
+typedef struct
+{
+    bool enabled;
+    bool started;        // the thread is to be joined
+    atomic_bool running; // the thread reads the input, cleared when it stops
+    atomic_bool shutdown;
+    _cg_thread_t thread;
+#if CG_PLATFORM_POSIX
+    int wake[2]; // written to on shutdown, wakes the thread from poll
+#endif
+    atomic_size_t head;
+    atomic_size_t tail;
+    cg_keyboard_input_t events[_CG_INPUT_RING_SIZE];
+} _cg_input_thread_t;
+
+_CG_EXTERN _cg_input_thread_t _cg_input;
+
+/**
+ * Terminal input read but not decoded yet, the start of an escape
+ * sequence whose rest has not arrived. Only used by the thread reading
+ * the terminal.
+ */
+typedef struct
+{
+    unsigned char bytes[_CG_INPUT_READ_SIZE];
+    size_t length;
+    uint64_t since; // when the oldest byte left was read, in nanoseconds
+    cg_keyboard_input_t motion; // the last mouse motion, not passed on yet
+    bool has_motion;
+    uint64_t stamp; // when the input being decoded was read
+    bool in_paste;  // between the start and end of a bracketed paste
+    cg_char *paste; // the text pasted so far
+    size_t paste_length;
+    size_t paste_capacity;
+} _cg_input_parser_t;
+
+_CG_EXTERN _cg_input_parser_t _cg_input_parser;
+
+// most parameters of a CSI sequence which are looked at
+#define _CG_CSI_MAX_PARAMS 4
+
+// the key codes of the key state, the key types then the characters
+#define _CG_KEY_CHAR_BASE 64
+#define _CG_KEY_CODES (_CG_KEY_CHAR_BASE + 128)
+#define _CG_KEY_WORDS ((_CG_KEY_CODES + 63) / 64)
+
+/**
+ * The state of every key, a bit per key code.
+ */
+typedef struct
+{
+    uint64_t held[_CG_KEY_WORDS];
+    uint64_t pressed[_CG_KEY_WORDS];  // this frame
+    uint64_t released[_CG_KEY_WORDS]; // this frame
+    uint64_t deadline[_CG_KEY_CODES]; // when a held key is taken as let go
+    uint64_t repeat_delay;            // nanoseconds
+    uint64_t repeat_interval;
+    bool releases;              // the terminal reports releases
+    bool kitty;                 // the kitty keyboard protocol is on
+    atomic_bool kitty_detected; // the terminal answered the kitty query
+} _cg_keys_t;
+
+_CG_EXTERN _cg_keys_t _cg_keys _CG_INIT({
+    .repeat_delay = 600000000ULL,
+    .repeat_interval = 100000000ULL});
+
+// the kitty keyboard flags: disambiguate, report event types, report
+// alternate keys and report all keys as escape codes
+#define _CG_KITTY_FLAGS "15"
+
+/**
+ * The mouse reporting state.
+ */
+typedef struct
+{
+    cg_mouse_mode_t mode;
+#if CG_PLATFORM_WINDOWS
+    DWORD buttons; // the buttons held at the last mouse event
+#endif
+} _cg_mouse_t;
+
+_CG_EXTERN _cg_mouse_t _cg_mouse;
+
+_CG_EXTERN int _loop _CG_INIT(1);
+_CG_EXTERN cg_uint _fps _CG_INIT(_CG_DEFAULT_FPS);
+_CG_EXTERN cg_uint _step_hz _CG_INIT(0);
+_CG_EXTERN cg_char background_char _CG_INIT(_CG_DEFAULT_BACKGROUND_CHAR);
+_CG_EXTERN cg_glyph_t draw_glyph _CG_INIT('#');
+_CG_EXTERN cg_rgb_t default_bg_colour _CG_INIT({0, 0, 0});
+_CG_EXTERN cg_rgb_t default_fg_colour _CG_INIT({255, 255, 255});
+_CG_EXTERN cg_rgb_t background_colour _CG_INIT({0, 0, 0});
+_CG_EXTERN cg_rgb_t stroke_colour _CG_INIT({255, 255, 255});
+_CG_EXTERN cg_rgb_t fill_colour _CG_INIT({255, 255, 255});
+_CG_EXTERN cg_uint stroke_alpha _CG_INIT(255);
+_CG_EXTERN cg_uint fill_alpha _CG_INIT(255);
+_CG_EXTERN cg_blend_mode_t blend_mode _CG_INIT(CG_BLEND_NORMAL);
+// packed copies of the colours written into the cells
+_CG_EXTERN cg_colour32_t _cg_stroke_packed _CG_INIT(0xFFFFFF);
+_CG_EXTERN cg_colour32_t _cg_background_packed _CG_INIT(0x000000);
+_CG_EXTERN cg_colour32_t _cg_fill_packed _CG_INIT(0xFFFFFF);
+// canvas variables for the current and previous canvas
+_CG_EXTERN cg_canvas_t *canvas_previous _CG_INIT(NULL);
+_CG_EXTERN cg_canvas_t *canvas_current _CG_INIT(NULL);
+
+// command buffer for the terminal
+_CG_EXTERN _cg_term_command_buffer_t *_cg_buffer _CG_INIT(NULL);
+
+typedef struct
+{
+    cg_char str[4];
+    size_t len;
+} _cg_num_str_t;
+
+_CG_EXTERN _cg_num_str_t _cg_num_lookup[256];
+
+/**
+ * An interned glyph, the utf-8 bytes of one grapheme cluster.
+ */
+typedef struct
+{
+    cg_char bytes[_CG_GLYPH_MAX_BYTES];
+    uint8_t len;
+    uint8_t width;
+} _cg_glyph_entry_t;
+
+/**
+ * The glyph table. Entries live in fixed size pages that are never moved,
+ * so that a glyph id can be resolved while the table is growing.
+ * The hash index maps the glyph bytes to ids (0 is an empty slot,
+ * ASCII glyphs are never hashed). Glyphs are added under _cg_glyph_lock,
+ * count is stored once the entry is written so it is read without it.
+ */
+typedef struct
+{
+    _cg_glyph_entry_t *pages[_CG_GLYPH_MAX_PAGES];
+    atomic_uint count;
+    cg_glyph_t *hash;
+    cg_uint hash_size;
+} _cg_glyph_table_t;
+
+_CG_EXTERN _cg_glyph_table_t _cg_glyphs _CG_INIT({0});
+
+// scratch buffer for formatted text which does not fit on the stack
+_CG_EXTERN cg_char *_cg_text_scratch _CG_INIT(NULL);
+_CG_EXTERN size_t _cg_text_scratch_size _CG_INIT(0);
+
+/**
+ * Terminal state at a point in the encoded output: where the cursor is
+ * and which colours are set.
+ */
+typedef struct
+{
+    cg_uint cursor_x;
+    cg_uint cursor_y;
+    bool cursor_valid;
+    cg_colour32_t fg;
+    cg_colour32_t bg;
+} _cg_encode_state_t;
+
+/**
+ * One frame being encoded in bands of rows.
+ */
+typedef struct
+{
+    cg_canvas_t *current;
+    cg_canvas_t *previous; // NULL to write every cell
+    cg_uint band_rows;
+    _cg_term_command_buffer_t **buffers;
+    atomic_uint cells_changed;
+} _cg_encode_job_t;
+
+// per band output buffers of the frame encoder
+_CG_EXTERN _cg_term_command_buffer_t **_cg_band_buffers _CG_INIT(NULL);
+_CG_EXTERN cg_uint _cg_band_buffer_count _CG_INIT(0);
+// output chunks of a frame, the bands plus the cursor commands around them
+_CG_EXTERN _cg_iovec_t *_cg_frame_iov _CG_INIT(NULL);
+
+/*--------- END PRIVATE VARIABLES -----------*/
+
+/*--------- BEGIN INTERNAL FUNCTION PROTOTYPES -----------*/
+
+// Internal terminal utility functions
+/**
+ * Enable raw mode for the terminal.
+ * see https://viewsourcecode.org/snaptoken/kilo/02.enteringRawMode.html
+ */
+void _cg_term_enable_raw_mode();
+
+/**
+ * Disable raw mode for the terminal.
+ * see https://viewsourcecode.org/snaptoken/kilo/02.enteringRawMode.html
+ */
+void _cg_term_disable_raw_mode();
+
+// Platform specific versions
+#if CG_PLATFORM_WINDOWS
+void _cg_win_term_enable_raw_mode();
+void _cg_win_term_disable_raw_mode();
+int _cg_win_get_cursor_position(int *rows, int *cols);
+int _cg_win_get_window_size(int *rows, int *cols);
+void _cg_win_read_key();
+int _cg_win_modifiers(DWORD state);
+void _cg_win_mouse_event(MOUSE_EVENT_RECORD *event);
+int _cg_win_write(const cg_char *bytes, size_t length);
+
+#ifdef CONGFX_IMPLEMENTATION
+void _cg_win_time_init(void)
+{
+    QueryPerformanceFrequency(&(_cg_gfx_context->_cg_qpc_freq));
+}
+
+void _cg_win_clock_gettime(struct timespec *ts)
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    double seconds = (double)counter.QuadPart /
+                     (double)((_cg_gfx_context->_cg_qpc_freq).QuadPart);
+
+    ts->tv_sec = (time_t)seconds;
+    ts->tv_nsec = (long)((seconds - ts->tv_sec) * 1e9);
+}
+
+int _cg_win_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    (void)rem; // Windows Sleep has no remaining-time reporting
+
+    DWORD ms =
+        (DWORD)(req->tv_sec * 1000 +
+                req->tv_nsec / 1000000);
+
+    Sleep(ms);
+    return 0;
+}
+#endif // CONGFX_IMPLEMENTATION
+
+#endif
+
+#if CG_PLATFORM_POSIX
+void _cg_posix_term_enable_raw_mode();
+void _cg_posix_term_disable_raw_mode();
+int _cg_posix_get_cursor_position(int *rows, int *cols);
+int _cg_posix_get_window_size(int *rows, int *cols);
+void _cg_posix_read_key();
+
+_CG_EXTERN struct termios orig_termios;
+_CG_EXTERN int _cg_term_orig_flags;
+_CG_EXTERN int _cg_term_orig_out_flags;
+// the fds in raw mode, -1 once they are restored
+_CG_EXTERN int _cg_term_raw_in _CG_INIT(-1);
+_CG_EXTERN int _cg_term_raw_out _CG_INIT(-1);
+_CG_EXTERN bool _cg_term_atexit;
+
+#endif
+
+/**
+ * Create a new command buffer for the terminal.
+ *
+ * @param buffer The command buffer to create.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_create_command_buffer(_cg_term_command_buffer_t **buffer);
+
+/**
+ * Expand the command buffer for the terminal.
+ *
+ * @param buffer The command buffer to expand.
+ * @param more_required The additional space required.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_expand_command_buffer(_cg_term_command_buffer_t *buffer, size_t more_required);
+
+/**
+ * Dispose of a command buffer for the terminal.
+ *
+ * @param buffer The command buffer to dispose of.
+ */
+void _cg_term_dispose_command_buffer(_cg_term_command_buffer_t *buffer);
+
+/**
+ * Add a command to the command buffer for the terminal.
+ *
+ * @param buffer The command buffer to add to.
+ * @param command The command to add.
+ * @param length The length of the command. (if 0, then the length is calculated)
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_buffer_command(_cg_term_command_buffer_t *buffer,
+                            cg_string command, size_t length);
+
+/**
+ * Flush the command buffer for the terminal.
+ * The commands are written to the terminal, and the buffer is reset.
+ *
+ * @param buffer The command buffer to flush.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_flush_command_buffer(_cg_term_command_buffer_t *buffer);
+
+/**
+ * Append bytes to a command buffer, growing it as needed.
+ * Unlike _cg_term_buffer_command this never flushes.
+ *
+ * @param buffer The command buffer to add to.
+ * @param bytes The bytes to add.
+ * @param length The number of bytes.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_buffer_append(_cg_term_command_buffer_t *buffer, const cg_char *bytes, size_t length);
+
+/**
+ * Write chunks of output to the terminal, in order, without blocking.
+ * Whatever the terminal does not take right away is queued as pending
+ * output. Called with the output lock held.
+ * The chunks are modified as they are written.
+ *
+ * @param iov The chunks to write.
+ * @param count The number of chunks.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_write_iov(_cg_iovec_t *iov, int count);
+
+/**
+ * Add chunks about to be written to the recording, as one event.
+ * Called with the output lock held.
+ *
+ * @param iov The chunks.
+ * @param count The number of chunks.
+ */
+void _cg_record_iov(_cg_iovec_t *iov, int count);
+
+/**
+ * Get the length of the well formed utf-8 sequence at the start of some
+ * bytes, one which is not overlong, a surrogate or past U+10FFFF.
+ *
+ * @param bytes The bytes, starting with a byte of 0x80 or more.
+ * @param n The number of bytes.
+ * @return The length of the sequence, 0 if it is not well formed.
+ */
+cg_uint _cg_utf8_valid_length(const unsigned char *bytes, size_t n);
+
+/**
+ * Write as much pending output as the terminal takes without blocking.
+ * Called with the output lock held.
+ *
+ * @return The number of bytes still pending, or -1 on error.
+ */
+long _cg_output_write_pending();
+
+/**
+ * Write pending output, waiting for the terminal to take it.
+ *
+ * @param timeout_ms The most milliseconds to wait, 0 to not wait at
+ *                   all, -1 to wait until everything is written.
+ * @return 0 if nothing is left pending, 1 if some output is still
+ *         pending, -1 on error.
+ */
+int _cg_output_drain(int timeout_ms);
+
+/**
+ * Give up on a stream which stopped taking output: drop what is still
+ * pending and hang the stream up. Does nothing for a terminal, which
+ * is waited on instead.
+ */
+void _cg_output_abandon();
+
+/**
+ * Reset the terminal to its default state.
+ */
+void _cg_term_reset();
+
+void _cg_term_set_foreground_colour(cg_colour32_t colour);
+
+void _cg_term_set_background_colour(cg_colour32_t colour);
+
+void _cg_term_move_to(cg_uint x, cg_uint y);
+
+void _cg_term_write_char(cg_char c);
+
+void _cg_term_write_glyph(cg_glyph_t glyph);
+
+/**
+ * Append an SGR truecolour sequence to a command buffer.
+ *
+ * @param buffer The command buffer.
+ * @param code The SGR code, 38 for foreground or 48 for background.
+ * @param colour The colour.
+ */
+void _cg_encode_colour(_cg_term_command_buffer_t *buffer, int code, cg_colour32_t colour);
+
+/**
+ * Append a cursor position sequence to a command buffer.
+ *
+ * @param buffer The command buffer.
+ * @param x The column (0 based).
+ * @param y The row (0 based).
+ */
+void _cg_encode_move_to(_cg_term_command_buffer_t *buffer, cg_uint x, cg_uint y);
+
+void _cg_hide_cursor();
+
+void _cg_show_cursor();
+
+/**
+ * Get the cursor position in the terminal.
+ * see https://viewsourcecode.org/snaptoken/kilo/03.rawInputAndOutput.html#window-size-the-hard-way
+ * @param rows The row position of the cursor.
+ * @param cols The column position of the cursor.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_get_cursor_position(int *rows, int *cols);
+
+/**
+ * Get the window size of the terminal.
+ * see https://viewsourcecode.org/snaptoken/kilo/03.rawInputAndOutput.html#window-size-the-hard-way
+ * @param rows The number of rows in the terminal.
+ * @param cols The number of columns in the terminal.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_get_window_size(int *rows, int *cols);
+
+/**
+ * Read the key presses for this frame, from the terminal or from the
+ * input thread.
+ */
+void _cg_read_key();
+
+/**
+ * Add a key press to the list for this frame, growing it as needed.
+ * The list takes a paste's text, it is freed if the press is dropped.
+ *
+ * @param input The key press.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_input_push(cg_keyboard_input_t input);
+
+/**
+ * Pass on a decoded key press, to the input ring when the input thread
+ * is running, to the list for this frame otherwise. A paste's text goes
+ * with it, and is freed if the press is dropped.
+ *
+ * @param input The key press.
+ */
+void _cg_input_emit(cg_keyboard_input_t input);
+
+/**
+ * Pass on a decoded input, holding back mouse motion so that a run of
+ * moves is passed on as the last one.
+ *
+ * @param input The input.
+ */
+void _cg_input_queue(cg_keyboard_input_t input);
+
+/**
+ * Pass on the mouse motion held back by _cg_input_queue.
+ */
+void _cg_input_flush_motion();
+
+/**
+ * Take the next key press from the input ring.
+ *
+ * @param input Set to the key press.
+ * @return 1 if a key press was taken, 0 if the ring is empty.
+ */
+int _cg_input_ring_pop(cg_keyboard_input_t *input);
+
+/**
+ * The input thread, waits on the terminal and decodes key presses.
+ *
+ * @param arg Unused.
+ */
+void _cg_input_thread_main(void *arg);
+
+/**
+ * Start the input thread.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_input_start();
+
+/**
+ * Stop the input thread, key presses left in the ring are dropped.
+ */
+void _cg_input_stop();
+
+/**
+ * Decode terminal input into key presses.
+ *
+ * @param bytes The input.
+ * @param n The number of bytes.
+ * @param flush Decode an unfinished escape sequence at the end as the
+ *              separate keys it starts with, rather than waiting for it.
+ * @return The number of bytes decoded, the rest is an unfinished
+ *         escape sequence.
+ */
+size_t _cg_input_decode(const unsigned char *bytes, size_t n, bool flush);
+
+/**
+ * Find the length of the escape sequence at the start of some input.
+ *
+ * @param bytes The input, starting with an escape.
+ * @param n The number of bytes.
+ * @return The length of the sequence, 1 for an escape on its own,
+ *         0 if the sequence is not finished yet.
+ */
+size_t _cg_input_sequence_length(const unsigned char *bytes, size_t n);
+
+/**
+ * Pass on the key press or mouse event of a whole escape sequence.
+ *
+ * @param seq The sequence, starting with the escape.
+ * @param len The length of the sequence.
+ */
+void _cg_input_emit_sequence(const unsigned char *seq, size_t len);
+
+/**
+ * Decode a single byte of input which is not part of a sequence.
+ *
+ * @param c The byte.
+ * @param modifiers The modifiers already known, CG_MOD_ALT after an escape.
+ * @return The key press.
+ */
+cg_keyboard_input_t _cg_input_byte(unsigned char c, int modifiers);
+
+/**
+ * Read the numeric parameters of a CSI sequence, missing ones are 0.
+ *
+ * @param seq The sequence.
+ * @param len The length of the sequence.
+ * @param params Set to the parameters, _CG_CSI_MAX_PARAMS of them.
+ * @param subs Set to the first sub parameter (after a colon) of each.
+ */
+void _cg_input_csi_params(const unsigned char *seq, size_t len, cg_uint *params, cg_uint *subs);
+
+/**
+ * Pass on a key of the kitty keyboard protocol, a CSI u sequence.
+ *
+ * @param code The unicode codepoint or functional key code.
+ * @param shifted The codepoint with shift applied, 0 if not given.
+ * @param modifiers A mask of cg_key_mod_t.
+ * @param action Press, repeat or release.
+ */
+void _cg_input_kitty_key(cg_uint code, cg_uint shifted, int modifiers, cg_key_action_t action);
+
+/**
+ * Get the action of a kitty event type sub parameter.
+ *
+ * @param event The event type, 0 if missing.
+ * @return The action.
+ */
+cg_key_action_t _cg_input_action(cg_uint event);
+
+/**
+ * Get the code of an input in the key state.
+ *
+ * @param input The input.
+ * @return The key code, -1 if the input is not tracked.
+ */
+int _cg_key_code(cg_keyboard_input_t input);
+
+/**
+ * Get the code of a key type in the key state, CG_KEY_ALPHANUM stands
+ * for any character key.
+ *
+ * @param key The key type.
+ * @return The key code, -1 if the key type is not tracked.
+ */
+int _cg_key_type_code(cg_key_type_t key);
+
+/**
+ * Update the key state with an input, marking repeats as such. A
+ * character key also updates CG_KEY_ALPHANUM, which is held while any
+ * character key is.
+ *
+ * @param input The input.
+ */
+void _cg_keys_update(cg_keyboard_input_t *input);
+
+/**
+ * Check if any character key is held.
+ *
+ * @return true if one is.
+ */
+bool _cg_keys_chars_held();
+
+/**
+ * Start the key state of a new frame, taking keys which stopped
+ * repeating as released.
+ */
+void _cg_keys_begin_frame();
+
+/**
+ * Test a key code in a key state bitset.
+ *
+ * @param bits The bitset.
+ * @param code The key code, may be -1.
+ * @return 1 if the bit is set, 0 otherwise.
+ */
+int _cg_keys_test(const uint64_t *bits, int code);
+
+/**
+ * Count the trailing zero bits of a word.
+ *
+ * @param bits The word, not 0.
+ * @return The index of the lowest set bit.
+ */
+int _cg_ctz64(uint64_t bits);
+
+/**
+ * Get the key of the final byte of a CSI or SS3 sequence.
+ *
+ * @param final The final byte.
+ * @return The key, CG_KEY_UNKNOWN if it is not a key.
+ */
+cg_key_type_t _cg_input_final_key(unsigned char final);
+
+/**
+ * Get the key of a CSI sequence ending in ~ by its number.
+ *
+ * @param number The first parameter of the sequence.
+ * @return The key, CG_KEY_UNKNOWN if it is not a key.
+ */
+cg_key_type_t _cg_input_tilde_key(cg_uint number);
+
+/**
+ * Get the modifiers from an xterm modifier parameter.
+ *
+ * @param param The parameter, 1 plus the modifier bits, 0 if missing.
+ * @return A mask of cg_key_mod_t.
+ */
+int _cg_input_modifiers(cg_uint param);
+
+/**
+ * Send the terminal the sequences which set the mouse mode.
+ *
+ * @param mode The mouse mode.
+ */
+void _cg_mouse_apply(cg_mouse_mode_t mode);
+
+/**
+ * Take the text of a bracketed paste, up to the end of the paste.
+ *
+ * @param bytes The input.
+ * @param n The number of bytes.
+ * @return The number of bytes taken, bytes which may be the start of
+ *         the end of the paste are left.
+ */
+size_t _cg_input_paste(const unsigned char *bytes, size_t n);
+
+/**
+ * Add text to the paste buffer, growing it as needed.
+ *
+ * @param bytes The text.
+ * @param n The number of bytes.
+ */
+void _cg_input_paste_append(const unsigned char *bytes, size_t n);
+
+/**
+ * Free the text of the pastes in a list of inputs.
+ *
+ * @param inputs The inputs.
+ * @param count The number of inputs.
+ */
+void _cg_input_free_pastes(cg_keyboard_input_t *inputs, cg_uint count);
+
+/**
+ * Decode the input queued for the headless backend.
+ */
+void _cg_headless_read_key();
+
+/**
+ * Go back to the terminal on stdin and stdout, and free the buffers of
+ * the headless backend.
+ */
+void _cg_backend_reset();
+
+/**
+ * The other end went away, the terminal was closed or the stream's
+ * client hung up. The input is not waited on any more and the loop is
+ * asked to exit.
+ */
+void _cg_backend_hangup();
+
+/**
+ * Get the size the headless or stream backend was given.
+ *
+ * @param rows The number of rows.
+ * @param cols The number of columns.
+ * @return 0.
+ */
+int _cg_backend_given_size(int *rows, int *cols);
+
+/**
+ * Write chunks to the headless memory buffer, or to the fd it was
+ * given.
+ *
+ * @param iov The chunks to write.
+ * @param count The number of chunks.
+ * @return The number of bytes written, or -1 with errno set.
+ */
+long _cg_headless_write(const _cg_iovec_t *iov, int count);
+
+/**
+ * Set up the headless backend, there is nothing to set up.
+ *
+ * @return 0.
+ */
+int _cg_headless_begin();
+
+/**
+ * Put the headless backend back, there is nothing to put back.
+ */
+void _cg_headless_end();
+
+/**
+ * Put the terminal in raw mode.
+ *
+ * @return 0, failing is fatal.
+ */
+int _cg_tty_begin();
+
+#if CG_PLATFORM_WINDOWS
+/**
+ * Write chunks to the console, all of them before returning.
+ *
+ * @param iov The chunks to write.
+ * @param count The number of chunks.
+ * @return The number of bytes written, or -1.
+ */
+long _cg_win_writev(const _cg_iovec_t *iov, int count);
+#elif CG_PLATFORM_POSIX
+/**
+ * Write chunks to the output fd. A terminal or stream which hung up
+ * ends the program's loop.
+ *
+ * @param iov The chunks to write.
+ * @param count The number of chunks, at most IOV_MAX.
+ * @return The number of bytes written, or -1 with errno set.
+ */
+long _cg_fd_write(const _cg_iovec_t *iov, int count);
+
+/**
+ * Write chunks to the output socket with sendmsg, so a client hanging
+ * up is an error and not a SIGPIPE.
+ *
+ * @param iov The chunks to write.
+ * @param count The number of chunks, at most IOV_MAX.
+ * @return The number of bytes written, or -1 with errno set.
+ */
+long _cg_socket_write(const _cg_iovec_t *iov, int count);
+
+/**
+ * Make the stream fds non-blocking, keeping the flags they had.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_stream_begin();
+
+/**
+ * Give the stream fds the flags they had before.
+ */
+void _cg_stream_end();
+#endif
+
+/**
+ * Get how long until an unfinished escape sequence times out.
+ *
+ * @return The milliseconds left, 0 if it timed out, -1 if no sequence
+ *         is unfinished.
+ */
+int _cg_input_timeout_ms();
+
+// internal functions
+
+/**
+ * Calculate the difference in time between two timespec structures.
+ *
+ * @param time1 The first time.
+ * @param time2 The second time.
+ * @return The difference in time in microseconds.
+ */
+cg_uint _diff_time_micros(struct timespec time1, struct timespec time2);
+
+/**
+ * Convert a time to nanoseconds.
+ *
+ * @param t The time.
+ * @return The time in nanoseconds.
+ */
+uint64_t _cg_time_nanos(struct timespec t);
+
+/**
+ * Get the monotonic time in nanoseconds.
+ *
+ * @return The current time in nanoseconds.
+ */
+uint64_t _cg_now_nanos();
+
+/**
+ * Get the generator of the calling thread, seeded for the current seed.
+ *
+ * @return The generator.
+ */
+_cg_rand_t *_cg_rand_state();
+
+/**
+ * Get the random stream of the calling thread, a pool worker's is from
+ * its index, any other thread is given the next free one on first use.
+ *
+ * @return The stream, never 0.
+ */
+uint64_t _cg_rand_stream_id();
+
+/**
+ * Get the next 64 random bits from a generator.
+ *
+ * @param rng The generator.
+ * @return The random bits.
+ */
+uint64_t _cg_rand_next(_cg_rand_t *rng);
+
+/**
+ * Step a splitmix64 sequence, used to spread a seed over a generator.
+ *
+ * @param x The sequence state, advanced.
+ * @return The next value.
+ */
+uint64_t _cg_splitmix64(uint64_t *x);
+
+/**
+ * Rotate 64 bits left.
+ *
+ * @param x The bits.
+ * @param k The number of places, 1 to 63.
+ * @return The rotated bits.
+ */
+uint64_t _cg_rotl64(uint64_t x, int k);
+
+/**
+ * Sleep until a monotonic time.
+ *
+ * @param deadline The time to wake up at, in nanoseconds.
+ */
+void _cg_sleep_until(uint64_t deadline);
+
+/**
+ * Record a value of a frame statistic.
+ *
+ * @param id The statistic.
+ * @param value The value.
+ */
+void _cg_stats_record(cg_stat_id_t id, uint64_t value);
+
+/**
+ * Record the time since the last mark for a phase of the draw loop, and
+ * start timing the next one.
+ *
+ * @param id The phase which just ended.
+ * @return The time now, in nanoseconds.
+ */
+uint64_t _cg_stats_phase(cg_stat_id_t id);
+
+void _cg_clock_get_time(struct timespec *t);
+
+void _cg_init_num_lookup();
+
+/**
+ * Initialize the glyph table with the ASCII glyphs.
+ */
+void _cg_init_glyph_table();
+
+/**
+ * Look up the table entry of a glyph id.
+ *
+ * @param glyph The glyph id.
+ * @return The glyph entry.
+ */
+_cg_glyph_entry_t *_cg_glyph_entry(cg_glyph_t glyph);
+
+/**
+ * Decode one utf-8 codepoint.
+ *
+ * @param s The bytes to decode.
+ * @param n The number of bytes available.
+ * @param cp Set to the codepoint (U+FFFD for invalid input).
+ * @return The number of bytes consumed (at least 1 if n > 0).
+ */
+cg_uint _cg_utf8_decode(const cg_char *s, size_t n, uint32_t *cp);
+
+/**
+ * Get the terminal display width of a codepoint (0, 1 or 2).
+ *
+ * @param cp The codepoint.
+ * @return The display width.
+ */
+int _cg_codepoint_width(uint32_t cp);
+
+/**
+ * Find the length in bytes of the grapheme cluster at the start of s.
+ *
+ * @param s The utf-8 bytes.
+ * @param n The number of bytes available.
+ * @param width Set to the display width of the cluster.
+ * @return The number of bytes in the cluster.
+ */
+cg_uint _cg_utf8_grapheme(const cg_char *s, size_t n, int *width);
+
+/**
+ * Intern a grapheme cluster given as bytes.
+ *
+ * @param bytes The utf-8 bytes of the cluster.
+ * @param len The number of bytes.
+ * @param width The display width of the cluster.
+ * @return The glyph id.
+ */
+cg_glyph_t _cg_intern_glyph_bytes(const cg_char *bytes, cg_uint len, int width);
+
+/**
+ * Intern a grapheme cluster, with the glyph table lock held.
+ *
+ * @param bytes The utf-8 bytes of the cluster.
+ * @param len The number of bytes.
+ * @param width The display width of the cluster.
+ * @return The glyph id.
+ */
+cg_glyph_t _cg_intern_glyph_bytes_unlocked(const cg_char *bytes, cg_uint len, int width);
+
+/**
+ * Convert a single character to a glyph id.
+ * ASCII characters map to themselves, other bytes are interned as is.
+ *
+ * @param c The character.
+ * @return The glyph id.
+ */
+cg_glyph_t _cg_char_to_glyph(cg_char c);
+
+/**
+ * Check if a codepoint lies in one of a sorted list of ranges.
+ *
+ * @param cp The codepoint.
+ * @param ranges The sorted, non overlapping [lo, hi] ranges.
+ * @param count The number of ranges.
+ * @return 1 if the codepoint is in a range, 0 otherwise.
+ */
+int _cg_codepoint_in_ranges(uint32_t cp, const uint32_t (*ranges)[2], int count);
+
+/**
+ * Hash the bytes of a glyph for the glyph table index.
+ *
+ * @param bytes The glyph bytes.
+ * @param len The number of bytes.
+ * @return The hash value.
+ */
+uint32_t _cg_glyph_hash(const cg_char *bytes, cg_uint len);
+
+/**
+ * Insert a glyph id into a glyph hash index.
+ *
+ * @param hash The hash index.
+ * @param hash_size The size of the index (a power of 2).
+ * @param glyph The glyph id to insert.
+ */
+void _cg_glyph_hash_insert(cg_glyph_t *hash, cg_uint hash_size, cg_glyph_t glyph);
+
+/**
+ * Clear the other half of a wide glyph that overlaps a cell which is
+ * about to be overwritten.
+ *
+ * @param row The first cell of the canvas row.
+ * @param x The x-coordinate of the cell being overwritten.
+ * @param w The width of the row.
+ */
+void _cg_canvas_break_wide(cg_cell_t *row, cg_uint x, cg_uint w);
+
+/**
+ * Pack a colour into 32 bits.
+ *
+ * @param c The colour.
+ * @return The packed colour.
+ */
+cg_colour32_t _cg_pack_colour(cg_rgb_t c);
+
+/**
+ * Unpack a 32 bit colour.
+ *
+ * @param c The packed colour.
+ * @return The colour.
+ */
+cg_rgb_t _cg_unpack_colour(cg_colour32_t c);
+
+/**
+ * Blend a source colour over a destination colour.
+ *
+ * @param dst The destination colour.
+ * @param src The source colour.
+ * @param alpha The opacity of the source (0-255).
+ * @param mode The blend mode.
+ * @return The blended colour.
+ */
+cg_colour32_t _cg_blend_colour(cg_colour32_t dst, cg_colour32_t src,
+                               cg_uint alpha, cg_blend_mode_t mode);
+
+/**
+ * Blend a source colour over a span of packed colours.
+ * The kernel works on two channels per multiply and has no branches in
+ * the loops, so the compiler can vectorise it.
+ *
+ * @param dst The first colour of the span.
+ * @param stride The distance between colours, in colours.
+ * @param n The number of colours.
+ * @param src The source colour.
+ * @param alpha The opacity of the source (0-255).
+ * @param mode The blend mode.
+ */
+void _cg_blend_span(cg_colour32_t *dst, size_t stride, size_t n,
+                    cg_colour32_t src, cg_uint alpha, cg_blend_mode_t mode);
+
+/**
+ * Blend the fill colour into the fg and/or bg of a rectangle.
+ *
+ * @param x The x-coordinate of the top left cell.
+ * @param y The y-coordinate of the top left cell.
+ * @param w The width of the rectangle.
+ * @param h The height of the rectangle.
+ * @param fg Blend into the foreground.
+ * @param bg Blend into the background.
+ */
+void _cg_blend_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h, bool fg, bool bg);
+
+// Threading functions
+
+/**
+ * Start a thread.
+ *
+ * @param thread Set to the started thread.
+ * @param fn The function to run.
+ * @param arg The argument to pass to fn.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_thread_start(_cg_thread_t *thread, void (*fn)(void *), void *arg);
+
+/**
+ * Wait for a thread to finish.
+ *
+ * @param thread The thread.
+ */
+void _cg_thread_join(_cg_thread_t thread);
+
+void _cg_mutex_lock(_cg_mutex_t *m);
+void _cg_mutex_unlock(_cg_mutex_t *m);
+void _cg_cond_wait(_cg_cond_t *c, _cg_mutex_t *m);
+void _cg_cond_signal(_cg_cond_t *c);
+void _cg_cond_broadcast(_cg_cond_t *c);
+
+/**
+ * Get the number of online cpus.
+ *
+ * @return The number of cpus, at least 1.
+ */
+cg_uint _cg_cpu_count();
+
+/**
+ * Start the worker threads if they are not running.
+ */
+void _cg_pool_start();
+
+/**
+ * The worker thread loop, runs and steals tasks until shutdown.
+ *
+ * @param arg The index of the worker.
+ */
+void _cg_pool_worker(void *arg);
+
+/**
+ * Stop and join the worker threads.
+ */
+void _cg_pool_stop();
+
+/**
+ * Push a task on the bottom of a deque, growing it as needed.
+ *
+ * @param deque The deque.
+ * @param task The task.
+ */
+void _cg_deque_push(_cg_deque_t *deque, _cg_task_t task);
+
+/**
+ * Pop the newest task from the bottom of a deque.
+ *
+ * @param deque The deque.
+ * @param task Set to the task.
+ * @return 1 if a task was taken, 0 if the deque is empty.
+ */
+int _cg_deque_pop(_cg_deque_t *deque, _cg_task_t *task);
+
+/**
+ * Steal the oldest task from the top of a deque.
+ *
+ * @param deque The deque.
+ * @param task Set to the task.
+ * @return 1 if a task was taken, 0 if the deque is empty.
+ */
+int _cg_deque_steal(_cg_deque_t *deque, _cg_task_t *task);
+
+/**
+ * Queue a task on the deque of the calling thread, without waking
+ * the workers.
+ *
+ * @param task The task.
+ */
+void _cg_pool_push(_cg_task_t task);
+
+/**
+ * Wake the workers and any waiting threads.
+ */
+void _cg_pool_notify();
+
+/**
+ * Take one queued task, the calling thread's own first, and run it.
+ *
+ * @return 1 if a task was run, 0 if none was found.
+ */
+int _cg_pool_run_one();
+
+/**
+ * Run queued tasks until done(arg) returns true, sleeping when there
+ * is nothing to run.
+ *
+ * @param done The condition to wait for.
+ * @param arg Passed to done.
+ */
+void _cg_pool_help_until(bool (*done)(void *arg), void *arg);
+
+/**
+ * Split a batch in tasks of at most grain indices, queue them and run
+ * tasks until the whole batch is done.
+ *
+ * @param batch The batch, with remaining unset.
+ * @param count The number of indices.
+ * @param grain The most indices in one task.
+ */
+void _cg_pool_run_batch(_cg_batch_t *batch, cg_uint count, cg_uint grain);
+
+/**
+ * Run fn(ctx, i) for every i in [0, count) on the worker pool and the
+ * calling thread, and wait until all of them are done.
+ *
+ * @param fn The task function.
+ * @param ctx The task context.
+ * @param count The number of tasks.
+ */
+void _cg_pool_run(_cg_pool_task_fn fn, void *ctx, cg_uint count);
+
+/**
+ * Get a free job slot, allocating a new page if needed. Called with
+ * the job lock held.
+ *
+ * @return The slot index, or -1 if out of memory.
+ */
+long _cg_job_alloc();
+
+/**
+ * Get a job slot by index. Called with the job lock held.
+ *
+ * @param index The slot index.
+ * @return The slot, or NULL if it does not exist.
+ */
+_cg_job_slot_t *_cg_job_slot(cg_uint index);
+
+/**
+ * Queue a job whose dependencies are all done.
+ *
+ * @param index The slot index.
+ */
+void _cg_job_queue(cg_uint index);
+
+/**
+ * Run a job, then release the jobs waiting on it and free its slot.
+ *
+ * @param arg The slot index cast to a pointer.
+ * @param begin Unused.
+ * @param end Unused.
+ */
+void _cg_job_task(void *arg, cg_uint begin, cg_uint end);
+
+/**
+ * Make the wide glyphs a shader wrote into a row consistent, adding
+ * continuation cells and removing stray ones.
+ *
+ * @param row The first cell of the canvas row.
+ * @param x The first shaded cell.
+ * @param n The number of shaded cells.
+ * @param w The width of the row.
+ */
+void _cg_row_fix_wide(cg_cell_t *row, cg_uint x, cg_uint n, cg_uint w);
+
+/**
+ * Shade a rectangle with either a cell or a row shader.
+ *
+ * @param x The x-coordinate of the top left cell.
+ * @param y The y-coordinate of the top left cell.
+ * @param w The width of the rectangle.
+ * @param h The height of the rectangle.
+ * @param cell_fn The cell shader, or NULL.
+ * @param row_fn The row shader, or NULL.
+ * @param userdata Passed to the shader.
+ */
+void _cg_shade_impl(cg_uint x, cg_uint y, cg_uint w, cg_uint h,
+                    cg_shader_fn cell_fn, cg_row_shader_fn row_fn, void *userdata);
+
+/**
+ * Pool task shading one band of rows of a cg_shade call.
+ *
+ * @param ctx The shade job.
+ * @param index The band index.
+ */
+void _cg_shade_band(void *ctx, cg_uint index);
+
+/**
+ * Check if a cell is written by the encoder.
+ *
+ * @param cur The current row.
+ * @param prev The previous row, or NULL if every cell is written.
+ * @param x The cell in the row.
+ * @param w The width of the row.
+ * @return true if the cell is written.
+ */
+bool _cg_encode_cell_changed(cg_cell_t *cur, cg_cell_t *prev, cg_uint x, cg_uint w);
+
+/**
+ * Find the terminal state the encoder is in when it reaches a row,
+ * without encoding the rows before it. The cursor is never valid at the
+ * start of a row (the first write in a row always moves), and the
+ * colours are those of the last cell written before the row.
+ *
+ * @param job The frame being encoded.
+ * @param row The row.
+ * @param state Set to the state at the start of the row.
+ */
+void _cg_encode_start_state(_cg_encode_job_t *job, cg_uint row, _cg_encode_state_t *state);
+
+/**
+ * Encode a range of rows into a command buffer.
+ *
+ * @param buffer The command buffer.
+ * @param job The frame being encoded.
+ * @param row0 The first row.
+ * @param row1 One past the last row.
+ * @param state The terminal state at row0, updated as rows are encoded.
+ * @return The number of cells written.
+ */
+cg_uint _cg_encode_rows(_cg_term_command_buffer_t *buffer, _cg_encode_job_t *job,
+                        cg_uint row0, cg_uint row1, _cg_encode_state_t *state);
+
+/**
+ * Pool task encoding one band of rows into its own buffer.
+ *
+ * @param ctx The encode job.
+ * @param index The band index.
+ */
+void _cg_encode_band(void *ctx, cg_uint index);
+
+/**
+ * Make sure there are enough band buffers.
+ *
+ * @param count The number of bands.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_encode_reserve_bands(cg_uint count);
+
+/**
+ * Encode a frame and write it to the terminal. The frame is skipped if
+ * the output of the one before has not been taken by the terminal yet.
+ *
+ * @param frame The canvas to write.
+ * @param base The canvas last written, to diff against.
+ * @param input When the oldest input of the frame was read, 0 if none.
+ * @return 1 if the frame was written, 0 if it was skipped.
+ */
+int _cg_present_frame(cg_canvas_t *frame, cg_canvas_t *base, uint64_t input);
+
+/**
+ * Get the earlier of two input times, where 0 is no input.
+ *
+ * @param a A time.
+ * @param b A time.
+ * @return The earlier time.
+ */
+uint64_t _cg_input_earliest(uint64_t a, uint64_t b);
+
+/**
+ * Flush a command buffer, with the output lock held.
+ *
+ * @param buffer The command buffer to flush.
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_term_flush_command_buffer_unlocked(_cg_term_command_buffer_t *buffer);
+
+/**
+ * The presentation thread, writes frames as they are handed over.
+ *
+ * @param arg Unused.
+ */
+void _cg_present_thread_main(void *arg);
+
+/**
+ * Start the presentation thread, taking over canvas_previous as the
+ * screen canvas and adding the spare canvas.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_present_start();
+
+/**
+ * Write any pending frame, stop the presentation thread and go back
+ * to the double buffered canvases.
+ */
+void _cg_present_stop();
+
+/**
+ * Open the wake up channel of the event driven loop.
+ *
+ * @return 0 if successful, -1 otherwise.
+ */
+int _cg_events_open();
+
+/**
+ * Close the wake up channel of the event driven loop.
+ */
+void _cg_events_close();
+
+/**
+ * Wake the event driven loop if it is waiting.
+ */
+void _cg_events_wake();
+
+/**
+ * Wait until a frame should be drawn in the event driven loop: input
+ * arrived, the redraw timer fired, or a redraw was requested. Pending
+ * output is written while waiting.
+ */
+void _cg_events_wait();
+
+/**
+ * Wait for the watched file descriptors and run the callbacks of those
+ * which are ready.
+ *
+ * @param timeout_ms The longest time to wait, 0 to only check.
+ * @return The number of callbacks run.
+ */
+int _cg_events_dispatch(int timeout_ms);
+
+#if CG_PLATFORM_POSIX
+/**
+ * Make room for the fds polled by the loop, its own and the watches.
+ *
+ * @param base The number of fds of the loop itself.
+ * @return The fds, the watches start at base, NULL if out of memory.
+ */
+struct pollfd *_cg_events_poll_fds(cg_uint base);
+
+/**
+ * Run the callbacks of the watches which poll found ready.
+ *
+ * @param fds The watches as filled by _cg_events_poll_fds.
+ * @param count The number of watches polled.
+ * @return The number of callbacks run.
+ */
+int _cg_events_run_watches(struct pollfd *fds, cg_uint count);
+#endif
+
+/**
+ * Hand the finished canvas_current over to the presentation thread
+ * and take the spare canvas to draw the next frame, with a copy of the
+ * finished one on it.
+ */
+void _cg_present_handoff();
+
+/*--------- END INTERNAL FUNCTION PROTOTYPES -----------*/
+
+#ifdef CONGFX_IMPLEMENTATION
+
+int cg_compare_colour(cg_rgb_t colour1, cg_rgb_t colour2)
+{
+    if (colour1.r != colour2.r || colour1.g != colour2.g || colour1.b != colour2.b)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+cg_cell_t *cg_make_cell(cg_char c, cg_rgb_t bg, cg_rgb_t fg)
+{
+    cg_cell_t *cell = (cg_cell_t *)_CG_CALLOC(1, sizeof(cg_cell_t));
+    if (cell == NULL)
+    {
+        printf("FATAL Error: Unable to allocate cg_cell_t.\n");
+        exit(-1);
+    }
+    cell->glyph = _cg_char_to_glyph(c);
+    cell->bg = _cg_pack_colour(bg);
+    cell->fg = _cg_pack_colour(fg);
+    return cell;
+}
+
+cg_rgb_t cg_get_cell_bg(cg_cell_t *cell)
+{
+    if (cell != NULL)
+    {
+        return _cg_unpack_colour(cell->bg);
+    }
+    return (cg_rgb_t){0, 0, 0};
+}
+
+cg_rgb_t cg_get_cell_fg(cg_cell_t *cell)
+{
+    if (cell != NULL)
+    {
+        return _cg_unpack_colour(cell->fg);
+    }
+    return (cg_rgb_t){255, 255, 255};
+}
+
+cg_char cg_get_cell_char(cg_cell_t *cell)
+{
+    if (cell != NULL)
+    {
+        if (cell->glyph < 128)
+        {
+            return (cg_char)cell->glyph;
+        }
+        cg_uint len;
+        const cg_char *bytes = cg_glyph_bytes(cell->glyph, &len);
+        if (len == 1)
+        {
+            return bytes[0];
+        }
+        return '?';
+    }
+    return ' ';
+}
+
+void cg_set_cell_bg(cg_cell_t *cell, cg_rgb_t bg)
+{
+    if (cell != NULL)
+    {
+        cell->bg = _cg_pack_colour(bg);
+    }
+}
+
+void cg_set_cell_fg(cg_cell_t *cell, cg_rgb_t fg)
+{
+    if (cell != NULL)
+    {
+        cell->fg = _cg_pack_colour(fg);
+    }
+}
 
 void cg_set_cell_char(cg_cell_t *cell, cg_char c)
 {
-    if (cell != NULL)
+    if (cell != NULL)
+    {
+        cell->glyph = _cg_char_to_glyph(c);
+    }
+}
+
+cg_glyph_t cg_get_cell_glyph(cg_cell_t *cell)
+{
+    if (cell != NULL)
+    {
+        return cell->glyph;
+    }
+    return ' ';
+}
+
+void cg_set_cell_glyph(cg_cell_t *cell, cg_glyph_t glyph)
+{
+    if (cell != NULL)
+    {
+        cell->glyph = glyph;
+    }
+}
+
+void cg_dispose_cell(cg_cell_t *cell)
+{
+    if (cell != NULL)
+    {
+        _CG_FREE(cell);
+    }
+}
+
+int cg_compare_cells(cg_cell_t *cell1, cg_cell_t *cell2)
+{
+    if (cell1 == NULL && cell2 == NULL)
+    {
+        return 0;
+    }
+    if (cell1 == NULL || cell2 == NULL)
+    {
+        return -1;
+    }
+    if (cell1->glyph != cell2->glyph)
+    {
+        return -1;
+    }
+    if (cell1->bg != cell2->bg || cell1->fg != cell2->fg)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Codepoint ranges that take up two terminal columns.
+ */
+static const uint32_t _cg_wide_ranges[][2] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+    {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+    {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F1E6, 0x1F1FF}, {0x1F200, 0x1F251},
+    {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393},
+    {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4},
+    {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596},
+    {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC},
+    {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC},
+    {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}};
+
+/*
+ * Codepoint ranges that take up no columns, they attach to the
+ * preceding character.
+ */
+static const uint32_t _cg_zero_width_ranges[][2] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x0900, 0x0902}, {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0x1F3FB, 0x1F3FF}, {0xE0020, 0xE007F}, {0xE0100, 0xE01EF}};
+
+int _cg_codepoint_in_ranges(uint32_t cp, const uint32_t (*ranges)[2], int count)
+{
+    int lo = 0;
+    int hi = count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cp < ranges[mid][0])
+        {
+            hi = mid - 1;
+        }
+        else if (cp > ranges[mid][1])
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int _cg_codepoint_width(uint32_t cp)
+{
+    if (cp < 0x300)
+    {
+        return 1;
+    }
+    if (_cg_codepoint_in_ranges(cp, _cg_zero_width_ranges,
+                                sizeof(_cg_zero_width_ranges) / sizeof(_cg_zero_width_ranges[0])))
+    {
+        return 0;
+    }
+    if (_cg_codepoint_in_ranges(cp, _cg_wide_ranges,
+                                sizeof(_cg_wide_ranges) / sizeof(_cg_wide_ranges[0])))
+    {
+        return 2;
+    }
+    return 1;
+}
+
+cg_uint _cg_utf8_decode(const cg_char *s, size_t n, uint32_t *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    cg_uint len;
+    uint32_t c;
+
+    if (n == 0)
+    {
+        *cp = 0;
+        return 0;
+    }
+
+    if (u[0] < 0x80)
+    {
+        *cp = u[0];
+        return 1;
+    }
+    else if ((u[0] & 0xE0) == 0xC0)
+    {
+        len = 2;
+        c = u[0] & 0x1F;
+    }
+    else if ((u[0] & 0xF0) == 0xE0)
+    {
+        len = 3;
+        c = u[0] & 0x0F;
+    }
+    else if ((u[0] & 0xF8) == 0xF0)
+    {
+        len = 4;
+        c = u[0] & 0x07;
+    }
+    else
+    {
+        *cp = 0xFFFD;
+        return 1;
+    }
+
+    if (len > n)
+    {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    for (cg_uint i = 1; i < len; i++)
+    {
+        if ((u[i] & 0xC0) != 0x80)
+        {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        c = (c << 6) | (u[i] & 0x3F);
+    }
+    *cp = c;
+    return len;
+}
+
+cg_uint _cg_utf8_grapheme(const cg_char *s, size_t n, int *width)
+{
+    uint32_t cp;
+    cg_uint len = _cg_utf8_decode(s, n, &cp);
+    int w = _cg_codepoint_width(cp);
+    // a lone combining mark still takes up a column
+    *width = (w == 0) ? 1 : w;
+
+    bool joined = false;
+    bool regional = (cp >= 0x1F1E6 && cp <= 0x1F1FF);
+    while (len < n)
+    {
+        uint32_t next;
+        cg_uint next_len = _cg_utf8_decode(s + len, n - len, &next);
+        bool attach = joined || _cg_codepoint_width(next) == 0 || next == 0x200D;
+        if (regional && next >= 0x1F1E6 && next <= 0x1F1FF)
+        {
+            // a pair of regional indicators is one flag
+            attach = true;
+            regional = false;
+        }
+        if (!attach || len + next_len > _CG_GLYPH_MAX_BYTES)
+        {
+            break;
+        }
+        joined = (next == 0x200D);
+        len += next_len;
+    }
+    return len;
+}
+
+void _cg_init_glyph_table()
+{
+    if (atomic_load_explicit(&_cg_glyphs.count, memory_order_acquire) > 0)
+    {
+        return;
+    }
+
+    _cg_mutex_lock(&_cg_glyph_lock);
+    if (atomic_load_explicit(&_cg_glyphs.count, memory_order_relaxed) > 0)
+    {
+        // another thread got here first
+        _cg_mutex_unlock(&_cg_glyph_lock);
+        return;
+    }
+
+    _cg_glyphs.pages[0] = (_cg_glyph_entry_t *)_CG_CALLOC(_CG_GLYPH_PAGE_SIZE, sizeof(_cg_glyph_entry_t));
+    _cg_glyphs.hash = (cg_glyph_t *)_CG_CALLOC(_CG_GLYPH_HASH_START_SIZE, sizeof(cg_glyph_t));
+    if (_cg_glyphs.pages[0] == NULL || _cg_glyphs.hash == NULL)
+    {
+        printf("FATAL Error: Unable to allocate glyph table.\n");
+        exit(-1);
+    }
+    _cg_glyphs.hash_size = _CG_GLYPH_HASH_START_SIZE;
+
+    for (int i = 0; i < 128; i++)
+    {
+        _cg_glyph_entry_t *entry = &(_cg_glyphs.pages[0][i]);
+        entry->bytes[0] = (cg_char)i;
+        entry->len = 1;
+        entry->width = 1;
+    }
+    // a NUL cell is shown as blank
+    _cg_glyphs.pages[0][0].bytes[0] = ' ';
+    atomic_store_explicit(&_cg_glyphs.count, 128, memory_order_release);
+    _cg_mutex_unlock(&_cg_glyph_lock);
+}
+
+_cg_glyph_entry_t *_cg_glyph_entry(cg_glyph_t glyph)
+{
+    return &(_cg_glyphs.pages[glyph / _CG_GLYPH_PAGE_SIZE][glyph % _CG_GLYPH_PAGE_SIZE]);
+}
+
+uint32_t _cg_glyph_hash(const cg_char *bytes, cg_uint len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (cg_uint i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void _cg_glyph_hash_insert(cg_glyph_t *hash, cg_uint hash_size, cg_glyph_t glyph)
+{
+    _cg_glyph_entry_t *entry = _cg_glyph_entry(glyph);
+    cg_uint i = _cg_glyph_hash(entry->bytes, entry->len) & (hash_size - 1);
+    while (hash[i] != 0)
+    {
+        i = (i + 1) & (hash_size - 1);
+    }
+    hash[i] = glyph;
+}
+
+cg_glyph_t _cg_intern_glyph_bytes(const cg_char *bytes, cg_uint len, int width)
+{
+    _cg_init_glyph_table();
+
+    if (len == 0)
+    {
+        return ' ';
+    }
+    if (len == 1 && (unsigned char)bytes[0] < 0x80)
+    {
+        return (cg_glyph_t)bytes[0];
+    }
+
+    _cg_mutex_lock(&_cg_glyph_lock);
+    cg_glyph_t glyph = _cg_intern_glyph_bytes_unlocked(bytes, len, width);
+    _cg_mutex_unlock(&_cg_glyph_lock);
+    return glyph;
+}
+
+cg_glyph_t _cg_intern_glyph_bytes_unlocked(const cg_char *bytes, cg_uint len, int width)
+{
+    if (len > _CG_GLYPH_MAX_BYTES)
+    {
+        len = _CG_GLYPH_MAX_BYTES;
+    }
+
+    // look for the glyph in the hash index
+    cg_uint mask = _cg_glyphs.hash_size - 1;
+    cg_uint i = _cg_glyph_hash(bytes, len) & mask;
+    while (_cg_glyphs.hash[i] != 0)
+    {
+        _cg_glyph_entry_t *entry = _cg_glyph_entry(_cg_glyphs.hash[i]);
+        if (entry->len == len && memcmp(entry->bytes, bytes, len) == 0)
+        {
+            return _cg_glyphs.hash[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    // add a new glyph
+    cg_uint id = atomic_load_explicit(&_cg_glyphs.count, memory_order_relaxed);
+    if (id >= _CG_GLYPH_MAX_PAGES * _CG_GLYPH_PAGE_SIZE)
+    {
+        return '?';
+    }
+    cg_uint page = id / _CG_GLYPH_PAGE_SIZE;
+    if (_cg_glyphs.pages[page] == NULL)
+    {
+        _cg_glyphs.pages[page] = (_cg_glyph_entry_t *)_CG_CALLOC(_CG_GLYPH_PAGE_SIZE, sizeof(_cg_glyph_entry_t));
+        if (_cg_glyphs.pages[page] == NULL)
+        {
+            return '?';
+        }
+    }
+    _cg_glyph_entry_t *entry = _cg_glyph_entry((cg_glyph_t)id);
+    memcpy(entry->bytes, bytes, len);
+    entry->len = (uint8_t)len;
+    entry->width = (width == 2) ? 2 : 1;
+    atomic_store_explicit(&_cg_glyphs.count, id + 1, memory_order_release);
+
+    // keep the hash index at most half full
+    if ((id + 1) * 2 > _cg_glyphs.hash_size)
+    {
+        cg_uint new_size = _cg_glyphs.hash_size * 2;
+        cg_glyph_t *new_hash = (cg_glyph_t *)_CG_CALLOC(new_size, sizeof(cg_glyph_t));
+        if (new_hash == NULL)
+        {
+            printf("FATAL Error: Unable to grow glyph table.\n");
+            exit(-1);
+        }
+        for (cg_uint g = 128; g <= id; g++)
+        {
+            _cg_glyph_hash_insert(new_hash, new_size, (cg_glyph_t)g);
+        }
+        _CG_FREE(_cg_glyphs.hash);
+        _cg_glyphs.hash = new_hash;
+        _cg_glyphs.hash_size = new_size;
+    }
+    else
+    {
+        _cg_glyph_hash_insert(_cg_glyphs.hash, _cg_glyphs.hash_size, (cg_glyph_t)id);
+    }
+
+    return (cg_glyph_t)id;
+}
+
+cg_glyph_t cg_intern_glyph(const cg_char *utf8)
+{
+    if (utf8 == NULL || utf8[0] == '\0')
+    {
+        return ' ';
+    }
+    int w;
+    size_t n = strlen(utf8);
+    cg_uint len = _cg_utf8_grapheme(utf8, n, &w);
+    return _cg_intern_glyph_bytes(utf8, len, w);
+}
+
+cg_glyph_t _cg_char_to_glyph(cg_char c)
+{
+    if ((unsigned char)c < 0x80)
+    {
+        return (cg_glyph_t)c;
+    }
+    // keep stray bytes as they are, as earlier versions did
+    return _cg_intern_glyph_bytes(&c, 1, 1);
+}
+
+cg_uint cg_glyph_width(cg_glyph_t glyph)
+{
+    if (glyph < 128)
+    {
+        return 1;
+    }
+    if (glyph == CG_GLYPH_CONTINUATION)
+    {
+        return 0;
+    }
+    _cg_init_glyph_table();
+    if (glyph >= atomic_load_explicit(&_cg_glyphs.count, memory_order_acquire))
+    {
+        return 1;
+    }
+    return _cg_glyph_entry(glyph)->width;
+}
+
+const cg_char *cg_glyph_bytes(cg_glyph_t glyph, cg_uint *len)
+{
+    _cg_init_glyph_table();
+    if (glyph >= atomic_load_explicit(&_cg_glyphs.count, memory_order_acquire))
+    {
+        glyph = '?';
+    }
+    _cg_glyph_entry_t *entry = _cg_glyph_entry(glyph);
+    if (len != NULL)
+    {
+        *len = entry->len;
+    }
+    return entry->bytes;
+}
+
+void _cg_canvas_break_wide(cg_cell_t *row, cg_uint x, cg_uint w)
+{
+    if (row[x].glyph == CG_GLYPH_CONTINUATION)
+    {
+        if (x > 0)
+        {
+            row[x - 1].glyph = ' ';
+        }
+    }
+    else if (row[x].glyph >= 128 && cg_glyph_width(row[x].glyph) == 2 && x + 1 < w)
+    {
+        row[x + 1].glyph = ' ';
+    }
+}
+
+void _cg_canvas_put(cg_canvas_t *canvas, cg_uint x, cg_uint y,
+                    cg_glyph_t glyph, cg_colour32_t fg, cg_colour32_t bg)
+{
+    cg_cell_t *row = canvas->cells + (y * canvas->width);
+    cg_uint w = cg_glyph_width(glyph);
+
+    if (w != 1 && (w == 0 || x + 1 >= canvas->width))
+    {
+        // a wide glyph does not fit in the last column
+        glyph = ' ';
+        w = 1;
+    }
+
+    _cg_canvas_break_wide(row, x, canvas->width);
+    if (w == 2)
+    {
+        _cg_canvas_break_wide(row, x + 1, canvas->width);
+        row[x + 1].glyph = CG_GLYPH_CONTINUATION;
+        row[x + 1].fg = fg;
+        row[x + 1].bg = bg;
+    }
+    row[x].glyph = glyph;
+    row[x].fg = fg;
+    row[x].bg = bg;
+}
+
+cg_colour32_t _cg_pack_colour(cg_rgb_t c)
+{
+    return ((cg_colour32_t)(c.r & 0xFF) << 16) |
+           ((cg_colour32_t)(c.g & 0xFF) << 8) |
+           (cg_colour32_t)(c.b & 0xFF);
+}
+
+cg_rgb_t _cg_unpack_colour(cg_colour32_t c)
+{
+    return (cg_rgb_t){(c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF};
+}
+
+cg_colour32_t _cg_blend_colour(cg_colour32_t dst, cg_colour32_t src,
+                               cg_uint alpha, cg_blend_mode_t mode)
+{
+    _cg_blend_span(&dst, 1, 1, src, alpha, mode);
+    return dst;
+}
+
+_CG_KERNEL
+void _cg_blend_span(cg_colour32_t *dst, size_t stride, size_t n,
+                    cg_colour32_t src, cg_uint alpha, cg_blend_mode_t mode)
+{
+    // scale alpha to 0-256 so the divide is a shift
+    uint32_t a = (alpha > 255) ? 256 : alpha + (alpha >> 7);
+    uint32_t ia = 256 - a;
+
+    switch (mode)
+    {
+    case CG_BLEND_ADD:
+    {
+        // scale the source once, then a saturating add
+        uint32_t s_rb = (((src & 0xFF00FF) * a) >> 8) & 0xFF00FF;
+        uint32_t s_g = (((src & 0x00FF00) * a) >> 8) & 0x00FF00;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t d = dst[i * stride];
+            uint32_t rb = (d & 0xFF00FF) + s_rb;
+            uint32_t g = (d & 0x00FF00) + s_g;
+            // turn the carry out of each channel into a saturated channel
+            uint32_t rb_carry = rb & 0x1000100;
+            uint32_t g_carry = g & 0x10000;
+            rb |= rb_carry - (rb_carry >> 8);
+            g |= g_carry - (g_carry >> 8);
+            dst[i * stride] = (rb & 0xFF00FF) | (g & 0x00FF00);
+        }
+        break;
+    }
+    case CG_BLEND_MULTIPLY:
+    {
+        uint32_t sr = (src >> 16) & 0xFF;
+        uint32_t sg = (src >> 8) & 0xFF;
+        uint32_t sb = src & 0xFF;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t d = dst[i * stride];
+            uint32_t m = ((((d >> 16) & 0xFF) * sr + 255) >> 8) << 16 |
+                         ((((d >> 8) & 0xFF) * sg + 255) >> 8) << 8 |
+                         (((d & 0xFF) * sb + 255) >> 8);
+            uint32_t rb = (((m & 0xFF00FF) * a + (d & 0xFF00FF) * ia) >> 8) & 0xFF00FF;
+            uint32_t g = (((m & 0x00FF00) * a + (d & 0x00FF00) * ia) >> 8) & 0x00FF00;
+            dst[i * stride] = rb | g;
+        }
+        break;
+    }
+    case CG_BLEND_NORMAL:
+    default:
+    {
+        // premultiply the source, two channels per multiply
+        uint32_t s_rb = (src & 0xFF00FF) * a;
+        uint32_t s_g = (src & 0x00FF00) * a;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t d = dst[i * stride];
+            uint32_t rb = ((s_rb + (d & 0xFF00FF) * ia) >> 8) & 0xFF00FF;
+            uint32_t g = ((s_g + (d & 0x00FF00) * ia) >> 8) & 0x00FF00;
+            dst[i * stride] = rb | g;
+        }
+        break;
+    }
+    }
+}
+
+cg_canvas_t *cg_make_canvas(cg_uint w, cg_uint h)
+{
+    cg_canvas_t *canvas = (cg_canvas_t *)_CG_CALLOC(1, sizeof(cg_canvas_t));
+    if (canvas == NULL)
+    {
+        printf("FATAL Error: Unable to allocate cg_canvas_t.\n");
+        exit(-1);
+    }
+    canvas->width = w;
+    canvas->height = h;
+    canvas->cells = (cg_cell_t *)_CG_CALLOC(w * h, sizeof(cg_cell_t));
+    if (canvas->cells == NULL)
+    {
+        printf("FATAL Error: Unable to allocate cg_cell_t array.\n");
+        exit(-1);
+    }
+
+    // allocate cells
+    for (cg_uint i = 0; i < h; i++)
+    {
+        for (cg_uint j = 0; j < w; j++)
+        {
+            canvas->cells[(i * w) + j] = *cg_make_cell(_CG_DEFAULT_BACKGROUND_CHAR, default_bg_colour, default_fg_colour);
+        }
+    }
+    return canvas;
+}
+
+cg_cell_t *cg_get_cell(cg_canvas_t *canvas, cg_uint x, cg_uint y)
+{
+    if (canvas == NULL)
+    {
+        return NULL;
+    }
+    if (x >= canvas->width || y >= canvas->height)
+    {
+        return NULL;
+    }
+    return &(canvas->cells[(y * canvas->width) + x]);
+}
+
+void cg_dispose_canvas(cg_canvas_t *canvas)
+{
+    if (canvas != NULL)
+    {
+        if (canvas->cells != NULL)
+        {
+            _CG_FREE(canvas->cells);
+        }
+        _CG_FREE(canvas);
+    }
+}
+cg_uint _diff_time_micros(struct timespec time1, struct timespec time2)
+{
+    // printf("time1 [%ld, %ld], time2[%ld, %ld]\n", time1.tv_sec, time1.tv_nsec, time2.tv_sec, time2.tv_nsec);
+    cg_uint seconds_delta = (time1.tv_sec - time2.tv_sec);
+    cg_int nanos_delta = (time1.tv_nsec - time2.tv_nsec);
+    cg_uint delta = (seconds_delta * 1000000) + (nanos_delta / 1000);
+    // printf("seconds_delta = %lu, nanos_delta = %ld, delta = %lu\n", seconds_delta, nanos_delta, delta);
+    return delta;
+}
+
+void _cg_stats_record(cg_stat_id_t id, uint64_t value)
+{
+    _cg_mutex_lock(&_cg_stats.lock);
+    _cg_stats.samples[id][_cg_stats.count[id] % _CG_STATS_WINDOW] = value;
+    _cg_stats.count[id]++;
+    if (id == CG_STAT_BYTES)
+    {
+        _cg_stats.total_bytes += value;
+    }
+    _cg_mutex_unlock(&_cg_stats.lock);
+}
+
+uint64_t _cg_stats_phase(cg_stat_id_t id)
+{
+    uint64_t now = _cg_now_nanos();
+    _cg_stats_record(id, now - _cg_stats.mark);
+    _cg_stats.mark = now;
+    return now;
+}
+
+int _cg_stats_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+cg_frame_stats_t cg_get_frame_stats()
+{
+    cg_frame_stats_t result;
+    uint64_t sorted[_CG_STATS_WINDOW];
+    memset(&result, 0, sizeof(result));
+
+    _cg_mutex_lock(&_cg_stats.lock);
+    for (int id = 0; id < CG_STAT_COUNT; id++)
+    {
+        cg_uint n = (_cg_stats.count[id] < _CG_STATS_WINDOW) ? _cg_stats.count[id] : _CG_STATS_WINDOW;
+        if (n == 0)
+        {
+            continue;
+        }
+        cg_stat_t *stat = &result.stats[id];
+        stat->last = _cg_stats.samples[id][(_cg_stats.count[id] - 1) % _CG_STATS_WINDOW];
+        memcpy(sorted, _cg_stats.samples[id], n * sizeof(uint64_t));
+        qsort(sorted, n, sizeof(uint64_t), _cg_stats_compare);
+        stat->p50 = sorted[(n - 1) * 50 / 100];
+        stat->p99 = sorted[(n - 1) * 99 / 100];
+        stat->max = sorted[n - 1];
+    }
+    result.frames = (_cg_stats.count[CG_STAT_FRAME] < _CG_STATS_WINDOW) ? _cg_stats.count[CG_STAT_FRAME] : _CG_STATS_WINDOW;
+    result.total_bytes = _cg_stats.total_bytes;
+    _cg_mutex_unlock(&_cg_stats.lock);
+
+    result.frames_skipped = cg_get_frames_skipped();
+    return result;
+}
+
+uint64_t _cg_time_nanos(struct timespec t)
+{
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+uint64_t _cg_now_nanos()
+{
+    struct timespec t;
+    _cg_clock_get_time(&t);
+    return _cg_time_nanos(t);
+}
+
+void _cg_sleep_until(uint64_t deadline)
+{
+#if CG_PLATFORM_POSIX && !defined(__APPLE__)
+    struct timespec t;
+    t.tv_sec = (time_t)(deadline / 1000000000ULL);
+    t.tv_nsec = (long)(deadline % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+    {
+    }
+#else
+    // no absolute sleep, but the deadline still keeps errors from adding up
+    uint64_t now = _cg_now_nanos();
+    if (deadline <= now)
+    {
+        return;
+    }
+    struct timespec t;
+    t.tv_sec = (time_t)((deadline - now) / 1000000000ULL);
+    t.tv_nsec = (long)((deadline - now) % 1000000000ULL);
+#if CG_PLATFORM_WINDOWS
+    _cg_win_nanosleep(&t, NULL);
+#else
+    nanosleep(&t, NULL);
+#endif
+#endif
+}
+
+void cg_err_fatal(cg_string message, cg_uint code)
+{
+    printf("FATAL: %s\n", message);
+    exit(code);
+}
+
+void cg_err_fatal_msg(cg_string message)
+{
+    cg_err_fatal(message, -1);
+}
+
+cg_uint cg_number_to_uinteger(cg_number x)
+{
+    if (x < 0)
+    {
+        return 0;
+    }
+    else
+    {
+        return (cg_uint)x;
+    }
+}
+
+// type utility functions
+cg_string cg_make_string(cg_uint length)
+{
+    cg_string s = (cg_string)_CG_CALLOC(length + 1, sizeof(cg_char));
+    if (s == NULL)
+    {
+        printf("FATAL Error: Unable to allocate cg_string.\n");
+        exit(-1);
+    }
+    return s;
+}
+
+void cg_dispose_string(cg_string s)
+{
+    if (s != NULL)
+    {
+        _CG_FREE(s);
+    }
+}
+
+uint64_t _cg_splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t _cg_rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+void cg_seed_random(uint64_t seed)
+{
+    // the seeding thread takes its stream first, so its sequence does
+    // not depend on which other threads drew before
+    _cg_rand_stream_id();
+    _cg_rand_seed = seed;
+    _cg_rand_seeded = true;
+    atomic_fetch_add(&_cg_rand_generation, 1);
+}
+
+uint64_t _cg_rand_stream_id()
+{
+    if (_cg_worker_index >= 0)
+    {
+        return (uint64_t)_cg_worker_index + 1;
+    }
+    if (_cg_rand_stream == 0)
+    {
+        _cg_rand_stream = _CG_RAND_THREAD_STREAMS + atomic_fetch_add(&_cg_rand_streams, 1);
+    }
+    return _cg_rand_stream;
+}
+
+_cg_rand_t *_cg_rand_state()
+{
+    uint64_t generation = atomic_load(&_cg_rand_generation);
+    if (_cg_rand.generation != generation)
+    {
+        // each thread has a stream of its own
+        uint64_t x = _cg_rand_seed ^ (_cg_rand_stream_id() * 0xD1B54A32D192ED03ULL);
+        for (int i = 0; i < 4; i++)
+        {
+            _cg_rand.s[i] = _cg_splitmix64(&x);
+        }
+        for (int j = 0; j < _CG_RAND_LANES; j++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                _cg_rand.lanes[i][j] = _cg_splitmix64(&x);
+            }
+        }
+        _cg_rand.generation = generation;
+    }
+    return &_cg_rand;
+}
+
+uint64_t _cg_rand_next(_cg_rand_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = _cg_rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _cg_rotl64(s[3], 45);
+    return result;
+}
+
+uint32_t cg_rand_u32()
+{
+    return (uint32_t)(_cg_rand_next(_cg_rand_state()) >> 32);
+}
+
+int cg_rand_int(int from, int to)
+{
+    if (to < from)
+    {
+        int swap = from;
+        from = to;
+        to = swap;
+    }
+
+    // multiply into the range, rejecting the few values which would make
+    // some results more likely than others (Lemire)
+    _cg_rand_t *rng = _cg_rand_state();
+    uint32_t range = (uint32_t)((int64_t)to - from + 1);
+    uint32_t x = (uint32_t)(_cg_rand_next(rng) >> 32);
+    if (range == 0)
+    {
+        // the full 32 bit range
+        return (int)((int64_t)from + x);
+    }
+    uint64_t m = (uint64_t)x * range;
+    uint32_t low = (uint32_t)m;
+    if (low < range)
+    {
+        uint32_t threshold = (0u - range) % range;
+        while (low < threshold)
+        {
+            x = (uint32_t)(_cg_rand_next(rng) >> 32);
+            m = (uint64_t)x * range;
+            low = (uint32_t)m;
+        }
+    }
+    return (int)((int64_t)from + (int64_t)(m >> 32));
+}
+
+_CG_KERNEL
+void cg_rand_fill(uint32_t *out, size_t count)
+{
+    _cg_rand_t *rng = _cg_rand_state();
+    uint64_t s0[_CG_RAND_LANES], s1[_CG_RAND_LANES], s2[_CG_RAND_LANES], s3[_CG_RAND_LANES];
+    memcpy(s0, rng->lanes[0], sizeof(s0));
+    memcpy(s1, rng->lanes[1], sizeof(s1));
+    memcpy(s2, rng->lanes[2], sizeof(s2));
+    memcpy(s3, rng->lanes[3], sizeof(s3));
+
+    // every step gives 64 bits from each lane, the lanes do not depend on
+    // each other and their state is local, so they run side by side, in
+    // vector registers where the compiler can, the multiplies by 5 and 9
+    // are shifts and adds for that
+    size_t steps = count / (2 * _CG_RAND_LANES);
+    for (size_t k = 0; k < steps; k++)
+    {
+        uint64_t result[_CG_RAND_LANES];
+        for (int j = 0; j < _CG_RAND_LANES; j++)
+        {
+            uint64_t x = (s1[j] << 2) + s1[j];
+            x = (x << 7) | (x >> 57);
+            result[j] = (x << 3) + x;
+            uint64_t t = s1[j] << 17;
+            s2[j] ^= s0[j];
+            s3[j] ^= s1[j];
+            s1[j] ^= s2[j];
+            s0[j] ^= s3[j];
+            s2[j] ^= t;
+            s3[j] = (s3[j] << 45) | (s3[j] >> 19);
+        }
+        memcpy(out + k * 2 * _CG_RAND_LANES, result, sizeof(result));
+    }
+
+    memcpy(rng->lanes[0], s0, sizeof(s0));
+    memcpy(rng->lanes[1], s1, sizeof(s1));
+    memcpy(rng->lanes[2], s2, sizeof(s2));
+    memcpy(rng->lanes[3], s3, sizeof(s3));
+
+    // the rest from the thread generator
+    for (size_t i = steps * 2 * _CG_RAND_LANES; i < count; i++)
+    {
+        out[i] = (uint32_t)(_cg_rand_next(rng) >> 32);
+    }
+}
+
+int cg_clamp(int x, int min, int max)
+{
+    if (x < min)
+    {
+        return min;
+    }
+    if (x > max)
+    {
+        return max;
+    }
+    return x;
+}
+
+void cg_no_loop()
+{
+    _loop = 0;
+}
+
+void cg_request_redraw()
+{
+    atomic_store(&_cg_events.redraw, true);
+    _cg_events_wake();
+}
+
+void cg_redraw_every(cg_uint millis)
+{
+    _cg_events.timer_period = (uint64_t)millis * 1000000ULL;
+    _cg_events.timer_deadline = _cg_now_nanos() + _cg_events.timer_period;
+}
+
+int cg_watch_fd(int fd, int events, cg_fd_fn fn, void *userdata)
+{
+#if CG_PLATFORM_WINDOWS
+    // console handles and sockets can not be waited on together
+    return -1;
+#else
+    if (fd < 0 || fn == NULL)
+    {
+        return -1;
+    }
+
+    for (cg_uint i = 0; i < _cg_events.watch_count; i++)
+    {
+        if (_cg_events.watches[i].fd == fd)
+        {
+            _cg_events.watches[i] = (_cg_watch_t){fd, events, fn, userdata, false};
+            return 0;
+        }
+    }
+
+    if (_cg_events.watch_count == _cg_events.watch_capacity)
+    {
+        cg_uint capacity = (_cg_events.watch_capacity == 0) ? _CG_WATCH_START_SIZE : _cg_events.watch_capacity * 2;
+        _cg_watch_t *watches = (_cg_watch_t *)_CG_REALLOC(_cg_events.watches, capacity * sizeof(_cg_watch_t));
+        if (watches == NULL)
+        {
+            return -1;
+        }
+        _cg_events.watches = watches;
+        _cg_events.watch_capacity = capacity;
+    }
+    _cg_events.watches[_cg_events.watch_count++] = (_cg_watch_t){fd, events, fn, userdata, false};
+    return 0;
+#endif
+}
+
+void cg_unwatch_fd(int fd)
+{
+    for (cg_uint i = 0; i < _cg_events.watch_count; i++)
+    {
+        if (_cg_events.watches[i].fd == fd)
+        {
+            _cg_events.watches[i] = _cg_events.watches[--_cg_events.watch_count];
+            return;
+        }
+    }
+}
+
+#if CG_PLATFORM_POSIX
+struct pollfd *_cg_events_poll_fds(cg_uint base)
+{
+    cg_uint needed = base + _cg_events.watch_count;
+    if (needed > _cg_events.fds_capacity)
+    {
+        cg_uint capacity = (_cg_events.fds_capacity == 0) ? _CG_WATCH_START_SIZE : _cg_events.fds_capacity;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        struct pollfd *fds = (struct pollfd *)_CG_REALLOC(_cg_events.fds, capacity * sizeof(struct pollfd));
+        if (fds == NULL)
+        {
+            return NULL;
+        }
+        _cg_events.fds = fds;
+        _cg_events.fds_capacity = capacity;
+    }
+
+    for (cg_uint i = 0; i < _cg_events.watch_count; i++)
+    {
+        _cg_watch_t *w = &_cg_events.watches[i];
+        short events = 0;
+        events |= (w->events & CG_FD_READ) ? POLLIN : 0;
+        events |= (w->events & CG_FD_WRITE) ? POLLOUT : 0;
+        // a hung up or closed fd stays ready, poll would return at once
+        _cg_events.fds[base + i] = (struct pollfd){w->failed ? -1 : w->fd, events, 0};
+    }
+    return _cg_events.fds;
+}
+
+int _cg_events_run_watches(struct pollfd *fds, cg_uint count)
+{
+    int ran = 0;
+    for (cg_uint i = 0; i < count; i++)
+    {
+        if (fds[i].revents == 0)
+        {
+            continue;
+        }
+
+        int events = 0;
+        events |= (fds[i].revents & POLLIN) ? CG_FD_READ : 0;
+        events |= (fds[i].revents & POLLOUT) ? CG_FD_WRITE : 0;
+        events |= (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) ? CG_FD_ERROR : 0;
+
+        // an earlier callback may have changed the watches, look it up again
+        for (cg_uint j = 0; j < _cg_events.watch_count; j++)
+        {
+            _cg_watch_t w = _cg_events.watches[j];
+            if (w.fd == fds[i].fd)
+            {
+                if (events & CG_FD_ERROR)
+                {
+                    _cg_events.watches[j].failed = true;
+                }
+                w.fn(w.fd, events, w.userdata);
+                ran++;
+                break;
+            }
+        }
+    }
+    return ran;
+}
+#endif
+
+int _cg_events_dispatch(int timeout_ms)
+{
+#if CG_PLATFORM_POSIX
+    if (_cg_events.watch_count == 0)
+    {
+        return 0;
+    }
+
+    cg_uint count = _cg_events.watch_count;
+    struct pollfd *fds = _cg_events_poll_fds(0);
+    if (fds == NULL || poll(fds, count, timeout_ms) <= 0)
+    {
+        return 0;
+    }
+    return _cg_events_run_watches(fds, count);
+#else
+    return 0;
+#endif
+}
+
+int _cg_events_open()
+{
+    if (_cg_events.open)
+    {
+        return 0;
+    }
+#if CG_PLATFORM_WINDOWS
+    _cg_events.wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (_cg_events.wake == NULL)
+    {
+        return -1;
+    }
+#elif CG_PLATFORM_POSIX
+    if (pipe(_cg_events.wake) == -1)
+    {
+        return -1;
+    }
+    // a full pipe already wakes the loop, writers never need to wait
+    fcntl(_cg_events.wake[0], F_SETFL, fcntl(_cg_events.wake[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(_cg_events.wake[1], F_SETFL, fcntl(_cg_events.wake[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+    _cg_events.open = true;
+    return 0;
+}
+
+void _cg_events_close()
+{
+    if (!_cg_events.open)
+    {
+        return;
+    }
+#if CG_PLATFORM_WINDOWS
+    CloseHandle(_cg_events.wake);
+#elif CG_PLATFORM_POSIX
+    close(_cg_events.wake[0]);
+    close(_cg_events.wake[1]);
+    _CG_FREE(_cg_events.fds);
+    _cg_events.fds = NULL;
+    _cg_events.fds_capacity = 0;
+#endif
+    _CG_FREE(_cg_events.watches);
+    _cg_events.watches = NULL;
+    _cg_events.watch_count = 0;
+    _cg_events.watch_capacity = 0;
+    _cg_events.open = false;
+}
+
+void _cg_events_wake()
+{
+    if (!_cg_events.open)
+    {
+        return;
+    }
+#if CG_PLATFORM_WINDOWS
+    SetEvent(_cg_events.wake);
+#elif CG_PLATFORM_POSIX
+    char c = 0;
+    if (write(_cg_events.wake[1], &c, 1) == -1)
+    {
+        // the pipe is full, the loop is woken already
+    }
+#endif
+}
+
+void _cg_events_wait()
+{
+    for (;;)
+    {
+        if (atomic_exchange(&_cg_events.redraw, false) || atomic_load(&_cg_gfx_context->should_exit))
+        {
+            return;
+        }
+
+        // when the timer is due
+        int timeout = -1;
+        if (_cg_events.timer_period > 0)
+        {
+            uint64_t now = _cg_now_nanos();
+            if (now >= _cg_events.timer_deadline)
+            {
+                _cg_events.timer_deadline += _cg_events.timer_period;
+                if (_cg_events.timer_deadline <= now)
+                {
+                    _cg_events.timer_deadline = now + _cg_events.timer_period;
+                }
+                return;
+            }
+            timeout = (int)((_cg_events.timer_deadline - now + 999999) / 1000000);
+        }
+
+        // an unfinished escape sequence which times out is a key press
+        if (!atomic_load(&_cg_input.running))
+        {
+            int input_timeout = _cg_input_timeout_ms();
+            if (input_timeout == 0)
+            {
+                return;
+            }
+            if (input_timeout > 0 && (timeout < 0 || input_timeout < timeout))
+            {
+                timeout = input_timeout;
+            }
+        }
+
+#if CG_PLATFORM_WINDOWS
+        HANDLE handles[2];
+        DWORD count = 0;
+        handles[count++] = _cg_events.wake;
+        if (!atomic_load(&_cg_input.running) && _cg_backend.ops == &_cg_backend_tty)
+        {
+            handles[count++] = _cg_gfx_context->_cg_hin;
+        }
+        DWORD r = WaitForMultipleObjects(count, handles, FALSE, (timeout < 0) ? INFINITE : (DWORD)timeout);
+        if (r == WAIT_OBJECT_0 + 1)
+        {
+            // console input, which may only be focus or mouse events
+            DWORD events = 0;
+            if (GetNumberOfConsoleInputEvents(_cg_gfx_context->_cg_hin, &events) && events > 0)
+            {
+                return;
+            }
+        }
+#elif CG_PLATFORM_POSIX
+        // the loop's own fds, then the watches
+        struct pollfd *fds = _cg_events_poll_fds(3);
+        if (fds == NULL)
+        {
+            return;
+        }
+        cg_uint watches = _cg_events.watch_count;
+        fds[0] = (struct pollfd){_cg_events.wake[0], POLLIN, 0};
+        fds[1] = (struct pollfd){_cg_backend.out_fd, POLLOUT, 0};
+        fds[2] = (struct pollfd){atomic_load(&_cg_backend.hung_up) ? -1 : _cg_backend.in_fd, POLLIN, 0};
+        const int out = 1;
+        const int in = 2;
+
+        // the input thread reads stdin, and wakes the loop itself
+        if (atomic_load(&_cg_input.running))
+        {
+            fds[in].fd = -1;
+        }
+        // only wait on the terminal taking output if some is pending
+        if (cg_get_output_pending() == 0)
+        {
+            fds[out].fd = -1;
+        }
+
+        if (poll(fds, 3 + watches, timeout) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            char buf[64];
+            while (read(_cg_events.wake[0], buf, sizeof(buf)) > 0)
+            {
+            }
+        }
+        if (fds[out].revents != 0)
+        {
+            // the terminal took some output, if a frame was skipped on
+            // the way the screen is behind, draw it once all is written
+            if (_cg_output_drain(0) == 0 && _cg_output.stale)
+            {
+                return;
+            }
+        }
+        if (fds[in].revents != 0)
+        {
+            // hung up with nothing left to read, the input is not
+            // polled again, it would be ready every time
+            if (!(fds[in].revents & POLLIN))
+            {
+                _cg_backend_hangup();
+            }
+            return;
+        }
+        if (_cg_events_run_watches(fds + 3, watches) > 0)
+        {
+            return;
+        }
+#endif
+    }
+}
+
+void cg_loop()
+{
+    _loop = 1;
+}
+
+void cg_frame_rate(cg_uint fps)
+{
+    _fps = fps;
+    if (_cg_gfx_context != NULL)
+    {
+        // pace from now on, the old deadline may be far off
+        _cg_gfx_context->frame_period = (fps > 0) ? 1000000000ULL / fps : 0;
+        _cg_gfx_context->frame_deadline = _cg_now_nanos();
+    }
+}
+
+void cg_fixed_step(cg_uint hz)
+{
+    _step_hz = hz;
+    if (_cg_gfx_context != NULL)
+    {
+        _cg_gfx_context->step_period = (hz > 0) ? 1000000000ULL / hz : 0;
+        _cg_gfx_context->step_accumulator = 0;
+    }
+}
+
+int cg_step()
+{
+    _cg_graphics_context_t *ctx = _cg_gfx_context;
+    if (ctx == NULL || ctx->step_period == 0 || ctx->step_accumulator < ctx->step_period)
+    {
+        return 0;
+    }
+    ctx->step_accumulator -= ctx->step_period;
+    return 1;
+}
+
+cg_uint cg_get_step_micros()
+{
+    return (_cg_gfx_context != NULL) ? (cg_uint)(_cg_gfx_context->step_period / 1000) : 0;
+}
+
+double cg_get_step_alpha()
+{
+    _cg_graphics_context_t *ctx = _cg_gfx_context;
+    if (ctx == NULL || ctx->step_period == 0)
+    {
+        return 0.0;
+    }
+    return (double)ctx->step_accumulator / (double)ctx->step_period;
+}
+
+// terminal utility functions
+void cg_cls()
+{
+    if (_cg_buffer == NULL)
+    {
+        printf("\033[2J");
+        fflush(stdout);
+        return;
+    }
+    _cg_term_buffer_command(_cg_buffer, "\033[2J", 4);
+    _cg_term_flush_command_buffer(_cg_buffer);
+}
+
+void cg_home()
+{
+    if (_cg_buffer == NULL)
+    {
+        printf("\033[H");
+        fflush(stdout);
+        return;
+    }
+    _cg_term_buffer_command(_cg_buffer, "\033[H", 3);
+    _cg_term_flush_command_buffer(_cg_buffer);
+}
+
+void _cg_term_enable_raw_mode()
+{
+#if CG_PLATFORM_WINDOWS
+    _cg_win_term_enable_raw_mode();
+#elif CG_PLATFORM_POSIX
+    _cg_posix_term_enable_raw_mode();
+#endif
+}
+
+void _cg_term_disable_raw_mode()
+{
+#if CG_PLATFORM_WINDOWS
+    _cg_win_term_disable_raw_mode();
+#elif CG_PLATFORM_POSIX
+    _cg_posix_term_disable_raw_mode();
+#endif
+}
+
+#if CG_PLATFORM_WINDOWS
+void _cg_win_term_enable_raw_mode()
+{
+    _cg_gfx_context->_cg_hin = GetStdHandle(STD_INPUT_HANDLE);
+    if (_cg_gfx_context->_cg_hin == INVALID_HANDLE_VALUE)
+    {
+        cg_err_fatal_msg("GetStdHandle");
+    }
+
+    if (!GetConsoleMode(_cg_gfx_context->_cg_hin, &_cg_gfx_context->_cg_orig_in_mode))
+    {
+        cg_err_fatal_msg("GetConsoleMode");
+    }
+
+    DWORD raw = _cg_gfx_context->_cg_orig_in_mode;
+
+    raw &= ~(ENABLE_ECHO_INPUT);
+    raw &= ~(ENABLE_LINE_INPUT);
+    raw &= ~(ENABLE_PROCESSED_INPUT);
+    raw &= ~(ENABLE_WINDOW_INPUT);
+    raw &= ~(ENABLE_MOUSE_INPUT);
+
+    // Optional: disable Ctrl+C handling
+    raw &= ~(ENABLE_PROCESSED_INPUT);
+
+    if (!SetConsoleMode(_cg_gfx_context->_cg_hin, raw))
+    {
+        cg_err_fatal_msg("SetConsoleMode");
+    }
+
+    atexit(_cg_term_disable_raw_mode);
+
+    // Enable vt100
+    _cg_gfx_context->_cg_hout = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    DWORD out_mode;
+    GetConsoleMode(_cg_gfx_context->_cg_hout, &out_mode);
+
+    out_mode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+
+    SetConsoleMode(_cg_gfx_context->_cg_hout, out_mode);
+
+    // Enable UTF8 in Windows
+    SetConsoleOutputCP(CP_UTF8);
+}
+
+void _cg_win_term_disable_raw_mode()
+{
+    // restored already, by cg_destroy_graphics
+    if (_cg_gfx_context == NULL)
+    {
+        return;
+    }
+    SetConsoleMode(_cg_gfx_context->_cg_hin, _cg_gfx_context->_cg_orig_in_mode);
+}
+#endif
+
+#if CG_PLATFORM_POSIX
+void _cg_posix_term_enable_raw_mode()
+{
+    int in = _cg_backend.in_fd;
+    int out = _cg_backend.out_fd;
+    if (tcgetattr(in, &orig_termios) == -1)
+    {
+        cg_err_fatal_msg("tcgetattr");
+    }
+
+    if (!_cg_term_atexit)
+    {
+        atexit(_cg_term_disable_raw_mode);
+        _cg_term_atexit = true;
+    }
+    struct termios raw = orig_termios;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= (CS8);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 1;
+
+    if (tcsetattr(in, TCSAFLUSH, &raw) == -1)
+    {
+        cg_err_fatal_msg("tcsetattr");
+    }
+    _cg_term_raw_in = in;
+    _cg_term_raw_out = out;
+
+    // Get the current flags
+    if ((_cg_term_orig_flags = fcntl(in, F_GETFL, 0)) == -1)
+    {
+        cg_err_fatal_msg("fcntl error getting flags");
+    }
+
+    // Set the flags to be non-blocking
+    if ((fcntl(in, F_SETFL, _cg_term_orig_flags | O_NONBLOCK) == -1))
+    {
+        cg_err_fatal_msg("fcntl error setting flags");
+    }
+
+    // the output too, a full terminal queues output instead of stalling
+    if ((_cg_term_orig_out_flags = fcntl(out, F_GETFL, 0)) == -1)
+    {
+        cg_err_fatal_msg("fcntl error getting flags");
+    }
+    if ((fcntl(out, F_SETFL, _cg_term_orig_out_flags | O_NONBLOCK) == -1))
+    {
+        cg_err_fatal_msg("fcntl error setting flags");
+    }
+}
+
+void _cg_posix_term_disable_raw_mode()
+{
+    // restored already, by cg_destroy_graphics
+    int in = _cg_term_raw_in;
+    int out = _cg_term_raw_out;
+    if (in < 0)
+    {
+        return;
+    }
+    _cg_term_raw_in = -1;
+    _cg_term_raw_out = -1;
+
+    // a terminal which was closed has no settings to give back
+    if (tcsetattr(in, TCSAFLUSH, &orig_termios) == -1 && errno != EIO)
+    {
+        cg_err_fatal_msg("tcsetattr");
+    }
+
+    // Reset the flags
+    if (fcntl(out, F_SETFL, _cg_term_orig_out_flags) == -1)
+    {
+        cg_err_fatal_msg("fcntl error resetting flags");
+    }
+    if (fcntl(in, F_SETFL, _cg_term_orig_flags) == -1)
+    {
+        cg_err_fatal_msg("fcntl error resetting flags");
+    }
+}
+#endif
+
+int _cg_term_create_command_buffer(_cg_term_command_buffer_t **buffer)
+{
+    *buffer = (_cg_term_command_buffer_t *)_CG_CALLOC(1, sizeof(_cg_term_command_buffer_t));
+    if (*buffer == NULL)
+    {
+        return -1;
+    }
+    (*buffer)->buffer = (cg_char *)_CG_CALLOC(_CG_TERM_COMMAND_BUFFER_START_SIZE, sizeof(cg_char));
+    if ((*buffer)->buffer == NULL)
+    {
+        return -1;
+    }
+    (*buffer)->length = 0;
+    // Mark the first character as the null terminator
+    (*buffer)->buffer[0] = '\0';
+    (*buffer)->size = _CG_TERM_COMMAND_BUFFER_START_SIZE;
+    return 0;
+}
+
+int _cg_term_expand_command_buffer(_cg_term_command_buffer_t *buffer, size_t more_required)
+{
+    // use realloc to expand the buffer, at least doubling it
+    size_t new_size = buffer->size + more_required;
+    if (new_size < buffer->size * 2)
+    {
+        new_size = buffer->size * 2;
+    }
+    cg_char *new_buffer = (cg_char *)_CG_REALLOC(buffer->buffer, new_size * sizeof(cg_char));
+    if (new_buffer == NULL)
+    {
+        return -1;
+    }
+    buffer->buffer = new_buffer;
+    buffer->size = new_size;
+    return 0;
+}
+
+void _cg_term_dispose_command_buffer(_cg_term_command_buffer_t *buffer)
+{
+    if (buffer != NULL)
+    {
+        if (buffer->buffer != NULL)
+        {
+            _CG_FREE(buffer->buffer);
+        }
+        _CG_FREE(buffer);
+    }
+}
+
+int _cg_term_buffer_append(_cg_term_command_buffer_t *buffer, const cg_char *bytes, size_t length)
+{
+    size_t new_size = buffer->length + length + 1;
+    if (new_size > buffer->size)
+    {
+        if (_cg_term_expand_command_buffer(buffer, new_size - buffer->size) == -1)
+        {
+            return -1;
+        }
+    }
+
+    memcpy(buffer->buffer + buffer->length, bytes, length);
+    buffer->length += length;
+    buffer->buffer[buffer->length] = '\0';
+    return 0;
+}
+
+int _cg_term_buffer_command(_cg_term_command_buffer_t *buffer, cg_string command, size_t length)
+{
+    if (buffer == NULL || command == NULL)
+    {
+        return -1;
+    }
+
+    size_t n = (length == 0) ? strlen(command) : length;
+    int err = 0;
+
+    _cg_mutex_lock(&_cg_out_lock);
+    if (_cg_term_buffer_append(buffer, command, n) == -1)
+    {
+        _cg_mutex_unlock(&_cg_out_lock);
+        return -1;
+    }
+
+    // Commands used to be flushed one by one on posix, as they got
+    // written incomplete on iterm/macos term. The tty is non-blocking
+    // (stdin and stdout share it), so stdio dropped whatever did not fit;
+    // _cg_term_write_iov now queues it as pending output instead.
+    if (buffer->length >= _CG_TERM_COMMAND_BUFFER_FLUSH_LIMIT)
+    {
+        err = _cg_term_flush_command_buffer_unlocked(buffer);
+    }
+    _cg_mutex_unlock(&_cg_out_lock);
+
+    return err;
+}
+
+#if CG_PLATFORM_WINDOWS
+int _cg_win_write(const cg_char *bytes, size_t length)
+{
+    DWORD written = 0;
+    BOOL ok = FALSE;
+    DWORD mode = 0;
+
+    if (GetConsoleMode(_cg_gfx_context->_cg_hout, &mode))
+    {
+        // Real console: explicit ANSI variant avoids UNICODE macro issues
+        ok = WriteConsoleA(_cg_gfx_context->_cg_hout, bytes, (DWORD)length, &written, NULL);
+    }
+    else
+    {
+        // Redirected/pipe/pseudoconsole path
+        ok = WriteFile(_cg_gfx_context->_cg_hout, bytes, (DWORD)length, &written, NULL);
+    }
+
+    if (!ok || written != (DWORD)length)
+    {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int _cg_term_write_iov(_cg_iovec_t *iov, int count)
+{
+    _cg_record_iov(iov, count);
+
+#if CG_PLATFORM_WINDOWS
+    // the console and the memory buffer take everything at once
+    if (_cg_backend.ops->write_iov(iov, count) == -1)
+    {
+        return -1;
+    }
+#elif CG_PLATFORM_POSIX
+    // older output goes first, if the terminal still has not taken it
+    // all the new output is queued behind it
+    long pending = _cg_output_write_pending();
+    if (pending == -1)
+    {
+        return -1;
+    }
+
+    while (count > 0 && pending == 0)
+    {
+        long n = _cg_backend.ops->write_iov(iov, (count > IOV_MAX) ? IOV_MAX : count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return -1;
+        }
+
+        // skip over what was written
+        size_t done = (size_t)n;
+        while (count > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (cg_char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    // the terminal is full, keep the rest for later
+    if (count > 0 && _cg_output.pending == NULL)
+    {
+        if (_cg_term_create_command_buffer(&_cg_output.pending) == -1)
+        {
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (_cg_term_buffer_append(_cg_output.pending, (const cg_char *)iov[i].iov_base, iov[i].iov_len) == -1)
+        {
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+long _cg_output_write_pending()
+{
+    _cg_term_command_buffer_t *pending = _cg_output.pending;
+    if (pending == NULL || pending->length == 0)
+    {
+        return 0;
+    }
+
+#if CG_PLATFORM_POSIX
+    while (_cg_output.offset < pending->length)
+    {
+        _cg_iovec_t chunk = {pending->buffer + _cg_output.offset, pending->length - _cg_output.offset};
+        long n = _cg_backend.ops->write_iov(&chunk, 1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return (long)(pending->length - _cg_output.offset);
+            }
+            // the terminal is gone, drop the output
+            pending->length = 0;
+            _cg_output.offset = 0;
+            return -1;
+        }
+        _cg_output.offset += (size_t)n;
+    }
+#endif
+
+    pending->length = 0;
+    pending->buffer[0] = '\0';
+    _cg_output.offset = 0;
+
+    // the frame which was queued is out, and with it its input
+    if (_cg_output.input_writing != 0)
+    {
+        _cg_stats_record(CG_STAT_INPUT_LATENCY, _cg_now_nanos() - _cg_output.input_writing);
+        _cg_output.input_writing = 0;
+    }
+    return 0;
+}
+
+int _cg_output_drain(int timeout_ms)
+{
+    struct timespec start;
+    _cg_clock_get_time(&start);
+
+    for (;;)
+    {
+        _cg_mutex_lock(&_cg_out_lock);
+        long pending = _cg_output_write_pending();
+        _cg_mutex_unlock(&_cg_out_lock);
+        if (pending <= 0)
+        {
+            return (int)pending;
+        }
+
+        int wait = -1;
+        if (timeout_ms >= 0)
+        {
+            struct timespec now;
+            _cg_clock_get_time(&now);
+            cg_uint elapsed = _diff_time_micros(now, start) / 1000;
+            if (elapsed >= (cg_uint)timeout_ms)
+            {
+                return 1;
+            }
+            wait = timeout_ms - (int)elapsed;
+        }
+#if CG_PLATFORM_POSIX
+        struct pollfd pfd = {_cg_backend.out_fd, POLLOUT, 0};
+        if (poll(&pfd, 1, wait) == -1 && errno != EINTR)
+        {
+            return -1;
+        }
+#else
+        (void)wait;
+#endif
+    }
+}
+
+void _cg_output_abandon()
+{
+    if (!_cg_backend.ops->stream)
+    {
+        return;
+    }
+
+    _cg_mutex_lock(&_cg_out_lock);
+    if (_cg_output.pending != NULL)
+    {
+        _cg_output.pending->length = 0;
+        _cg_output.pending->buffer[0] = '\0';
+    }
+    _cg_output.offset = 0;
+    _cg_output.input_writing = 0;
+    _cg_mutex_unlock(&_cg_out_lock);
+    _cg_backend_hangup();
+}
+
+size_t cg_get_output_pending()
+{
+    _cg_mutex_lock(&_cg_out_lock);
+    size_t n = (_cg_output.pending != NULL) ? _cg_output.pending->length - _cg_output.offset : 0;
+    _cg_mutex_unlock(&_cg_out_lock);
+    return n;
+}
+
+cg_uint cg_get_frames_skipped()
+{
+    return _cg_output.frames_skipped;
+}
+
+int _cg_term_flush_command_buffer(_cg_term_command_buffer_t *buffer)
+{
+    _cg_mutex_lock(&_cg_out_lock);
+    int err = _cg_term_flush_command_buffer_unlocked(buffer);
+    _cg_mutex_unlock(&_cg_out_lock);
+    return err;
+}
+
+int _cg_term_flush_command_buffer_unlocked(_cg_term_command_buffer_t *buffer)
+{
+    if (buffer == NULL)
+    {
+        return 0;
+    }
+    if (buffer->length == 0)
+    {
+        return 0;
+    }
+
+    _cg_iovec_t iov = {buffer->buffer, buffer->length};
+    if (_cg_term_write_iov(&iov, 1) == -1)
+    {
+        return -1; // don't clear buffer on failure
+    }
+
+    buffer->length = 0;
+    buffer->buffer[0] = '\0';
+    return 0;
+}
+
+void _cg_term_reset()
+{
+    // the [0m code resets all terminal attributes
+    _cg_term_buffer_command(_cg_buffer, "\033[0m", 4);
+}
+
+void _cg_encode_colour(_cg_term_command_buffer_t *buffer, int code, cg_colour32_t colour)
+{
+    // build the whole sequence, then append it once
+    cg_char seq[24] = {'\033', '[', (cg_char)('0' + code / 10), (cg_char)('0' + code % 10), ';', '2', ';'};
+    size_t n = 7;
+    _cg_num_str_t *r = &_cg_num_lookup[(colour >> 16) & 0xFF];
+    _cg_num_str_t *g = &_cg_num_lookup[(colour >> 8) & 0xFF];
+    _cg_num_str_t *b = &_cg_num_lookup[colour & 0xFF];
+    memcpy(seq + n, r->str, r->len);
+    n += r->len;
+    seq[n++] = ';';
+    memcpy(seq + n, g->str, g->len);
+    n += g->len;
+    seq[n++] = ';';
+    memcpy(seq + n, b->str, b->len);
+    n += b->len;
+    seq[n++] = 'm';
+    _cg_term_buffer_append(buffer, seq, n);
+}
+
+void _cg_encode_move_to(_cg_term_command_buffer_t *buffer, cg_uint x, cg_uint y)
+{
+    cg_char seq[48];
+    int n = snprintf(seq, sizeof(seq), "\033[%lu;%luf", y + 1, x + 1);
+    _cg_term_buffer_append(buffer, seq, (size_t)n);
+}
+
+void _cg_term_set_foreground_colour(cg_colour32_t colour)
+{
+    _cg_encode_colour(_cg_buffer, 38, colour);
+}
+
+void _cg_term_set_background_colour(cg_colour32_t colour)
+{
+    _cg_encode_colour(_cg_buffer, 48, colour);
+}
+
+void _cg_term_move_to(cg_uint x, cg_uint y)
+{
+    _cg_encode_move_to(_cg_buffer, x, y);
+}
+
+void _cg_term_write_char(cg_char c)
+{
+    _cg_term_buffer_command(_cg_buffer, &c, 1);
+}
+
+void _cg_term_write_glyph(cg_glyph_t glyph)
+{
+    _cg_glyph_entry_t *entry = _cg_glyph_entry(glyph);
+    _cg_term_buffer_command(_cg_buffer, entry->bytes, entry->len);
+}
+
+void _cg_hide_cursor()
+{
+    _cg_term_buffer_command(_cg_buffer, "\033[?25l", 6);
+}
+
+void _cg_show_cursor()
+{
+    _cg_term_buffer_command(_cg_buffer, "\033[?25h", 6);
+}
+
+#if CG_PLATFORM_WINDOWS
+int _cg_win_get_cursor_position(int *rows, int *cols)
+{
+    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        return -1;
+    }
+
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(h, &csbi))
+    {
+        return -1;
+    }
+
+    // Windows is 0-based
+    *rows = csbi.dwCursorPosition.Y + 1;
+    *cols = csbi.dwCursorPosition.X + 1;
+
+    return 0;
+}
+#endif
+
+#if CG_PLATFORM_POSIX
+int _cg_posix_get_cursor_position(int *rows, int *cols)
+{
+    char buf[32];
+    unsigned int i = 0;
+    if (write(_cg_backend.out_fd, "\x1b[6n", 4) != 4)
+        return -1;
+    while (i < sizeof(buf) - 1)
+    {
+        if (read(_cg_backend.in_fd, &buf[i], 1) != 1)
+            break;
+        if (buf[i] == 'R')
+            break;
+        i++;
+    }
+    buf[i] = '\0';
+    if (buf[0] != '\x1b' || buf[1] != '[')
+        return -1;
+    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2)
+        return -1;
+    return 0;
+}
+#endif
+
+int _cg_get_cursor_position(int *rows, int *cols)
+{
+#if CG_PLATFORM_WINDOWS
+    return _cg_win_get_cursor_position(rows, cols);
+#elif CG_PLATFORM_POSIX
+    return _cg_posix_get_cursor_position(rows, cols);
+#endif
+}
+
+#if CG_PLATFORM_WINDOWS
+int _cg_win_get_window_size(int *rows, int *cols)
+{
+    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        return -1;
+    }
+
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(h, &csbi))
+    {
+        return -1;
+    }
+
+    SMALL_RECT win = csbi.srWindow;
+
+    *cols = win.Right - win.Left + 1;
+    *rows = win.Bottom - win.Top + 1;
+
+    return 0;
+}
+#endif
+
+#if CG_PLATFORM_POSIX
+int _cg_posix_get_window_size(int *rows, int *cols)
+{
+    struct winsize ws;
+    if (ioctl(_cg_backend.out_fd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    {
+        if (write(_cg_backend.out_fd, "\x1b[999C\x1b[999B", 12) != 12)
+            return -1;
+        return _cg_get_cursor_position(rows, cols);
+    }
+    else
+    {
+        *cols = ws.ws_col;
+        *rows = ws.ws_row;
+        return 0;
+    }
+}
+#endif
+
+int _cg_get_window_size(int *rows, int *cols)
+{
+    return _cg_backend.ops->get_size(rows, cols);
+}
+
+#if CG_PLATFORM_WINDOWS
+void _cg_win_read_key()
+{
+    DWORD events = 0;
+    GetNumberOfConsoleInputEvents(_cg_gfx_context->_cg_hin, &events);
+    _cg_input_parser.stamp = _cg_now_nanos();
+
+    while (events > 0)
+    {
+        INPUT_RECORD record;
+        DWORD read = 0;
+        ReadConsoleInput(_cg_gfx_context->_cg_hin, &record, 1, &read);
+        if (read == 0)
+        {
+            break;
+        }
+        events--;
+
+        if (record.EventType == MOUSE_EVENT)
+        {
+            _cg_win_mouse_event(&record.Event.MouseEvent);
+            continue;
+        }
+        if (record.EventType != KEY_EVENT)
+        {
+            continue;
+        }
+
+        // the console reports releases, the key state need not guess
+        _cg_keys.releases = true;
+
+        cg_keyboard_input_t input = {.key = CG_KEY_UNKNOWN, .char_value = record.Event.KeyEvent.uChar.AsciiChar};
+        input.modifiers = _cg_win_modifiers(record.Event.KeyEvent.dwControlKeyState);
+        input.action = record.Event.KeyEvent.bKeyDown ? CG_KEY_PRESS : CG_KEY_RELEASE;
+        WORD vk = record.Event.KeyEvent.wVirtualKeyCode;
+
+        switch (vk)
+        {
+        case VK_ESCAPE:
+            input.key = CG_KEY_ESCAPE;
+            break;
+        case VK_RETURN:
+            input.key = CG_KEY_ENTER;
+            break;
+        case VK_TAB:
+            input.key = CG_KEY_TAB;
+            break;
+        case VK_BACK:
+            input.key = CG_KEY_BACKSPACE;
+            break;
+        case VK_UP:
+            input.key = CG_KEY_UP;
+            break;
+        case VK_DOWN:
+            input.key = CG_KEY_DOWN;
+            break;
+        case VK_RIGHT:
+            input.key = CG_KEY_RIGHT;
+            break;
+        case VK_LEFT:
+            input.key = CG_KEY_LEFT;
+            break;
+        case VK_INSERT:
+            input.key = CG_KEY_INSERT;
+            break;
+        case VK_DELETE:
+            input.key = CG_KEY_DELETE;
+            break;
+        case VK_HOME:
+            input.key = CG_KEY_HOME;
+            break;
+        case VK_END:
+            input.key = CG_KEY_END;
+            break;
+        case VK_PRIOR:
+            input.key = CG_KEY_PAGE_UP;
+            break;
+        case VK_NEXT:
+            input.key = CG_KEY_PAGE_DOWN;
+            break;
+        default:
+            if (vk >= VK_F1 && vk <= VK_F12)
+            {
+                input.key = (cg_key_type_t)(CG_KEY_F1 + (vk - VK_F1));
+            }
+            else if (input.char_value >= 1 && input.char_value <= 26)
+            {
+                // report control characters as the letter, like the terminal
+                input.key = CG_KEY_ALPHANUM;
+                input.char_value = (cg_char)('a' + input.char_value - 1);
+            }
+            else if (input.char_value >= 32 && input.char_value <= 126)
+            {
+                input.key = CG_KEY_ALPHANUM;
+            }
+            break;
+        }
+
+        _cg_input_queue(input);
+    }
+    _cg_input_flush_motion();
+}
+
+int _cg_win_modifiers(DWORD state)
+{
+    int modifiers = CG_MOD_NONE;
+    modifiers |= (state & SHIFT_PRESSED) ? CG_MOD_SHIFT : 0;
+    modifiers |= (state & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) ? CG_MOD_ALT : 0;
+    modifiers |= (state & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) ? CG_MOD_CTRL : 0;
+    return modifiers;
+}
+
+void _cg_win_mouse_event(MOUSE_EVENT_RECORD *event)
+{
+    cg_keyboard_input_t input = {.key = CG_KEY_MOUSE, .char_value = '\0'};
+    input.modifiers = _cg_win_modifiers(event->dwControlKeyState);
+    input.x = (cg_uint)event->dwMousePosition.X;
+    input.y = (cg_uint)event->dwMousePosition.Y;
+
+    // the three buttons, in the order of cg_mouse_button_t
+    const DWORD masks[3] = {FROM_LEFT_1ST_BUTTON_PRESSED, FROM_LEFT_2ND_BUTTON_PRESSED, RIGHTMOST_BUTTON_PRESSED};
+    DWORD buttons = event->dwButtonState & (masks[0] | masks[1] | masks[2]);
+
+    if (event->dwEventFlags & MOUSE_WHEELED)
+    {
+        input.mouse = ((SHORT)HIWORD(event->dwButtonState) > 0) ? CG_MOUSE_WHEEL_UP : CG_MOUSE_WHEEL_DOWN;
+        _cg_input_queue(input);
+        return;
+    }
+    if (event->dwEventFlags & MOUSE_MOVED)
+    {
+        if (buttons == 0 && _cg_mouse.mode != CG_MOUSE_ALL_MOTION)
+        {
+            return;
+        }
+        input.mouse = (buttons == 0) ? CG_MOUSE_MOVE : CG_MOUSE_DRAG;
+        for (int i = 0; i < 3; i++)
+        {
+            if (buttons & masks[i])
+            {
+                input.button = (cg_mouse_button_t)i;
+                break;
+            }
+        }
+        _cg_input_queue(input);
+        return;
+    }
+
+    // a press or release, one event for every button which changed
+    DWORD changed = buttons ^ _cg_mouse.buttons;
+    _cg_mouse.buttons = buttons;
+    for (int i = 0; i < 3; i++)
+    {
+        if (changed & masks[i])
+        {
+            input.button = (cg_mouse_button_t)i;
+            input.mouse = (buttons & masks[i]) ? CG_MOUSE_PRESS : CG_MOUSE_RELEASE;
+            _cg_input_queue(input);
+        }
+    }
+}
+#endif
+
+#if CG_PLATFORM_POSIX
+void _cg_posix_read_key()
+{
+    _cg_input_parser_t *p = &_cg_input_parser;
+
+    if (atomic_load(&_cg_backend.hung_up))
+    {
+        return;
+    }
+
+    // one read takes everything typed since the last frame, unless
+    // there is more than fits. The end of a stream, or EIO from a
+    // terminal which was closed, is a hangup; a terminal in raw mode
+    // reads 0 when nothing was typed
+    for (;;)
+    {
+        size_t space = sizeof(p->bytes) - p->length;
+        ssize_t n = read(_cg_backend.in_fd, p->bytes + p->length, space);
+        if ((n == 0 && _cg_backend.ops->stream) || (n == -1 && errno == EIO))
+        {
+            _cg_backend_hangup();
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        p->stamp = _cg_now_nanos();
+        if (p->length == 0)
+        {
+            p->since = p->stamp;
+        }
+        p->length += (size_t)n;
+
+        // a sequence which fills the buffer is never going to end
+        size_t used = _cg_input_decode(p->bytes, p->length, p->length == sizeof(p->bytes));
+        memmove(p->bytes, p->bytes + used, p->length - used);
+        p->length -= used;
+        if (p->length > 0 && used > 0)
+        {
+            p->since = _cg_now_nanos();
+        }
+
+        if ((size_t)n < space)
+        {
+            break;
+        }
+    }
+
+    // the rest of the sequence did not come, the escape was a key press
+    if (p->length > 0 && _cg_input_timeout_ms() == 0)
+    {
+        p->stamp = p->since;
+        _cg_input_decode(p->bytes, p->length, true);
+        p->length = 0;
+    }
+}
+#endif
+
+void _cg_read_key()
+{
+    _cg_input_free_pastes(_cg_gfx_context->keys_pressed, _cg_gfx_context->key_count);
+    _cg_gfx_context->key_count = 0;
+    _cg_gfx_context->key_counter = 0;
+    _cg_keys_begin_frame();
+
+    // take everything the input thread queued since the last frame, it
+    // may have stopped since if the terminal went away
+    cg_keyboard_input_t input;
+    while (_cg_input_ring_pop(&input))
+    {
+        _cg_input_push(input);
+    }
+
+    // otherwise the input thread reads the terminal
+    if (!atomic_load(&_cg_input.running))
+    {
+        _cg_backend.ops->read_input();
+    }
+
+    // how long the oldest input waited for the frame
+    if (_cg_stats.frame_input != 0)
+    {
+        _cg_stats_record(CG_STAT_INPUT_WAIT, _cg_now_nanos() - _cg_stats.frame_input);
+    }
+}
+
+size_t _cg_input_sequence_length(const unsigned char *bytes, size_t n)
+{
+    if (n < 2)
+    {
+        return 0;
+    }
+
+    if (bytes[1] == '[')
+    {
+        // CSI, parameter and intermediate bytes then a final byte
+        for (size_t i = 2; i < n; i++)
+        {
+            if (bytes[i] >= 0x40 && bytes[i] <= 0x7E)
+            {
+                return i + 1;
+            }
+            if (bytes[i] < 0x20 || bytes[i] > 0x3F)
+            {
+                // not a sequence after all
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (bytes[1] == 'O')
+    {
+        // SS3, one final byte
+        return (n < 3) ? 0 : 3;
+    }
+    if (bytes[1] == _CG_TERM_KEY_ESCAPE)
+    {
+        return 1;
+    }
+    // a key typed with alt held
+    return 2;
+}
+
+void _cg_input_emit_sequence(const unsigned char *seq, size_t len)
+{
+    unsigned char final = seq[len - 1];
+    cg_keyboard_input_t input = {.key = CG_KEY_UNKNOWN, .char_value = (cg_char)final};
+
+    if (seq[1] != '[' && seq[1] != 'O')
+    {
+        _cg_input_queue(_cg_input_byte(seq[1], CG_MOD_ALT));
+        return;
+    }
+    if (seq[1] == 'O')
+    {
+        // SS3, application cursor keys and F1-F4
+        input.key = _cg_input_final_key(final);
+        _cg_input_queue(input);
+        return;
+    }
+
+    cg_uint params[_CG_CSI_MAX_PARAMS];
+    cg_uint subs[_CG_CSI_MAX_PARAMS];
+    _cg_input_csi_params(seq, len, params, subs);
+
+    if (seq[2] == '<' && (final == 'M' || final == 'm'))
+    {
+        // SGR mouse, the button code then the 1 based cell
+        cg_uint code = params[0];
+        input.key = CG_KEY_MOUSE;
+        input.char_value = '\0';
+        input.modifiers = ((code & 4) ? CG_MOD_SHIFT : 0) | ((code & 8) ? CG_MOD_ALT : 0) | ((code & 16) ? CG_MOD_CTRL : 0);
+        input.button = (cg_mouse_button_t)(code & 3);
+        input.x = (params[1] > 0) ? params[1] - 1 : 0;
+        input.y = (params[2] > 0) ? params[2] - 1 : 0;
+        if (code & 64)
+        {
+            input.mouse = (code & 1) ? CG_MOUSE_WHEEL_DOWN : CG_MOUSE_WHEEL_UP;
+            input.button = CG_MOUSE_LEFT;
+        }
+        else if (code & 32)
+        {
+            input.mouse = ((code & 3) == 3) ? CG_MOUSE_MOVE : CG_MOUSE_DRAG;
+        }
+        else
+        {
+            input.mouse = (final == 'M') ? CG_MOUSE_PRESS : CG_MOUSE_RELEASE;
+        }
+        if (input.button > CG_MOUSE_RIGHT)
+        {
+            input.button = CG_MOUSE_LEFT;
+        }
+        _cg_input_queue(input);
+        return;
+    }
+    if (seq[2] == '?' && final == 'u')
+    {
+        // the terminal answered the kitty keyboard protocol query
+        atomic_store(&_cg_keys.kitty_detected, true);
+        return;
+    }
+    if (seq[2] == '<' || seq[2] == '?' || seq[2] == '>' || seq[2] == '=')
+    {
+        // a private sequence, a reply to a query
+        _cg_input_queue(input);
+        return;
+    }
+
+    // the kitty protocol adds the event type to the modifiers
+    input.action = _cg_input_action(subs[1]);
+    if (final == 'u')
+    {
+        _cg_input_kitty_key(params[0], subs[0], _cg_input_modifiers(params[1]), input.action);
+        return;
+    }
+    if (final == '~' && params[0] == 200)
+    {
+        // the start of a bracketed paste, the text follows as is
+        _cg_input_parser_t *p = &_cg_input_parser;
+        p->in_paste = true;
+        p->paste_length = 0;
+        if (p->paste == NULL)
+        {
+            p->paste = (cg_char *)_CG_CALLOC(_CG_PASTE_START_SIZE, 1);
+            p->paste_capacity = (p->paste == NULL) ? 0 : _CG_PASTE_START_SIZE;
+        }
+        return;
+    }
+    if (final == '~')
+    {
+        input.key = _cg_input_tilde_key(params[0]);
+        input.modifiers = _cg_input_modifiers(params[1]);
+    }
+    else if (final == 'Z')
+    {
+        input.key = CG_KEY_TAB;
+        input.char_value = '\t';
+        input.modifiers = CG_MOD_SHIFT;
+    }
+    else
+    {
+        input.key = _cg_input_final_key(final);
+        input.modifiers = _cg_input_modifiers(params[1]);
+    }
+    _cg_input_queue(input);
+}
+
+cg_keyboard_input_t _cg_input_byte(unsigned char c, int modifiers)
+{
+    cg_keyboard_input_t input = {.key = CG_KEY_UNKNOWN, .char_value = (cg_char)c};
+    input.modifiers = modifiers;
+
+    if (c == '\r' || c == '\n')
+    {
+        input.key = CG_KEY_ENTER;
+    }
+    else if (c == '\t')
+    {
+        input.key = CG_KEY_TAB;
+    }
+    else if (c == 127 || c == '\b')
+    {
+        input.key = CG_KEY_BACKSPACE;
+    }
+    else if (c == 0)
+    {
+        // ctrl and space
+        input.key = CG_KEY_ALPHANUM;
+        input.char_value = ' ';
+        input.modifiers |= CG_MOD_CTRL;
+    }
+    else if (c <= 26)
+    {
+        input.key = CG_KEY_ALPHANUM;
+        input.char_value = (cg_char)('a' + c - 1);
+        input.modifiers |= CG_MOD_CTRL;
+    }
+    else if (c >= 32 && c <= 126)
+    {
+        input.key = CG_KEY_ALPHANUM;
+    }
+    return input;
+}
+
+void _cg_input_csi_params(const unsigned char *seq, size_t len, cg_uint *params, cg_uint *subs)
+{
+    cg_uint count = 0;
+    cg_uint sub = 0; // 0 for the parameter itself, then the sub parameters
+    for (cg_uint i = 0; i < _CG_CSI_MAX_PARAMS; i++)
+    {
+        params[i] = 0;
+        subs[i] = 0;
+    }
+
+    for (size_t i = 2; i < len - 1; i++)
+    {
+        unsigned char c = seq[i];
+        if (c >= '0' && c <= '9')
+        {
+            if (count < _CG_CSI_MAX_PARAMS && sub == 0)
+            {
+                params[count] = params[count] * 10 + (c - '0');
+            }
+            else if (count < _CG_CSI_MAX_PARAMS && sub == 1)
+            {
+                subs[count] = subs[count] * 10 + (c - '0');
+            }
+        }
+        else if (c == ';')
+        {
+            count++;
+            sub = 0;
+        }
+        else if (c == ':')
+        {
+            sub++;
+        }
+    }
+}
+
+void _cg_input_kitty_key(cg_uint code, cg_uint shifted, int modifiers, cg_key_action_t action)
+{
+    // the private use area holds the modifier, keypad and media keys
+    if (code >= 0xE000 && code <= 0xF8FF)
+    {
+        return;
+    }
+    if (shifted != 0 && (modifiers & CG_MOD_SHIFT))
+    {
+        code = shifted;
+    }
+
+    cg_keyboard_input_t input = {.key = CG_KEY_UNKNOWN, .char_value = '\0'};
+    if (code == _CG_TERM_KEY_ESCAPE)
+    {
+        input.key = CG_KEY_ESCAPE;
+        input.char_value = (cg_char)code;
+    }
+    else if (code < 128)
+    {
+        // control keys are reported as the letter with ctrl already
+        input = _cg_input_byte((unsigned char)code, CG_MOD_NONE);
+    }
+    else if (action != CG_KEY_RELEASE)
+    {
+        // other text as its utf-8 bytes, as the terminal sends it
+        // without the protocol
+        cg_char bytes[4];
+        cg_uint n = 0;
+        if (code < 0x800)
+        {
+            bytes[n++] = (cg_char)(0xC0 | (code >> 6));
+        }
+        else if (code < 0x10000)
+        {
+            bytes[n++] = (cg_char)(0xE0 | (code >> 12));
+            bytes[n++] = (cg_char)(0x80 | ((code >> 6) & 0x3F));
+        }
+        else
+        {
+            bytes[n++] = (cg_char)(0xF0 | ((code >> 18) & 0x07));
+            bytes[n++] = (cg_char)(0x80 | ((code >> 12) & 0x3F));
+            bytes[n++] = (cg_char)(0x80 | ((code >> 6) & 0x3F));
+        }
+        bytes[n++] = (cg_char)(0x80 | (code & 0x3F));
+        for (cg_uint i = 0; i < n; i++)
+        {
+            input.char_value = bytes[i];
+            input.modifiers = modifiers;
+            input.action = action;
+            _cg_input_queue(input);
+        }
+        return;
+    }
+    input.modifiers = modifiers;
+    input.action = action;
+    _cg_input_queue(input);
+}
+
+cg_key_action_t _cg_input_action(cg_uint event)
+{
+    switch (event)
+    {
+    case 2:
+        return CG_KEY_REPEAT;
+    case 3:
+        return CG_KEY_RELEASE;
+    }
+    return CG_KEY_PRESS;
+}
+
+cg_key_type_t _cg_input_final_key(unsigned char final)
+{
+    switch (final)
+    {
+    case 'A':
+        return CG_KEY_UP;
+    case 'B':
+        return CG_KEY_DOWN;
+    case 'C':
+        return CG_KEY_RIGHT;
+    case 'D':
+        return CG_KEY_LEFT;
+    case 'H':
+        return CG_KEY_HOME;
+    case 'F':
+        return CG_KEY_END;
+    case 'P':
+        return CG_KEY_F1;
+    case 'Q':
+        return CG_KEY_F2;
+    case 'R':
+        return CG_KEY_F3;
+    case 'S':
+        return CG_KEY_F4;
+    }
+    return CG_KEY_UNKNOWN;
+}
+
+cg_key_type_t _cg_input_tilde_key(cg_uint number)
+{
+    switch (number)
+    {
+    case 1:
+    case 7:
+        return CG_KEY_HOME;
+    case 2:
+        return CG_KEY_INSERT;
+    case 3:
+        return CG_KEY_DELETE;
+    case 4:
+    case 8:
+        return CG_KEY_END;
+    case 5:
+        return CG_KEY_PAGE_UP;
+    case 6:
+        return CG_KEY_PAGE_DOWN;
+    case 11:
+        return CG_KEY_F1;
+    case 12:
+        return CG_KEY_F2;
+    case 13:
+        return CG_KEY_F3;
+    case 14:
+        return CG_KEY_F4;
+    case 15:
+        return CG_KEY_F5;
+    case 17:
+        return CG_KEY_F6;
+    case 18:
+        return CG_KEY_F7;
+    case 19:
+        return CG_KEY_F8;
+    case 20:
+        return CG_KEY_F9;
+    case 21:
+        return CG_KEY_F10;
+    case 23:
+        return CG_KEY_F11;
+    case 24:
+        return CG_KEY_F12;
+    }
+    return CG_KEY_UNKNOWN;
+}
+
+int _cg_input_modifiers(cg_uint param)
+{
+    if (param < 2)
+    {
+        return CG_MOD_NONE;
+    }
+    // the bits line up with cg_key_mod_t, meta and above are dropped
+    return (int)((param - 1) & (CG_MOD_SHIFT | CG_MOD_ALT | CG_MOD_CTRL));
+}
+
+void _cg_input_queue(cg_keyboard_input_t input)
+{
+    _cg_input_parser_t *p = &_cg_input_parser;
+    bool motion = input.key == CG_KEY_MOUSE && (input.mouse == CG_MOUSE_DRAG || input.mouse == CG_MOUSE_MOVE);
+
+    if (p->has_motion)
+    {
+        if (motion && input.mouse == p->motion.mouse && input.button == p->motion.button && input.modifiers == p->motion.modifiers)
+        {
+            p->motion = input;
+            return;
+        }
+        _cg_input_flush_motion();
+    }
+
+    if (motion)
+    {
+        p->motion = input;
+        p->has_motion = true;
+        return;
+    }
+    _cg_input_emit(input);
+}
+
+void _cg_input_flush_motion()
+{
+    if (_cg_input_parser.has_motion)
+    {
+        _cg_input_parser.has_motion = false;
+        _cg_input_emit(_cg_input_parser.motion);
+    }
+}
+
+void cg_set_mouse(cg_mouse_mode_t mode)
+{
+    _cg_mouse.mode = mode;
+
+    // before the graphics are created, the mode is set by cg_create_graphics
+    if (_cg_events.open)
+    {
+        _cg_mouse_apply(mode);
+    }
+}
+
+void _cg_mouse_apply(cg_mouse_mode_t mode)
+{
+#if CG_PLATFORM_WINDOWS
+    if (_cg_backend.ops != &_cg_backend_tty)
+    {
+        return;
+    }
+    DWORD console_mode = 0;
+    if (!GetConsoleMode(_cg_gfx_context->_cg_hin, &console_mode))
+    {
+        return;
+    }
+    if (mode == CG_MOUSE_OFF)
+    {
+        console_mode &= ~ENABLE_MOUSE_INPUT;
+    }
+    else
+    {
+        // quick edit takes the mouse for selecting text
+        console_mode |= ENABLE_MOUSE_INPUT | ENABLE_EXTENDED_FLAGS;
+        console_mode &= ~ENABLE_QUICK_EDIT_MODE;
+    }
+    SetConsoleMode(_cg_gfx_context->_cg_hin, console_mode);
+#elif CG_PLATFORM_POSIX
+    // turn every mode off first, so a lower mode does not keep motion on
+    _cg_term_buffer_command(_cg_buffer, "\033[?1006l\033[?1003l\033[?1002l\033[?1000l", 0);
+    if (mode == CG_MOUSE_BUTTONS)
+    {
+        _cg_term_buffer_command(_cg_buffer, "\033[?1000h\033[?1002h\033[?1006h", 0);
+    }
+    else if (mode == CG_MOUSE_ALL_MOTION)
+    {
+        _cg_term_buffer_command(_cg_buffer, "\033[?1000h\033[?1003h\033[?1006h", 0);
+    }
+#endif
+}
+
+size_t _cg_input_decode(const unsigned char *bytes, size_t n, bool flush)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        if (_cg_input_parser.in_paste)
+        {
+            i += _cg_input_paste(bytes + i, n - i);
+            if (_cg_input_parser.in_paste)
+            {
+                // the end of the paste has not come yet
+                break;
+            }
+            continue;
+        }
+
+        unsigned char c = bytes[i];
+        if (c != _CG_TERM_KEY_ESCAPE)
+        {
+            _cg_input_queue(_cg_input_byte(c, CG_MOD_NONE));
+            i++;
+            continue;
+        }
+
+        size_t len = _cg_input_sequence_length(bytes + i, n - i);
+        if (len == 0 && !flush)
+        {
+            // wait for the rest of the sequence
+            break;
+        }
+        if (len <= 1)
+        {
+            cg_keyboard_input_t input = {.key = CG_KEY_ESCAPE, .char_value = (cg_char)c};
+            _cg_input_queue(input);
+            i++;
+            continue;
+        }
+        _cg_input_emit_sequence(bytes + i, len);
+        i += len;
+    }
+    _cg_input_flush_motion();
+    return i;
+}
+
+size_t _cg_input_paste(const unsigned char *bytes, size_t n)
+{
+    static const char end[] = "\033[201~";
+    const size_t end_length = sizeof(end) - 1;
+
+    // only the escapes need a look, the rest is copied in bulk
+    size_t i = 0;
+    for (;;)
+    {
+        const unsigned char *esc = (const unsigned char *)memchr(bytes + i, _CG_TERM_KEY_ESCAPE, n - i);
+        if (esc == NULL)
+        {
+            _cg_input_paste_append(bytes, n);
+            return n;
+        }
+
+        size_t at = (size_t)(esc - bytes);
+        size_t left = n - at;
+        if (left < end_length && memcmp(esc, end, left) == 0)
+        {
+            // possibly the end, split over reads
+            _cg_input_paste_append(bytes, at);
+            return at;
+        }
+        if (left >= end_length && memcmp(esc, end, end_length) == 0)
+        {
+            _cg_input_parser_t *p = &_cg_input_parser;
+            _cg_input_paste_append(bytes, at);
+            p->in_paste = false;
+            if (p->paste != NULL)
+            {
+                // the input owns the text now, freed after its frame
+                cg_keyboard_input_t input = {.key = CG_KEY_PASTE, .char_value = '\0'};
+                p->paste[p->paste_length] = '\0';
+                input.text = p->paste;
+                input.text_length = p->paste_length;
+                p->paste = NULL;
+                p->paste_length = 0;
+                p->paste_capacity = 0;
+                _cg_input_queue(input);
+            }
+            return at + end_length;
+        }
+        i = at + 1;
+    }
+}
+
+void _cg_input_paste_append(const unsigned char *bytes, size_t n)
+{
+    _cg_input_parser_t *p = &_cg_input_parser;
+    if (p->paste == NULL || n == 0)
+    {
+        return;
+    }
+
+    // keep room for the terminating zero
+    if (p->paste_length + n + 1 > p->paste_capacity)
+    {
+        size_t capacity = p->paste_capacity * 2;
+        while (capacity < p->paste_length + n + 1)
+        {
+            capacity *= 2;
+        }
+        cg_char *paste = (cg_char *)_CG_REALLOC(p->paste, capacity);
+        if (paste == NULL)
+        {
+            // out of memory, the rest of the paste is dropped
+            return;
+        }
+        p->paste = paste;
+        p->paste_capacity = capacity;
+    }
+    memcpy(p->paste + p->paste_length, bytes, n);
+    p->paste_length += n;
+}
+
+void _cg_input_free_pastes(cg_keyboard_input_t *inputs, cg_uint count)
+{
+    for (cg_uint i = 0; i < count; i++)
+    {
+        if (inputs[i].key == CG_KEY_PASTE && inputs[i].text != NULL)
+        {
+            _CG_FREE(inputs[i].text);
+            inputs[i].text = NULL;
+        }
+    }
+}
+
+void _cg_backend_reset()
+{
+    _cg_backend.ops = &_cg_backend_tty;
+    _cg_backend.socket = false;
+    _cg_backend.in_fd = 0;
+    _cg_backend.out_fd = 1;
+    if (_cg_backend.sink != NULL)
+    {
+        _cg_term_dispose_command_buffer(_cg_backend.sink);
+        _cg_backend.sink = NULL;
+    }
+    if (_cg_backend.script != NULL)
+    {
+        _cg_term_dispose_command_buffer(_cg_backend.script);
+        _cg_backend.script = NULL;
+    }
+}
+
+int cg_set_headless(cg_uint width, cg_uint height, int fd)
+{
+    if (width == 0 || height == 0)
+    {
+        _cg_backend_reset();
+        return 0;
+    }
+
+#if CG_PLATFORM_WINDOWS
+    if (fd >= 0)
+    {
+        return -1;
+    }
+#endif
+    if (_cg_backend.sink == NULL && _cg_term_create_command_buffer(&_cg_backend.sink) == -1)
+    {
+        return -1;
+    }
+    if (_cg_backend.script == NULL && _cg_term_create_command_buffer(&_cg_backend.script) == -1)
+    {
+        return -1;
+    }
+    _cg_backend.ops = &_cg_backend_headless;
+    _cg_backend.width = width;
+    _cg_backend.height = height;
+    _cg_backend.in_fd = -1;
+    _cg_backend.out_fd = (fd < 0) ? -1 : fd;
+#if CG_PLATFORM_POSIX
+    struct stat st;
+    _cg_backend.socket = (fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode));
+#endif
+    return 0;
+}
+
+const cg_char *cg_get_headless_output(size_t *length)
+{
+    if (_cg_backend.sink == NULL)
+    {
+        if (length != NULL)
+        {
+            *length = 0;
+        }
+        return "";
+    }
+    if (length != NULL)
+    {
+        *length = _cg_backend.sink->length;
+    }
+    return _cg_backend.sink->buffer;
+}
+
+void cg_clear_headless_output()
+{
+    if (_cg_backend.sink != NULL)
+    {
+        _cg_backend.sink->length = 0;
+        _cg_backend.sink->buffer[0] = '\0';
+    }
+}
+
+int cg_headless_input(const cg_char *bytes, size_t length)
+{
+    if (_cg_backend.script == NULL)
+    {
+        return -1;
+    }
+    if (_cg_term_buffer_append(_cg_backend.script, bytes, length) == -1)
+    {
+        return -1;
+    }
+    cg_request_redraw();
+    return 0;
+}
+
+void _cg_headless_read_key()
+{
+    _cg_term_command_buffer_t *script = _cg_backend.script;
+    if (script == NULL || script->length == 0)
+    {
+        return;
+    }
+
+    // sequences are given whole, nothing waits for the rest, but the
+    // end of a paste may still come later
+    _cg_input_parser.stamp = _cg_now_nanos();
+    size_t used = _cg_input_decode((const unsigned char *)script->buffer, script->length, true);
+    memmove(script->buffer, script->buffer + used, script->length - used);
+    script->length -= used;
+}
+
+int cg_set_terminal(int fd)
+{
+    if (fd < 0)
+    {
+        _cg_backend_reset();
+        return 0;
+    }
+
+#if CG_PLATFORM_WINDOWS
+    return -1;
+#elif CG_PLATFORM_POSIX
+    if (!isatty(fd))
+    {
+        return -1;
+    }
+    _cg_backend_reset();
+    _cg_backend.in_fd = fd;
+    _cg_backend.out_fd = fd;
+    return 0;
+#endif
+}
+
+int cg_set_stream(int in_fd, int out_fd, cg_uint width, cg_uint height)
+{
+#if CG_PLATFORM_WINDOWS
+    (void)in_fd;
+    (void)out_fd;
+    (void)width;
+    (void)height;
+    return -1;
+#elif CG_PLATFORM_POSIX
+    if (out_fd < 0 || width == 0 || height == 0)
+    {
+        return -1;
+    }
+
+    // the fds are made non-blocking by cg_create_graphics
+    if (fcntl(out_fd, F_GETFL, 0) == -1 || (in_fd >= 0 && fcntl(in_fd, F_GETFL, 0) == -1))
+    {
+        return -1;
+    }
+
+    _cg_backend_reset();
+    struct stat st;
+    bool socket = (fstat(out_fd, &st) == 0 && S_ISSOCK(st.st_mode));
+    _cg_backend.ops = socket ? &_cg_backend_socket : &_cg_backend_stream;
+    _cg_backend.width = width;
+    _cg_backend.height = height;
+    _cg_backend.in_fd = in_fd;
+    _cg_backend.out_fd = out_fd;
+#ifdef SO_NOSIGPIPE
+    if (socket)
+    {
+        int on = 1;
+        setsockopt(out_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    return 0;
+#endif
+}
+
+void _cg_backend_hangup()
+{
+    atomic_store(&_cg_backend.hung_up, true);
+    if (_cg_gfx_context != NULL)
+    {
+        cg_exit_graphics();
+    }
+}
+
+int _cg_backend_given_size(int *rows, int *cols)
+{
+    *rows = (int)_cg_backend.height;
+    *cols = (int)_cg_backend.width;
+    return 0;
+}
+
+long _cg_headless_write(const _cg_iovec_t *iov, int count)
+{
+#if CG_PLATFORM_POSIX
+    if (_cg_backend.out_fd >= 0)
+    {
+        return _cg_backend.socket ? _cg_socket_write(iov, count) : _cg_fd_write(iov, count);
+    }
+#endif
+
+    // the memory buffer takes everything at once
+    long written = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (_cg_term_buffer_append(_cg_backend.sink, (const cg_char *)iov[i].iov_base, iov[i].iov_len) == -1)
+        {
+            return -1;
+        }
+        written += (long)iov[i].iov_len;
+    }
+    return written;
+}
+
+int _cg_headless_begin()
+{
+    return 0;
+}
+
+void _cg_headless_end()
+{
+}
+
+int _cg_tty_begin()
+{
+    _cg_term_enable_raw_mode();
+    return 0;
+}
+
+#if CG_PLATFORM_WINDOWS
+long _cg_win_writev(const _cg_iovec_t *iov, int count)
+{
+    long written = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (iov[i].iov_len > 0 && _cg_win_write((const cg_char *)iov[i].iov_base, iov[i].iov_len) == -1)
+        {
+            return -1;
+        }
+        written += (long)iov[i].iov_len;
+    }
+    return written;
+}
+#elif CG_PLATFORM_POSIX
+long _cg_fd_write(const _cg_iovec_t *iov, int count)
+{
+    ssize_t n = writev(_cg_backend.out_fd, iov, count);
+    if (n < 0 && (errno == EPIPE || errno == EIO))
+    {
+        _cg_backend_hangup();
+    }
+    return (long)n;
+}
+
+long _cg_socket_write(const _cg_iovec_t *iov, int count)
+{
+    // the same chunks writev would take, without a copy
+    struct msghdr msg = {0};
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(_cg_backend.out_fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EPIPE || errno == ECONNRESET))
+    {
+        _cg_backend_hangup();
+    }
+    return (long)n;
+}
+
+int _cg_stream_begin()
+{
+    int in = _cg_backend.in_fd;
+    int out = _cg_backend.out_fd;
+
+    // a full socket queues output instead of stalling the frame, and
+    // input is read without waiting, as for a terminal
+    _cg_backend.orig_out_flags = fcntl(out, F_GETFL, 0);
+    if (_cg_backend.orig_out_flags == -1 || fcntl(out, F_SETFL, _cg_backend.orig_out_flags | O_NONBLOCK) == -1)
+    {
+        return -1;
+    }
+    _cg_backend.orig_in_flags = -1;
+    if (in >= 0 && in != out)
+    {
+        _cg_backend.orig_in_flags = fcntl(in, F_GETFL, 0);
+        if (_cg_backend.orig_in_flags == -1 || fcntl(in, F_SETFL, _cg_backend.orig_in_flags | O_NONBLOCK) == -1)
+        {
+            fcntl(out, F_SETFL, _cg_backend.orig_out_flags);
+            return -1;
+        }
+    }
+    _cg_backend.begun = true;
+    return 0;
+}
+
+void _cg_stream_end()
+{
+    // restored already, or never changed
+    if (!_cg_backend.begun)
+    {
+        return;
+    }
+    _cg_backend.begun = false;
+
+    fcntl(_cg_backend.out_fd, F_SETFL, _cg_backend.orig_out_flags);
+    if (_cg_backend.orig_in_flags != -1)
+    {
+        fcntl(_cg_backend.in_fd, F_SETFL, _cg_backend.orig_in_flags);
+    }
+}
+#endif
+
+const _cg_backend_ops_t _cg_backend_tty = {
+#if CG_PLATFORM_WINDOWS
+    .write_iov = _cg_win_writev,
+    .read_input = _cg_win_read_key,
+    .get_size = _cg_win_get_window_size,
+#elif CG_PLATFORM_POSIX
+    .write_iov = _cg_fd_write,
+    .read_input = _cg_posix_read_key,
+    .get_size = _cg_posix_get_window_size,
+#endif
+    .begin = _cg_tty_begin,
+    .end = _cg_term_disable_raw_mode,
+    .stream = false};
+
+const _cg_backend_ops_t _cg_backend_headless = {
+    .write_iov = _cg_headless_write,
+    .read_input = _cg_headless_read_key,
+    .get_size = _cg_backend_given_size,
+    .begin = _cg_headless_begin,
+    .end = _cg_headless_end,
+    .stream = false};
+
+#if CG_PLATFORM_POSIX
+const _cg_backend_ops_t _cg_backend_stream = {
+    .write_iov = _cg_fd_write,
+    .read_input = _cg_posix_read_key,
+    .get_size = _cg_backend_given_size,
+    .begin = _cg_stream_begin,
+    .end = _cg_stream_end,
+    .stream = true};
+
+const _cg_backend_ops_t _cg_backend_socket = {
+    .write_iov = _cg_socket_write,
+    .read_input = _cg_posix_read_key,
+    .get_size = _cg_backend_given_size,
+    .begin = _cg_stream_begin,
+    .end = _cg_stream_end,
+    .stream = true};
+#endif
+
+int cg_record_start(const cg_char *path)
+{
+    cg_record_stop();
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    _cg_mutex_lock(&_cg_out_lock);
+    if (_cg_recorder.line == NULL && _cg_term_create_command_buffer(&_cg_recorder.line) == -1)
+    {
+        _cg_mutex_unlock(&_cg_out_lock);
+        fclose(file);
+        return -1;
+    }
+    _cg_recorder.file = file;
+    _cg_recorder.start = _cg_now_nanos();
+    _cg_recorder.header = false;
+    _cg_mutex_unlock(&_cg_out_lock);
+    return 0;
+}
+
+void cg_record_stop()
+{
+    _cg_mutex_lock(&_cg_out_lock);
+    if (_cg_recorder.file != NULL)
+    {
+        fclose(_cg_recorder.file);
+        _cg_recorder.file = NULL;
+    }
+    if (_cg_recorder.line != NULL)
+    {
+        _cg_term_dispose_command_buffer(_cg_recorder.line);
+        _cg_recorder.line = NULL;
+    }
+    _cg_mutex_unlock(&_cg_out_lock);
+}
+
+void _cg_record_iov(_cg_iovec_t *iov, int count)
+{
+    if (_cg_recorder.file == NULL)
+    {
+        return;
+    }
+
+    _cg_term_command_buffer_t *line = _cg_recorder.line;
+    cg_char text[64];
+    if (!_cg_recorder.header)
+    {
+        // the size is only known once the first frame is drawn
+        cg_uint w = (canvas_current != NULL) ? canvas_current->width : 80;
+        cg_uint h = (canvas_current != NULL) ? canvas_current->height : 24;
+        // "congfx" marks \u0080 to \u00ff as the single bytes they escape
+        fprintf(_cg_recorder.file, "{\"version\": 2, \"width\": %lu, \"height\": %lu, \"timestamp\": %lld, \"congfx\": 1}\n",
+                (unsigned long)w, (unsigned long)h, (long long)time(NULL));
+        _cg_recorder.header = true;
+    }
+
+    // the output as a json string, runs of plain bytes and well formed
+    // utf-8 are copied as is, other bytes are escaped as \u00XX
+    double seconds = (_cg_now_nanos() - _cg_recorder.start) / 1e9;
+    line->length = 0;
+    int n = snprintf(text, sizeof(text), "[%.6f, \"o\", \"", seconds);
+    _cg_term_buffer_append(line, text, n);
+    for (int i = 0; i < count; i++)
+    {
+        const unsigned char *bytes = (const unsigned char *)iov[i].iov_base;
+        size_t length = iov[i].iov_len;
+        size_t run = 0;
+        for (size_t j = 0; j < length; j++)
+        {
+            unsigned char c = bytes[j];
+            if (c >= 0x80)
+            {
+                cg_uint valid = _cg_utf8_valid_length(bytes + j, length - j);
+                if (valid > 0)
+                {
+                    j += valid - 1;
+                    continue;
+                }
+            }
+            else if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f)
+            {
+                continue;
+            }
+            _cg_term_buffer_append(line, (const cg_char *)bytes + run, j - run);
+            if (c == '"' || c == '\\')
+            {
+                text[0] = '\\';
+                text[1] = (cg_char)c;
+                n = 2;
+            }
+            else
+            {
+                n = snprintf(text, sizeof(text), "\\u%04x", c);
+            }
+            _cg_term_buffer_append(line, text, n);
+            run = j + 1;
+        }
+        _cg_term_buffer_append(line, (const cg_char *)bytes + run, length - run);
+    }
+    _cg_term_buffer_append(line, "\"]\n", 3);
+
+    if (fwrite(line->buffer, 1, line->length, _cg_recorder.file) != line->length)
+    {
+        // the disk is full or gone, stop rather than fail every frame
+        fclose(_cg_recorder.file);
+        _cg_recorder.file = NULL;
+    }
+}
+
+cg_uint _cg_utf8_valid_length(const unsigned char *bytes, size_t n)
+{
+    uint32_t cp;
+    cg_uint len = _cg_utf8_decode((const cg_char *)bytes, n, &cp);
+    static const uint32_t min[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (len < 2 || cp < min[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+    {
+        return 0;
+    }
+    return len;
+}
+
+int _cg_input_timeout_ms()
+{
+    // a paste waits as long as it takes for its end
+    if (_cg_input_parser.length == 0 || _cg_input_parser.in_paste)
+    {
+        return -1;
+    }
+    uint64_t elapsed = _cg_now_nanos() - _cg_input_parser.since;
+    uint64_t timeout = (uint64_t)_CG_ESCAPE_TIMEOUT_MS * 1000000ULL;
+    if (elapsed >= timeout)
+    {
+        return 0;
+    }
+    return (int)((timeout - elapsed + 999999) / 1000000);
+}
+
+int _cg_input_push(cg_keyboard_input_t input)
+{
+    _cg_graphics_context_t *ctx = _cg_gfx_context;
+
+    _cg_keys_update(&input);
+    if (input.action == CG_KEY_RELEASE)
+    {
+        return 0;
+    }
+    _cg_stats.frame_input = _cg_input_earliest(_cg_stats.frame_input, input.time);
+    if (ctx->key_count == ctx->key_capacity)
+    {
+        cg_uint capacity = (ctx->key_capacity == 0) ? _CG_INPUT_START_SIZE : ctx->key_capacity * 2;
+        cg_keyboard_input_t *keys = (cg_keyboard_input_t *)_CG_REALLOC(ctx->keys_pressed, capacity * sizeof(cg_keyboard_input_t));
+        if (keys == NULL)
+        {
+            _cg_input_free_pastes(&input, 1);
+            return -1;
+        }
+        ctx->keys_pressed = keys;
+        ctx->key_capacity = capacity;
+    }
+    ctx->keys_pressed[ctx->key_count++] = input;
+    return 0;
+}
+
+void _cg_input_emit(cg_keyboard_input_t input)
+{
+    input.time = _cg_input_parser.stamp;
+
+    if (!atomic_load(&_cg_input.running))
+    {
+        _cg_input_push(input);
+        return;
+    }
+
+    // wait for room rather than drop the key, the terminal holds
+    // anything typed in the meantime
+    size_t head = atomic_load_explicit(&_cg_input.head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&_cg_input.tail, memory_order_acquire) == _CG_INPUT_RING_SIZE)
+    {
+        if (atomic_load(&_cg_input.shutdown))
+        {
+            // dropped, and a paste with it
+            _cg_input_free_pastes(&input, 1);
+            return;
+        }
+        struct timespec wait = {0, 1000000};
+#if CG_PLATFORM_WINDOWS
+        _cg_win_nanosleep(&wait, NULL);
+#elif CG_PLATFORM_POSIX
+        nanosleep(&wait, NULL);
+#endif
+    }
+    _cg_input.events[head & (_CG_INPUT_RING_SIZE - 1)] = input;
+    atomic_store_explicit(&_cg_input.head, head + 1, memory_order_release);
+}
+
+int _cg_input_ring_pop(cg_keyboard_input_t *input)
+{
+    size_t tail = atomic_load_explicit(&_cg_input.tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&_cg_input.head, memory_order_acquire))
+    {
+        return 0;
+    }
+    *input = _cg_input.events[tail & (_CG_INPUT_RING_SIZE - 1)];
+    atomic_store_explicit(&_cg_input.tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+void _cg_input_thread_main(void *arg)
+{
+    (void)arg;
+
+    while (!atomic_load(&_cg_input.shutdown))
+    {
+#if CG_PLATFORM_WINDOWS
+        // wake up now and then to check for shutdown
+        if (WaitForSingleObject(_cg_gfx_context->_cg_hin, 50) == WAIT_OBJECT_0)
+        {
+            _cg_backend.ops->read_input();
+            cg_request_redraw();
+        }
+#elif CG_PLATFORM_POSIX
+        struct pollfd fds[2];
+        fds[0].fd = _cg_backend.in_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = _cg_input.wake[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        // wake up when an unfinished escape sequence times out
+        int ready = poll(fds, 2, _cg_input_timeout_ms());
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) || ready == 0)
+        {
+            _cg_backend.ops->read_input();
+            cg_request_redraw();
+        }
+        else if (fds[0].revents != 0)
+        {
+            // the terminal or the stream went away
+            _cg_backend_hangup();
+            break;
+        }
+#endif
+    }
+
+    // from now on the draw thread reads the input itself
+    atomic_store(&_cg_input.running, false);
+}
+
+int _cg_input_start()
+{
+    if (_cg_input.started)
+    {
+        return 0;
+    }
+    if (_cg_backend.in_fd < 0)
+    {
+        // there is no input to wait on
+        return -1;
+    }
+
+#if CG_PLATFORM_POSIX
+    if (pipe(_cg_input.wake) == -1)
+    {
+        return -1;
+    }
+#endif
+    atomic_store(&_cg_input.head, 0);
+    atomic_store(&_cg_input.tail, 0);
+    atomic_store(&_cg_input.shutdown, false);
+
+    // set before the thread starts, from then on only it decodes input
+    atomic_store(&_cg_input.running, true);
+    if (_cg_thread_start(&_cg_input.thread, _cg_input_thread_main, NULL) != 0)
+    {
+        atomic_store(&_cg_input.running, false);
+#if CG_PLATFORM_POSIX
+        close(_cg_input.wake[0]);
+        close(_cg_input.wake[1]);
+#endif
+        return -1;
+    }
+    _cg_input.started = true;
+    return 0;
+}
+
+void _cg_input_stop()
+{
+    if (!_cg_input.started)
+    {
+        return;
+    }
+
+    atomic_store(&_cg_input.shutdown, true);
+#if CG_PLATFORM_POSIX
+    char c = 0;
+    if (write(_cg_input.wake[1], &c, 1) == -1)
+    {
+        cg_err_fatal_msg("write to input thread wakeup pipe");
+    }
+#endif
+    _cg_thread_join(_cg_input.thread);
+#if CG_PLATFORM_POSIX
+    close(_cg_input.wake[0]);
+    close(_cg_input.wake[1]);
+#endif
+    _cg_input.started = false;
+
+    // drop what was never taken, pastes own their text
+    cg_keyboard_input_t input;
+    while (_cg_input_ring_pop(&input))
+    {
+        _cg_input_free_pastes(&input, 1);
+    }
+}
+
+void cg_set_input_thread(int enabled)
+{
+    _cg_input.enabled = (enabled != 0);
+    if (!_cg_input.enabled)
+    {
+        _cg_input_stop();
+    }
+}
+
+// threading functions
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *arg;
+} _cg_thread_start_t;
+
+#if CG_PLATFORM_WINDOWS
+DWORD WINAPI _cg_thread_trampoline(LPVOID p)
+{
+    _cg_thread_start_t start = *(_cg_thread_start_t *)p;
+    _CG_FREE(p);
+    start.fn(start.arg);
+    return 0;
+}
+#elif CG_PLATFORM_POSIX
+void *_cg_thread_trampoline(void *p)
+{
+    _cg_thread_start_t start = *(_cg_thread_start_t *)p;
+    _CG_FREE(p);
+    start.fn(start.arg);
+    return NULL;
+}
+#endif
+
+int _cg_thread_start(_cg_thread_t *thread, void (*fn)(void *), void *arg)
+{
+    _cg_thread_start_t *start = (_cg_thread_start_t *)_CG_CALLOC(1, sizeof(_cg_thread_start_t));
+    if (start == NULL)
+    {
+        return -1;
+    }
+    start->fn = fn;
+    start->arg = arg;
+#if CG_PLATFORM_WINDOWS
+    *thread = CreateThread(NULL, 0, _cg_thread_trampoline, start, 0, NULL);
+    if (*thread == NULL)
+    {
+        _CG_FREE(start);
+        return -1;
+    }
+#elif CG_PLATFORM_POSIX
+    if (pthread_create(thread, NULL, _cg_thread_trampoline, start) != 0)
+    {
+        _CG_FREE(start);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void _cg_thread_join(_cg_thread_t thread)
+{
+#if CG_PLATFORM_WINDOWS
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#elif CG_PLATFORM_POSIX
+    pthread_join(thread, NULL);
+#endif
+}
+
+void _cg_mutex_lock(_cg_mutex_t *m)
+{
+#if CG_PLATFORM_WINDOWS
+    AcquireSRWLockExclusive(m);
+#elif CG_PLATFORM_POSIX
+    pthread_mutex_lock(m);
+#endif
+}
+
+void _cg_mutex_unlock(_cg_mutex_t *m)
+{
+#if CG_PLATFORM_WINDOWS
+    ReleaseSRWLockExclusive(m);
+#elif CG_PLATFORM_POSIX
+    pthread_mutex_unlock(m);
+#endif
+}
+
+void _cg_cond_wait(_cg_cond_t *c, _cg_mutex_t *m)
+{
+#if CG_PLATFORM_WINDOWS
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+#elif CG_PLATFORM_POSIX
+    pthread_cond_wait(c, m);
+#endif
+}
+
+void _cg_cond_signal(_cg_cond_t *c)
+{
+#if CG_PLATFORM_WINDOWS
+    WakeConditionVariable(c);
+#elif CG_PLATFORM_POSIX
+    pthread_cond_signal(c);
+#endif
+}
+
+void _cg_cond_broadcast(_cg_cond_t *c)
+{
+#if CG_PLATFORM_WINDOWS
+    WakeAllConditionVariable(c);
+#elif CG_PLATFORM_POSIX
+    pthread_cond_broadcast(c);
+#endif
+}
+
+cg_uint _cg_cpu_count()
+{
+#if CG_PLATFORM_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? info.dwNumberOfProcessors : 1;
+#elif CG_PLATFORM_POSIX
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (cg_uint)n : 1;
+#endif
+}
+
+// worker pool
+
+void _cg_deque_push(_cg_deque_t *deque, _cg_task_t task)
+{
+    _cg_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity)
     {
-        cell->c = c;
+        cg_uint capacity = (deque->capacity == 0) ? _CG_DEQUE_START_SIZE : deque->capacity * 2;
+        _cg_task_t *tasks = (_cg_task_t *)_CG_CALLOC(capacity, sizeof(_cg_task_t));
+        if (tasks == NULL)
+        {
+            printf("FATAL Error: Unable to grow task queue.\n");
+            exit(-1);
+        }
+        for (cg_uint i = deque->top; i != deque->bottom; i++)
+        {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        if (deque->tasks != NULL)
+        {
+            _CG_FREE(deque->tasks);
+        }
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    deque->bottom++;
+    _cg_mutex_unlock(&deque->lock);
+    atomic_fetch_add(&_cg_pool.queued, 1);
+}
+
+int _cg_deque_pop(_cg_deque_t *deque, _cg_task_t *task)
+{
+    int found = 0;
+    _cg_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top)
+    {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+        found = 1;
+    }
+    _cg_mutex_unlock(&deque->lock);
+    return found;
+}
+
+int _cg_deque_steal(_cg_deque_t *deque, _cg_task_t *task)
+{
+    int found = 0;
+    _cg_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top)
+    {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        deque->top++;
+        found = 1;
+    }
+    _cg_mutex_unlock(&deque->lock);
+    return found;
+}
+
+void _cg_pool_push(_cg_task_t task)
+{
+    int self = _cg_worker_index;
+    _cg_deque_push((self >= 0) ? &_cg_pool.deques[self] : &_cg_pool.inject, task);
+}
+
+void _cg_pool_notify()
+{
+    _cg_mutex_lock(&_cg_pool.lock);
+    _cg_cond_broadcast(&_cg_pool.cond);
+    _cg_mutex_unlock(&_cg_pool.lock);
+}
+
+int _cg_pool_run_one()
+{
+    int self = _cg_worker_index;
+    _cg_task_t task;
+    int found = 0;
+
+    if (atomic_load(&_cg_pool.queued) == 0)
+    {
+        return 0;
+    }
+
+    // newest task of our own first, it is most likely still in cache
+    if (self >= 0)
+    {
+        found = _cg_deque_pop(&_cg_pool.deques[self], &task);
+    }
+    else
+    {
+        found = _cg_deque_pop(&_cg_pool.inject, &task);
+    }
+
+    // then the oldest task of the other workers, starting after our own
+    cg_uint n = _cg_pool.thread_count;
+    for (cg_uint i = 0; !found && i < n; i++)
+    {
+        cg_uint victim = (cg_uint)(self + 1 + i) % n;
+        if ((int)victim != self)
+        {
+            found = _cg_deque_steal(&_cg_pool.deques[victim], &task);
+        }
+    }
+    if (!found && self >= 0)
+    {
+        found = _cg_deque_steal(&_cg_pool.inject, &task);
+    }
+    if (!found)
+    {
+        return 0;
+    }
+
+    atomic_fetch_sub(&_cg_pool.queued, 1);
+    task.run(task.arg, task.begin, task.end);
+    return 1;
+}
+
+void _cg_pool_help_until(bool (*done)(void *arg), void *arg)
+{
+    while (!done(arg))
+    {
+        if (_cg_pool_run_one())
+        {
+            continue;
+        }
+
+        // nothing to run, sleep until tasks are queued or work finishes
+        _cg_mutex_lock(&_cg_pool.lock);
+        while (!done(arg) && atomic_load(&_cg_pool.queued) == 0)
+        {
+            _cg_cond_wait(&_cg_pool.cond, &_cg_pool.lock);
+        }
+        _cg_mutex_unlock(&_cg_pool.lock);
+    }
+}
+
+void _cg_pool_worker(void *arg)
+{
+    _cg_worker_index = (int)(intptr_t)arg;
+
+    for (;;)
+    {
+        if (_cg_pool_run_one())
+        {
+            continue;
+        }
+
+        _cg_mutex_lock(&_cg_pool.lock);
+        while (!_cg_pool.shutdown && atomic_load(&_cg_pool.queued) == 0)
+        {
+            _cg_cond_wait(&_cg_pool.cond, &_cg_pool.lock);
+        }
+        bool shutdown = _cg_pool.shutdown;
+        _cg_mutex_unlock(&_cg_pool.lock);
+        if (shutdown)
+        {
+            break;
+        }
     }
 }
 
-void cg_dispose_cell(cg_cell_t *cell)
+void _cg_pool_start()
 {
-    if (cell != NULL)
+    _cg_mutex_lock(&_cg_pool.start_lock);
+    if (_cg_pool.started)
     {
-        _CG_FREE(cell);
+        _cg_mutex_unlock(&_cg_pool.start_lock);
+        return;
     }
-}
+    _cg_pool.shutdown = false;
 
-int cg_compare_cells(cg_cell_t *cell1, cg_cell_t *cell2)
-{
-    if (cell1 == NULL && cell2 == NULL)
+    cg_uint total = (_cg_pool.requested > 0) ? _cg_pool.requested : _cg_cpu_count();
+    cg_uint n = total - 1; // the calling thread also works
+    if (n > 0)
     {
-        return 0;
+        _cg_pool.threads = (_cg_thread_t *)_CG_CALLOC(n, sizeof(_cg_thread_t));
+        _cg_pool.deques = (_cg_deque_t *)_CG_CALLOC(n, sizeof(_cg_deque_t));
+        if (_cg_pool.threads == NULL || _cg_pool.deques == NULL)
+        {
+            n = 0;
+        }
+        for (cg_uint i = 0; i < n; i++)
+        {
+            _cg_mutex_t init = _CG_MUTEX_INITIALIZER;
+            _cg_pool.deques[i].lock = init;
+        }
+        for (cg_uint i = 0; i < n; i++)
+        {
+            if (_cg_thread_start(&(_cg_pool.threads[i]), _cg_pool_worker, (void *)(intptr_t)i) != 0)
+            {
+                break;
+            }
+            _cg_pool.thread_count++;
+        }
     }
-    if (cell1 == NULL || cell2 == NULL)
+
+    _cg_pool.started = true;
+    _cg_mutex_unlock(&_cg_pool.start_lock);
+}
+
+void _cg_pool_stop()
+{
+    _cg_mutex_lock(&_cg_pool.start_lock);
+    if (!_cg_pool.started)
     {
-        return -1;
+        _cg_mutex_unlock(&_cg_pool.start_lock);
+        return;
     }
-    if (cell1->c != cell2->c)
+
+    _cg_mutex_lock(&_cg_pool.lock);
+    _cg_pool.shutdown = true;
+    _cg_cond_broadcast(&_cg_pool.cond);
+    _cg_mutex_unlock(&_cg_pool.lock);
+
+    for (cg_uint i = 0; i < _cg_pool.thread_count; i++)
     {
-        return -1;
+        _cg_thread_join(_cg_pool.threads[i]);
     }
-    if (cell1->bg.r != cell2->bg.r || cell1->bg.g != cell2->bg.g || cell1->bg.b != cell2->bg.b)
+    if (_cg_pool.threads != NULL)
     {
-        return -1;
+        _CG_FREE(_cg_pool.threads);
     }
-    if (cell1->fg.r != cell2->fg.r || cell1->fg.g != cell2->fg.g || cell1->fg.b != cell2->fg.b)
+    if (_cg_pool.deques != NULL)
     {
-        return -1;
+        for (cg_uint i = 0; i < _cg_pool.thread_count; i++)
+        {
+            if (_cg_pool.deques[i].tasks != NULL)
+            {
+                _CG_FREE(_cg_pool.deques[i].tasks);
+            }
+        }
+        _CG_FREE(_cg_pool.deques);
     }
-    return 0;
+    _cg_pool.threads = NULL;
+    _cg_pool.deques = NULL;
+    _cg_pool.thread_count = 0;
+    _cg_pool.started = false;
+    _cg_mutex_unlock(&_cg_pool.start_lock);
 }
 
-cg_canvas_t *cg_make_canvas(cg_uint w, cg_uint h)
+void _cg_batch_task(void *arg, cg_uint begin, cg_uint end)
 {
-    cg_canvas_t *canvas = (cg_canvas_t *)_CG_CALLOC(1, sizeof(cg_canvas_t));
-    if (canvas == NULL)
+    _cg_batch_t *batch = (_cg_batch_t *)arg;
+
+    if (batch->range_fn != NULL)
     {
-        printf("FATAL Error: Unable to allocate cg_canvas_t.\n");
-        exit(-1);
+        batch->range_fn(begin, end, batch->ctx);
     }
-    canvas->width = w;
-    canvas->height = h;
-    canvas->cells = (cg_cell_t *)_CG_CALLOC(w * h, sizeof(cg_cell_t));
-    if (canvas->cells == NULL)
+    else
     {
-        printf("FATAL Error: Unable to allocate cg_cell_t array.\n");
-        exit(-1);
+        for (cg_uint i = begin; i < end; i++)
+        {
+            batch->index_fn(batch->ctx, i);
+        }
     }
 
-    // allocate cells
-    for (cg_uint i = 0; i < h; i++)
+    // the batch lives on the waiting thread's stack, do not touch it
+    // after the last task is counted
+    if (atomic_fetch_sub(&batch->remaining, 1) == 1)
     {
-        for (cg_uint j = 0; j < w; j++)
-        {
-            canvas->cells[(i * w) + j] = *cg_make_cell(_CG_DEFAULT_BACKGROUND_CHAR, default_bg_colour, default_fg_colour);
-        }
+        _cg_pool_notify();
     }
-    return canvas;
 }
 
-cg_cell_t *cg_get_cell(cg_canvas_t *canvas, cg_uint x, cg_uint y)
+bool _cg_batch_done(void *arg)
 {
-    if (canvas == NULL)
-    {
-        return NULL;
-    }
-    if (x >= canvas->width || y >= canvas->height)
-    {
-        return NULL;
-    }
-    return &(canvas->cells[(y * canvas->width) + x]);
+    return atomic_load(&((_cg_batch_t *)arg)->remaining) == 0;
 }
 
-void cg_dispose_canvas(cg_canvas_t *canvas)
+void _cg_pool_run_batch(_cg_batch_t *batch, cg_uint count, cg_uint grain)
 {
-    if (canvas != NULL)
+    if (count == 0)
     {
-        if (canvas->cells != NULL)
+        return;
+    }
+    _cg_pool_start();
+
+    cg_uint tasks = (count + grain - 1) / grain;
+    if (_cg_pool.thread_count == 0 || tasks == 1)
+    {
+        atomic_store(&batch->remaining, tasks);
+        for (cg_uint begin = 0; begin < count; begin += grain)
         {
-            _CG_FREE(canvas->cells);
+            _cg_batch_task(batch, begin, (count - begin < grain) ? count : begin + grain);
         }
-        _CG_FREE(canvas);
+        return;
     }
+
+    // push in reverse so the first range is popped first by this thread,
+    // the workers steal from the far end
+    atomic_store(&batch->remaining, tasks);
+    for (cg_uint t = tasks; t > 0; t--)
+    {
+        cg_uint begin = (t - 1) * grain;
+        _cg_task_t task = {_cg_batch_task, batch, begin, (count - begin < grain) ? count : begin + grain};
+        _cg_pool_push(task);
+    }
+    _cg_pool_notify();
+
+    _cg_pool_help_until(_cg_batch_done, batch);
 }
-cg_uint _diff_time_micros(struct timespec time1, struct timespec time2)
+
+void _cg_pool_run(_cg_pool_task_fn fn, void *ctx, cg_uint count)
 {
-    // printf("time1 [%ld, %ld], time2[%ld, %ld]\n", time1.tv_sec, time1.tv_nsec, time2.tv_sec, time2.tv_nsec);
-    cg_uint seconds_delta = (time1.tv_sec - time2.tv_sec);
-    cg_int nanos_delta = (time1.tv_nsec - time2.tv_nsec);
-    cg_uint delta = (seconds_delta * 1000000) + (nanos_delta / 1000);
-    // printf("seconds_delta = %lu, nanos_delta = %ld, delta = %lu\n", seconds_delta, nanos_delta, delta);
-    return delta;
+    _cg_batch_t batch;
+    batch.range_fn = NULL;
+    batch.index_fn = fn;
+    batch.ctx = ctx;
+    _cg_pool_run_batch(&batch, count, 1);
 }
 
-void cg_err_fatal(cg_string message, cg_uint code)
+void cg_set_worker_count(cg_uint n)
 {
-    printf("FATAL: %s\n", message);
-    exit(code);
+    // the workers may still have queued jobs or a frame to encode
+    cg_wait_jobs();
+    _cg_present_stop();
+
+    _cg_pool_stop();
+    _cg_pool.requested = n;
 }
 
-void cg_err_fatal_msg(cg_string message)
+cg_uint cg_get_worker_count()
 {
-    cg_err_fatal(message, -1);
+    return (_cg_pool.requested > 0) ? _cg_pool.requested : _cg_cpu_count();
 }
 
-cg_uint cg_number_to_uinteger(cg_number x)
+void cg_parallel_for(cg_uint count, cg_uint grain, cg_range_fn fn, void *userdata)
 {
-    if (x < 0)
+    if (grain == 0)
     {
-        return 0;
-    }
-    else
-    {
-        return (cg_uint)x;
+        cg_uint tasks = cg_get_worker_count() * _CG_POOL_TASKS_PER_WORKER;
+        grain = (count + tasks - 1) / tasks;
+        if (grain == 0)
+        {
+            grain = 1;
+        }
     }
+
+    _cg_batch_t batch;
+    batch.range_fn = fn;
+    batch.index_fn = NULL;
+    batch.ctx = userdata;
+    _cg_pool_run_batch(&batch, count, grain);
 }
 
-// type utility functions
-cg_string cg_make_string(cg_uint length)
+// jobs
+
+_cg_job_slot_t *_cg_job_slot(cg_uint index)
 {
-    cg_string s = (cg_string)_CG_CALLOC(length + 1, sizeof(cg_char));
-    if (s == NULL)
+    cg_uint page = index / _CG_JOB_PAGE_SIZE;
+    if (page >= _cg_jobs.page_count)
     {
-        printf("FATAL Error: Unable to allocate cg_string.\n");
-        exit(-1);
+        return NULL;
     }
-    return s;
+    return &(_cg_jobs.pages[page][index % _CG_JOB_PAGE_SIZE]);
 }
 
-void cg_dispose_string(cg_string s)
+long _cg_job_alloc()
 {
-    if (s != NULL)
+    if (_cg_jobs.free_head == 0)
     {
-        _CG_FREE(s);
+        if (_cg_jobs.page_count == _CG_JOB_MAX_PAGES)
+        {
+            return -1;
+        }
+        _cg_job_slot_t *page = (_cg_job_slot_t *)_CG_CALLOC(_CG_JOB_PAGE_SIZE, sizeof(_cg_job_slot_t));
+        if (page == NULL)
+        {
+            return -1;
+        }
+        cg_uint first = _cg_jobs.page_count * _CG_JOB_PAGE_SIZE;
+        for (cg_uint i = 0; i < _CG_JOB_PAGE_SIZE; i++)
+        {
+            // generation 0 is never used, so a zeroed handle is always done
+            atomic_store(&page[i].generation, 1);
+            page[i].next_free = (i + 1 < _CG_JOB_PAGE_SIZE) ? first + i + 2 : 0;
+        }
+        _cg_jobs.pages[_cg_jobs.page_count++] = page;
+        _cg_jobs.free_head = first + 1;
     }
+
+    cg_uint index = _cg_jobs.free_head - 1;
+    _cg_jobs.free_head = _cg_job_slot(index)->next_free;
+    return (long)index;
 }
 
-int cg_rand_int(int from, int to)
+void _cg_job_queue(cg_uint index)
 {
-    int num = (rand() % (to - from + 1)) + from;
-    return num;
+    _cg_task_t task = {_cg_job_task, (void *)(uintptr_t)index, 0, 0};
+    _cg_pool_push(task);
 }
 
-int cg_clamp(int x, int min, int max)
+void _cg_job_task(void *arg, cg_uint begin, cg_uint end)
 {
-    if (x < min)
-    {
-        return min;
-    }
-    if (x > max)
+    (void)begin;
+    (void)end;
+    cg_uint index = (cg_uint)(uintptr_t)arg;
+
+    _cg_mutex_lock(&_cg_jobs.lock);
+    _cg_job_slot_t *slot = _cg_job_slot(index);
+    cg_job_fn fn = slot->fn;
+    void *userdata = slot->userdata;
+    _cg_mutex_unlock(&_cg_jobs.lock);
+
+    fn(userdata);
+
+    _cg_mutex_lock(&_cg_jobs.lock);
+    slot = _cg_job_slot(index);
+    for (cg_uint i = 0; i < slot->dependent_count; i++)
     {
-        return max;
+        _cg_job_slot_t *dependent = _cg_job_slot(slot->dependents[i]);
+        if (--dependent->pending == 0)
+        {
+            _cg_job_queue(slot->dependents[i]);
+        }
     }
-    return x;
+    slot->dependent_count = 0;
+
+    // old handles now read as done, and the slot can be reused
+    cg_uint generation = atomic_load(&slot->generation) + 1;
+    atomic_store(&slot->generation, (generation == 0) ? 1 : generation);
+    slot->next_free = _cg_jobs.free_head;
+    _cg_jobs.free_head = index + 1;
+    _cg_mutex_unlock(&_cg_jobs.lock);
+
+    atomic_fetch_sub(&_cg_jobs.outstanding, 1);
+    _cg_pool_notify();
 }
 
-void cg_no_loop()
+bool _cg_job_done(void *arg)
 {
-    _loop = 0;
+    return cg_job_done(*(cg_job_t *)arg) != 0;
 }
 
-void cg_loop()
+bool _cg_jobs_all_done(void *arg)
 {
-    _loop = 1;
+    (void)arg;
+    return atomic_load(&_cg_jobs.outstanding) == 0;
 }
 
-void cg_frame_rate(cg_uint fps)
+cg_job_t cg_job_submit(cg_job_fn fn, void *userdata, const cg_job_t *deps, cg_uint dep_count)
 {
-    if (fps > 0 && fps < 100)
+    cg_job_t job = {0, 0};
+
+    _cg_pool_start();
+
+    _cg_mutex_lock(&_cg_jobs.lock);
+    long index = _cg_job_alloc();
+    if (index < 0)
     {
-        _fps = fps;
+        // out of slots, run it here once its dependencies are done
+        _cg_mutex_unlock(&_cg_jobs.lock);
+        for (cg_uint i = 0; i < dep_count; i++)
+        {
+            cg_job_wait(deps[i]);
+        }
+        fn(userdata);
+        return job;
     }
-    else
+
+    _cg_job_slot_t *slot = _cg_job_slot((cg_uint)index);
+    slot->fn = fn;
+    slot->userdata = userdata;
+    slot->pending = 0;
+    for (cg_uint i = 0; i < dep_count; i++)
     {
-        printf("FATAL: Invalid fps [%lu], should be in range (0, 100). \n", fps);
-        exit(-1);
+        _cg_job_slot_t *dep = _cg_job_slot(deps[i].index);
+        if (dep == NULL || atomic_load(&dep->generation) != deps[i].generation)
+        {
+            // already done
+            continue;
+        }
+        if (dep->dependent_count == dep->dependent_capacity)
+        {
+            cg_uint capacity = (dep->dependent_capacity == 0) ? 4 : dep->dependent_capacity * 2;
+            cg_uint *dependents = (cg_uint *)_CG_REALLOC(dep->dependents, capacity * sizeof(cg_uint));
+            if (dependents == NULL)
+            {
+                printf("FATAL Error: Unable to grow job dependents.\n");
+                exit(-1);
+            }
+            dep->dependents = dependents;
+            dep->dependent_capacity = capacity;
+        }
+        dep->dependents[dep->dependent_count++] = (cg_uint)index;
+        slot->pending++;
     }
-}
 
-// terminal utility functions
-void cg_cls()
-{
-    printf("\033[2J");
+    job.index = (cg_uint)index;
+    job.generation = atomic_load(&slot->generation);
+    atomic_fetch_add(&_cg_jobs.outstanding, 1);
+    bool ready = (slot->pending == 0);
+    if (ready)
+    {
+        _cg_job_queue((cg_uint)index);
+    }
+    _cg_mutex_unlock(&_cg_jobs.lock);
+
+    if (ready)
+    {
+        _cg_pool_notify();
+    }
+    return job;
 }
 
-void cg_home()
+int cg_job_done(cg_job_t job)
 {
-    printf("\033[H");
+    _cg_mutex_lock(&_cg_jobs.lock);
+    _cg_job_slot_t *slot = _cg_job_slot(job.index);
+    int done = (slot == NULL || atomic_load(&slot->generation) != job.generation);
+    _cg_mutex_unlock(&_cg_jobs.lock);
+    return done;
 }
 
-void _cg_term_enable_raw_mode()
+void cg_job_wait(cg_job_t job)
 {
-#if CG_PLATFORM_WINDOWS
-    _cg_win_term_enable_raw_mode();
-#elif CG_PLATFORM_POSIX
-    _cg_posix_term_enable_raw_mode();
-#endif
+    _cg_pool_help_until(_cg_job_done, &job);
 }
 
-void _cg_term_disable_raw_mode()
+void cg_wait_jobs()
 {
-#if CG_PLATFORM_WINDOWS
-    _cg_win_term_disable_raw_mode();
-#elif CG_PLATFORM_POSIX
-    _cg_posix_term_disable_raw_mode();
-#endif
+    _cg_pool_help_until(_cg_jobs_all_done, NULL);
 }
 
-#if CG_PLATFORM_WINDOWS
-void _cg_win_term_enable_raw_mode()
+// canvas functions
+
+void cg_create_canvas(cg_uint w, cg_uint h)
 {
-    _cg_gfx_context->_cg_hin = GetStdHandle(STD_INPUT_HANDLE);
-    if (_cg_gfx_context->_cg_hin == INVALID_HANDLE_VALUE)
+    // the presentation thread owns some of the canvases, stop it first,
+    // it restarts with the new size on the next frame
+    _cg_present_stop();
+
+    if (canvas_current != NULL)
     {
-        cg_err_fatal_msg("GetStdHandle");
+        cg_dispose_canvas(canvas_current);
     }
-
-    if (!GetConsoleMode(_cg_gfx_context->_cg_hin, &_cg_gfx_context->_cg_orig_in_mode))
+    canvas_current = cg_make_canvas(w, h);
+    if (canvas_previous != NULL)
     {
-        cg_err_fatal_msg("GetConsoleMode");
+        cg_dispose_canvas(canvas_previous);
     }
+    canvas_previous = cg_make_canvas(w, h);
 
-    DWORD raw = _cg_gfx_context->_cg_orig_in_mode;
+    // nothing on the terminal is known to match the new canvases
+    _cg_output.full_redraw = true;
 
-    raw &= ~(ENABLE_ECHO_INPUT);
-    raw &= ~(ENABLE_LINE_INPUT);
-    raw &= ~(ENABLE_PROCESSED_INPUT);
-    raw &= ~(ENABLE_WINDOW_INPUT);
-    raw &= ~(ENABLE_MOUSE_INPUT);
+    width = w;
+    height = h;
+}
 
-    // Optional: disable Ctrl+C handling
-    raw &= ~(ENABLE_PROCESSED_INPUT);
+void cg_swap_canvas()
+{
+    cg_canvas_t *temp = canvas_current;
+    canvas_current = canvas_previous;
+    canvas_previous = temp;
+}
 
-    if (!SetConsoleMode(_cg_gfx_context->_cg_hin, raw))
+void cg_background(cg_rgb_t col)
+{
+    background_colour = col;
+    _cg_background_packed = _cg_pack_colour(col);
+
+    // the background is opaque, fill every cell directly
+    cg_glyph_t glyph = _cg_char_to_glyph(background_char);
+    cg_uint n = canvas_current->width * canvas_current->height;
+    cg_cell_t *cells = canvas_current->cells;
+    for (cg_uint i = 0; i < n; i++)
     {
-        cg_err_fatal_msg("SetConsoleMode");
+        cells[i].glyph = glyph;
+        cells[i].fg = _cg_stroke_packed;
+        cells[i].bg = _cg_background_packed;
     }
+}
 
-    atexit(_cg_term_disable_raw_mode);
-
-    // Enable vt100
-    _cg_gfx_context->_cg_hout = GetStdHandle(STD_OUTPUT_HANDLE);
-
-    DWORD out_mode;
-    GetConsoleMode(_cg_gfx_context->_cg_hout, &out_mode);
+void cg_stroke(cg_rgb_t col)
+{
+    stroke_colour = col;
+    stroke_alpha = 255;
+    _cg_stroke_packed = _cg_pack_colour(col);
+}
 
-    out_mode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+void cg_fill(cg_rgb_t col)
+{
+    fill_colour = col;
+    fill_alpha = 255;
+    _cg_fill_packed = _cg_pack_colour(col);
+}
 
-    SetConsoleMode(_cg_gfx_context->_cg_hout, out_mode);
+void cg_stroke_rgba(cg_rgba_t col)
+{
+    cg_stroke((cg_rgb_t){col.r, col.g, col.b});
+    stroke_alpha = (col.a > 255) ? 255 : col.a;
+}
 
-    // Enable UTF8 in Windows
-    SetConsoleOutputCP(CP_UTF8);
+void cg_fill_rgba(cg_rgba_t col)
+{
+    cg_fill((cg_rgb_t){col.r, col.g, col.b});
+    fill_alpha = (col.a > 255) ? 255 : col.a;
 }
 
-void _cg_win_term_disable_raw_mode()
+void cg_blend_mode(cg_blend_mode_t mode)
 {
-    SetConsoleMode(_cg_gfx_context->_cg_hin, _cg_gfx_context->_cg_orig_in_mode);
+    blend_mode = mode;
 }
-#endif
 
-#if CG_PLATFORM_POSIX
-void _cg_posix_term_enable_raw_mode()
+cg_colour32_t _cg_stroke_over(cg_colour32_t dst)
 {
-    if (tcgetattr(STDIN_FILENO, &orig_termios) == -1)
+    if (stroke_alpha == 255 && blend_mode == CG_BLEND_NORMAL)
     {
-        cg_err_fatal_msg("tcgetattr");
+        return _cg_stroke_packed;
     }
+    return _cg_blend_colour(dst, _cg_stroke_packed, stroke_alpha, blend_mode);
+}
 
-    atexit(_cg_term_disable_raw_mode);
-    struct termios raw = orig_termios;
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-    raw.c_oflag &= ~(OPOST);
-    raw.c_cflag |= (CS8);
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
-
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+void _cg_blend_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h, bool fg, bool bg)
+{
+    if (canvas_current == NULL || x >= canvas_current->width || y >= canvas_current->height)
     {
-        cg_err_fatal_msg("tcsetattr");
+        return;
     }
-
-    // Get the current flags
-    if ((_cg_term_orig_flags = fcntl(STDIN_FILENO, F_GETFL, 0)) == -1)
+    if (w > canvas_current->width - x)
     {
-        cg_err_fatal_msg("fcntl error getting flags");
+        w = canvas_current->width - x;
     }
-
-    // Set the flags to be non-blocking
-    if ((fcntl(STDIN_FILENO, F_SETFL, _cg_term_orig_flags | O_NONBLOCK) == -1))
+    if (h > canvas_current->height - y)
     {
-        cg_err_fatal_msg("fcntl error setting flags");
+        h = canvas_current->height - y;
     }
-}
 
-void _cg_posix_term_disable_raw_mode()
-{
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1)
+    // colours are strided by the cell size inside the cell array
+    size_t stride = sizeof(cg_cell_t) / sizeof(cg_colour32_t);
+    cg_cell_t *first = cg_get_cell(canvas_current, x, y);
+
+    // full width rows are contiguous, blend them as one span
+    size_t span = w;
+    cg_uint spans = h;
+    if (w == canvas_current->width)
     {
-        cg_err_fatal_msg("tcsetattr");
+        span = (size_t)w * h;
+        spans = 1;
     }
 
-    // Reset the flags
-    if (fcntl(STDIN_FILENO, F_SETFL, _cg_term_orig_flags) == -1)
+    for (cg_uint i = 0; i < spans; i++)
     {
-        cg_err_fatal_msg("fcntl error resetting flags");
+        cg_cell_t *row = first + (i * canvas_current->width);
+        if (fg)
+        {
+            _cg_blend_span(&(row->fg), stride, span, _cg_fill_packed, fill_alpha, blend_mode);
+        }
+        if (bg)
+        {
+            _cg_blend_span(&(row->bg), stride, span, _cg_fill_packed, fill_alpha, blend_mode);
+        }
     }
 }
-#endif
 
-int _cg_term_create_command_buffer(_cg_term_command_buffer_t **buffer)
+void cg_fill_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h)
 {
-    *buffer = (_cg_term_command_buffer_t *)_CG_CALLOC(1, sizeof(_cg_term_command_buffer_t));
-    if (*buffer == NULL)
+    _cg_blend_rect(x, y, w, h, false, true);
+}
+
+void cg_fade_rect(cg_uint x, cg_uint y, cg_uint w, cg_uint h)
+{
+    _cg_blend_rect(x, y, w, h, true, true);
+}
+
+void cg_set_colour(cg_rgb_t col)
+{
+    cg_stroke(col);
+    cg_fill(col);
+}
+
+bool _cg_encode_cell_changed(cg_cell_t *cur, cg_cell_t *prev, cg_uint x, cg_uint w)
+{
+    // the continuation cell is covered when its wide glyph is written
+    if (cur[x].glyph == CG_GLYPH_CONTINUATION)
     {
-        return -1;
+        return false;
     }
-    (*buffer)->buffer = (cg_char *)_CG_CALLOC(_CG_TERM_COMMAND_BUFFER_START_SIZE, sizeof(cg_char));
-    if ((*buffer)->buffer == NULL)
+    if (prev == NULL)
     {
-        return -1;
+        return true;
     }
-    (*buffer)->length = 0;
-    // Mark the first character as the null terminator
-    (*buffer)->buffer[0] = '\0';
-    (*buffer)->size = _CG_TERM_COMMAND_BUFFER_START_SIZE;
-    return 0;
+    if (cg_compare_cells(&cur[x], &prev[x]) != 0)
+    {
+        return true;
+    }
+    // a wide glyph is also rewritten if its continuation cell changed
+    return (x + 1 < w && cur[x + 1].glyph == CG_GLYPH_CONTINUATION &&
+            cg_compare_cells(&cur[x + 1], &prev[x + 1]) != 0);
 }
 
-int _cg_term_expand_command_buffer(_cg_term_command_buffer_t *buffer, size_t more_required)
+void _cg_encode_start_state(_cg_encode_job_t *job, cg_uint row, _cg_encode_state_t *state)
 {
-    // use realloc to expand the buffer
-    size_t new_size = buffer->size + more_required;
-    cg_char *new_buffer = (cg_char *)_CG_REALLOC(buffer->buffer, new_size * sizeof(cg_char));
-    if (new_buffer == NULL)
+    cg_uint w = job->current->width;
+
+    state->cursor_x = 0;
+    state->cursor_y = 0;
+    state->cursor_valid = false;
+    // no colour packs to all ones, so the first cell always sets both
+    state->fg = 0xFFFFFFFF;
+    state->bg = 0xFFFFFFFF;
+
+    // find the last cell written before the row
+    while (row > 0)
     {
-        return -1;
+        row--;
+        cg_cell_t *cur = job->current->cells + (row * w);
+        cg_cell_t *prev = (job->previous != NULL) ? job->previous->cells + (row * w) : NULL;
+        if (prev != NULL && memcmp(cur, prev, w * sizeof(cg_cell_t)) == 0)
+        {
+            continue;
+        }
+        for (cg_uint j = w; j > 0; j--)
+        {
+            if (_cg_encode_cell_changed(cur, prev, j - 1, w))
+            {
+                state->fg = cur[j - 1].fg;
+                state->bg = cur[j - 1].bg;
+                return;
+            }
+        }
     }
-    buffer->buffer = new_buffer;
-    buffer->size = new_size;
-    return 0;
 }
 
-void _cg_term_dispose_command_buffer(_cg_term_command_buffer_t *buffer)
+cg_uint _cg_encode_rows(_cg_term_command_buffer_t *buffer, _cg_encode_job_t *job,
+                        cg_uint row0, cg_uint row1, _cg_encode_state_t *state)
 {
-    if (buffer != NULL)
+    cg_uint w = job->current->width;
+    cg_uint written = 0;
+
+    for (cg_uint i = row0; i < row1; i++)
     {
-        if (buffer->buffer != NULL)
+        cg_cell_t *cur = job->current->cells + (i * w);
+        cg_cell_t *prev = (job->previous != NULL) ? job->previous->cells + (i * w) : NULL;
+
+        // skip rows which did not change at all
+        if (prev != NULL && memcmp(cur, prev, w * sizeof(cg_cell_t)) == 0)
         {
-            _CG_FREE(buffer->buffer);
+            continue;
+        }
+
+        for (cg_uint j = 0; j < w; j++)
+        {
+            if (!_cg_encode_cell_changed(cur, prev, j, w))
+            {
+                continue;
+            }
+
+            cg_cell_t *cell = &cur[j];
+
+            // move to the cell position if the cursor is elsewhere
+            if (!state->cursor_valid || state->cursor_x != j || state->cursor_y != i)
+            {
+                state->cursor_x = j;
+                state->cursor_y = i;
+                state->cursor_valid = true;
+                _cg_encode_move_to(buffer, j, i);
+            }
+
+            // set the colours
+            if (cell->fg != state->fg)
+            {
+                _cg_encode_colour(buffer, 38, cell->fg);
+                state->fg = cell->fg;
+            }
+            if (cell->bg != state->bg)
+            {
+                _cg_encode_colour(buffer, 48, cell->bg);
+                state->bg = cell->bg;
+            }
+
+            // write the glyph bytes
+            _cg_glyph_entry_t *entry = _cg_glyph_entry(cell->glyph);
+            _cg_term_buffer_append(buffer, entry->bytes, entry->len);
+            state->cursor_x += cg_glyph_width(cell->glyph);
+            written++;
         }
-        _CG_FREE(buffer);
     }
+    return written;
 }
 
-int _cg_term_buffer_command(_cg_term_command_buffer_t *buffer, cg_string command, size_t length)
+void _cg_encode_band(void *ctx, cg_uint index)
 {
-    if (buffer == NULL || command == NULL)
+    _cg_encode_job_t *job = (_cg_encode_job_t *)ctx;
+    _cg_term_command_buffer_t *buffer = job->buffers[index];
+    cg_uint row0 = index * job->band_rows;
+    cg_uint row1 = row0 + job->band_rows;
+    if (row1 > job->current->height)
     {
-        return -1;
+        row1 = job->current->height;
     }
 
-    size_t n = (length == 0) ? strlen(command) : length;
+    _cg_encode_state_t state;
+    _cg_encode_start_state(job, row0, &state);
 
-    size_t new_size = buffer->length + n + 1;
-    if (new_size > buffer->size)
+    buffer->length = 0;
+    cg_uint written = _cg_encode_rows(buffer, job, row0, row1, &state);
+    atomic_fetch_add(&job->cells_changed, written);
+}
+
+int _cg_encode_reserve_bands(cg_uint count)
+{
+    if (count <= _cg_band_buffer_count)
+    {
+        return 0;
+    }
+    _cg_term_command_buffer_t **buffers = (_cg_term_command_buffer_t **)_CG_REALLOC(
+        _cg_band_buffers, count * sizeof(_cg_term_command_buffer_t *));
+    if (buffers == NULL)
+    {
+        return -1;
+    }
+    _cg_band_buffers = buffers;
+    _cg_iovec_t *iov = (_cg_iovec_t *)_CG_REALLOC(_cg_frame_iov, (count + 3) * sizeof(_cg_iovec_t));
+    if (iov == NULL)
     {
-        if (_cg_term_expand_command_buffer(buffer, n) == -1)
+        return -1;
+    }
+    _cg_frame_iov = iov;
+    while (_cg_band_buffer_count < count)
+    {
+        if (_cg_term_create_command_buffer(&(_cg_band_buffers[_cg_band_buffer_count])) == -1)
         {
             return -1;
         }
+        _cg_band_buffer_count++;
     }
+    return 0;
+}
 
-    memcpy(buffer->buffer + buffer->length, command, n);
-    buffer->length += n;
-    buffer->buffer[buffer->length] = '\0';
-
-    // FIXME: flushing every command; otherwise commands
-    // get witten incomplete sometimes on iterm/macos term
-    // which is strange, can't figure it out
-#if CG_PLATFORM_WINDOWS
-    if (buffer->length >= _CG_TERM_COMMAND_BUFFER_FLUSH_LIMIT)
+void cg_show_canvas()
+{
+    if (canvas_current == NULL)
     {
-        return _cg_term_flush_command_buffer(buffer);
+        return;
     }
-#elif CG_PLATFORM_POSIX
-    // if (buffer->length >= _CG_TERM_COMMAND_BUFFER_FLUSH_LIMIT)
-    //{
-    return _cg_term_flush_command_buffer(buffer);
-    //}
-#endif
+    _cg_present_frame(canvas_current, canvas_previous, 0);
+}
 
-    return 0;
+uint64_t _cg_input_earliest(uint64_t a, uint64_t b)
+{
+    if (a == 0 || (b != 0 && b < a))
+    {
+        return b;
+    }
+    return a;
 }
 
-int _cg_term_flush_command_buffer(_cg_term_command_buffer_t *buffer)
+int _cg_present_frame(cg_canvas_t *frame, cg_canvas_t *base, uint64_t input)
 {
-    if (buffer == NULL)
+    // if the terminal has not taken the last frame yet, skip this one,
+    // the next frame is diffed against the last one written instead,
+    // and the input it showed is only shown by that one
+    _cg_mutex_lock(&_cg_out_lock);
+    _cg_output.input_unwritten = _cg_input_earliest(_cg_output.input_unwritten, input);
+    long pending = _cg_output_write_pending();
+    if (pending > 0)
     {
+        _cg_output.frames_skipped++;
+        _cg_output.stale = true;
+        _cg_mutex_unlock(&_cg_out_lock);
         return 0;
     }
-    if (buffer->length == 0)
+    _cg_output.stale = false;
+    _cg_mutex_unlock(&_cg_out_lock);
+
+    uint64_t start = _cg_now_nanos();
+    _cg_encode_job_t job;
+    job.current = frame;
+    job.previous = _cg_output.full_redraw ? NULL : base;
+    atomic_store(&job.cells_changed, 0);
+    _cg_output.full_redraw = false;
+
+    // split the rows in bands, each encoded into its own buffer
+    cg_uint h = frame->height;
+    cg_uint bands = 1;
+    if ((size_t)frame->width * h >= _CG_POOL_MIN_PARALLEL_CELLS)
     {
-        return 0;
+        bands = cg_get_worker_count() * _CG_ENCODE_BANDS_PER_WORKER;
+    }
+    if (bands > h)
+    {
+        bands = (h > 0) ? h : 1;
+    }
+    if (_cg_encode_reserve_bands(bands) == -1)
+    {
+        printf("FATAL Error: Unable to allocate encoder buffers.\n");
+        exit(-1);
+    }
+    job.band_rows = (h + bands - 1) / bands;
+    if (job.band_rows == 0)
+    {
+        job.band_rows = 1;
     }
+    bands = (h + job.band_rows - 1) / job.band_rows;
+    job.buffers = _cg_band_buffers;
 
-    // use simple fwrite instead of expensive puts and flush
-#if CG_PLATFORM_WINDOWS
-    // fwrite(buffer->buffer, 1, buffer->length, stdout);
-    DWORD written = 0;
-    BOOL ok = FALSE;
-    DWORD mode = 0;
+    _cg_pool_run(_cg_encode_band, &job, bands);
+    uint64_t encoded = _cg_now_nanos();
 
-    if (GetConsoleMode(_cg_gfx_context->_cg_hout, &mode))
+    // write any pending commands, then the bands in order, in one go
+    _cg_mutex_lock(&_cg_out_lock);
+    cg_uint count = 0;
+    size_t bytes = 0;
+    _cg_iovec_t *iov = _cg_frame_iov;
+    iov[count++] = (_cg_iovec_t){_cg_buffer->buffer, _cg_buffer->length};
+    iov[count++] = (_cg_iovec_t){"\033[?25l", 6};
+    for (cg_uint i = 0; i < bands; i++)
     {
-        // Real console: explicit ANSI variant avoids UNICODE macro issues
-        ok = WriteConsoleA(_cg_gfx_context->_cg_hout, buffer->buffer, (DWORD)buffer->length, &written, NULL);
+        iov[count++] = (_cg_iovec_t){_cg_band_buffers[i]->buffer, _cg_band_buffers[i]->length};
     }
-    else
+    iov[count++] = (_cg_iovec_t){"\033[?25h", 6};
+    // the bytes encoded, the terminal may take some of them later
+    for (cg_uint i = 0; i < count; i++)
     {
-        // Redirected/pipe/pseudoconsole path
-        ok = WriteFile(_cg_gfx_context->_cg_hout, buffer->buffer, (DWORD)buffer->length, &written, NULL);
+        bytes += iov[i].iov_len;
     }
+    _cg_term_write_iov(iov, (int)count);
 
-    if (!ok || written != (DWORD)buffer->length)
+    // the input is on screen once the terminal has taken all of it
+    input = _cg_output.input_unwritten;
+    _cg_output.input_unwritten = 0;
+    if (input != 0)
     {
-        return -1; // don't clear buffer on failure
+        if (_cg_output.pending != NULL && _cg_output.pending->length > 0)
+        {
+            _cg_output.input_writing = _cg_input_earliest(_cg_output.input_writing, input);
+        }
+        else
+        {
+            _cg_stats_record(CG_STAT_INPUT_LATENCY, _cg_now_nanos() - input);
+        }
     }
-#elif CG_PLATFORM_POSIX
-    fputs(buffer->buffer, stdout);
-    fflush(stdout);
-#endif
-    buffer->length = 0;
-    buffer->buffer[0] = '\0';
-    return 0;
-}
 
-void _cg_term_reset()
-{
-    // the [0m code resets all terminal attributes
-    _cg_term_buffer_command(_cg_buffer, "\033[0m", 4);
-}
+    _cg_buffer->length = 0;
+    _cg_buffer->buffer[0] = '\0';
+    _cg_mutex_unlock(&_cg_out_lock);
 
-void _cg_term_set_foreground_colour(cg_rgb_t colour)
-{
-    _cg_term_buffer_command(_cg_buffer, "\033[38;2;", 7);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.r & 0xFF].str, _cg_num_lookup[colour.r & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, ";", 1);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.g & 0xFF].str, _cg_num_lookup[colour.g & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, ";", 1);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.b & 0xFF].str, _cg_num_lookup[colour.b & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, "m", 1);
+    _cg_stats_record(CG_STAT_ENCODE, encoded - start);
+    _cg_stats_record(CG_STAT_WRITE, _cg_now_nanos() - encoded);
+    _cg_stats_record(CG_STAT_BYTES, bytes);
+    _cg_stats_record(CG_STAT_CELLS, atomic_load(&job.cells_changed));
+    return 1;
 }
 
-void _cg_term_set_background_colour(cg_rgb_t colour)
+void _cg_present_thread_main(void *arg)
 {
-    _cg_term_buffer_command(_cg_buffer, "\033[48;2;", 7);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.r & 0xFF].str, _cg_num_lookup[colour.r & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, ";", 1);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.g & 0xFF].str, _cg_num_lookup[colour.g & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, ";", 1);
-    _cg_term_buffer_command(_cg_buffer, _cg_num_lookup[colour.b & 0xFF].str, _cg_num_lookup[colour.b & 0xFF].len);
-    _cg_term_buffer_command(_cg_buffer, "m", 1);
-}
+    (void)arg;
 
-void _cg_term_move_to(cg_uint x, cg_uint y)
-{
-    cg_char buffer[20];
-    snprintf(buffer, 20, "\033[%lu;%luf", y + 1, x + 1);
-    _cg_term_buffer_command(_cg_buffer, buffer, 0);
-}
+    _cg_mutex_lock(&_cg_presenter.lock);
+    for (;;)
+    {
+        while (_cg_presenter.pending == NULL && !_cg_presenter.shutdown)
+        {
+            _cg_cond_wait(&_cg_presenter.cond, &_cg_presenter.lock);
+        }
+        if (_cg_presenter.pending == NULL)
+        {
+            // shutting down and every frame is written
+            break;
+        }
 
-void _cg_term_write_char(cg_char c)
-{
-    _cg_term_buffer_command(_cg_buffer, &c, 1);
-}
+        // let the terminal catch up first, newer frames replace the
+        // pending one in the meantime. On shutdown stop waiting, the
+        // frame is then skipped if the terminal is still behind. A
+        // stream is not waited on for longer than _CG_STREAM_STALL_MS
+        uint64_t waiting = _cg_now_nanos();
+        for (;;)
+        {
+            _cg_mutex_unlock(&_cg_presenter.lock);
+            int left = _cg_output_drain(_CG_DRAIN_STEP_MS);
+            bool stalled = (left == 1 && _cg_backend.ops->stream && _cg_now_nanos() - waiting >= (uint64_t)_CG_STREAM_STALL_MS * 1000000);
+            if (stalled)
+            {
+                _cg_output_abandon();
+            }
+            _cg_mutex_lock(&_cg_presenter.lock);
+            if (left != 1 || stalled || _cg_presenter.shutdown)
+            {
+                break;
+            }
+        }
 
-void _cg_hide_cursor()
-{
-    _cg_term_buffer_command(_cg_buffer, "\033[?25l", 6);
-}
+        cg_canvas_t *frame = _cg_presenter.pending;
+        cg_canvas_t *base = _cg_presenter.screen;
+        uint64_t input = _cg_presenter.pending_input;
+        _cg_presenter.pending = NULL;
+        _cg_presenter.pending_input = 0;
+        _cg_mutex_unlock(&_cg_presenter.lock);
 
-void _cg_show_cursor()
-{
-    _cg_term_buffer_command(_cg_buffer, "\033[?25h", 6);
+        int written = _cg_present_frame(frame, base, input);
+
+        // once written the frame is on screen and the old screen is free
+        // to draw on, a skipped frame is free to draw on right away
+        _cg_mutex_lock(&_cg_presenter.lock);
+        if (written)
+        {
+            _cg_presenter.screen = frame;
+            _cg_presenter.spare = base;
+        }
+        else
+        {
+            _cg_presenter.spare = frame;
+        }
+        _cg_cond_broadcast(&_cg_presenter.cond);
+    }
+    _cg_mutex_unlock(&_cg_presenter.lock);
 }
 
-#if CG_PLATFORM_WINDOWS
-int _cg_win_get_cursor_position(int *rows, int *cols)
+int _cg_present_start()
 {
-    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (h == INVALID_HANDLE_VALUE)
+    if (_cg_presenter.running)
+    {
+        return 0;
+    }
+    if (canvas_current == NULL || canvas_previous == NULL)
     {
         return -1;
     }
 
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(h, &csbi))
+    _cg_presenter.spare = cg_make_canvas(canvas_current->width, canvas_current->height);
+    _cg_presenter.screen = canvas_previous;
+    _cg_presenter.pending = NULL;
+    _cg_presenter.shutdown = false;
+    canvas_previous = NULL;
+
+    if (_cg_thread_start(&_cg_presenter.thread, _cg_present_thread_main, NULL) != 0)
     {
+        canvas_previous = _cg_presenter.screen;
+        cg_dispose_canvas(_cg_presenter.spare);
+        _cg_presenter.spare = NULL;
+        _cg_presenter.screen = NULL;
         return -1;
     }
+    _cg_presenter.running = true;
+    return 0;
+}
 
-    // Windows is 0-based
-    *rows = csbi.dwCursorPosition.Y + 1;
-    *cols = csbi.dwCursorPosition.X + 1;
+void _cg_present_stop()
+{
+    if (!_cg_presenter.running)
+    {
+        return;
+    }
 
-    return 0;
+    _cg_mutex_lock(&_cg_presenter.lock);
+    _cg_presenter.shutdown = true;
+    _cg_cond_broadcast(&_cg_presenter.cond);
+    _cg_mutex_unlock(&_cg_presenter.lock);
+    _cg_thread_join(_cg_presenter.thread);
+
+    // back to two canvases, the last frame written is the previous one
+    canvas_previous = _cg_presenter.screen;
+    cg_dispose_canvas(_cg_presenter.spare);
+    _cg_presenter.screen = NULL;
+    _cg_presenter.spare = NULL;
+    _cg_presenter.running = false;
+    _cg_presenter.shutdown = false;
 }
-#endif
 
-#if CG_PLATFORM_POSIX
-int _cg_posix_get_cursor_position(int *rows, int *cols)
+void _cg_present_handoff()
 {
-    char buf[32];
-    unsigned int i = 0;
-    if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
-        return -1;
-    while (i < sizeof(buf) - 1)
+    cg_canvas_t *frame = canvas_current;
+
+    _cg_mutex_lock(&_cg_presenter.lock);
+    if (_cg_presenter.pending != NULL)
     {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
-            break;
-        if (buf[i] == 'R')
-            break;
-        i++;
+        // the terminal is behind, replace the stale frame with this one
+        cg_canvas_t *stale = _cg_presenter.pending;
+        _cg_presenter.pending = frame;
+        _cg_presenter.pending_input = _cg_input_earliest(_cg_presenter.pending_input, _cg_stats.frame_input);
+        canvas_current = stale;
+        _cg_mutex_lock(&_cg_out_lock);
+        _cg_output.frames_skipped++;
+        _cg_mutex_unlock(&_cg_out_lock);
+    }
+    else
+    {
+        // only wait if the frame before is still being encoded
+        while (_cg_presenter.spare == NULL)
+        {
+            _cg_cond_wait(&_cg_presenter.cond, &_cg_presenter.lock);
+        }
+        _cg_presenter.pending = frame;
+        _cg_presenter.pending_input = _cg_stats.frame_input;
+        canvas_current = _cg_presenter.spare;
+        _cg_presenter.spare = NULL;
+        _cg_cond_broadcast(&_cg_presenter.cond);
+    }
+    _cg_mutex_unlock(&_cg_presenter.lock);
+
+    // the canvas handed back holds an older frame, start the next one
+    // from this one, as programs which draw over the last frame expect.
+    // The presentation thread only reads the frame, so this can overlap.
+    memcpy(canvas_current->cells, frame->cells, (size_t)frame->width * frame->height * sizeof(cg_cell_t));
+}
+
+void cg_set_present_thread(int enabled)
+{
+    _cg_presenter.enabled = (enabled != 0);
+    if (!_cg_presenter.enabled)
+    {
+        _cg_present_stop();
     }
-    buf[i] = '\0';
-    if (buf[0] != '\x1b' || buf[1] != '[')
-        return -1;
-    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2)
-        return -1;
-    return 0;
 }
-#endif
 
-int _cg_get_cursor_position(int *rows, int *cols)
+void cg_clear_canvas()
 {
-#if CG_PLATFORM_WINDOWS
-    return _cg_win_get_cursor_position(rows, cols);
-#elif CG_PLATFORM_POSIX
-    return _cg_posix_get_cursor_position(rows, cols);
-#endif
+    cg_background(default_bg_colour);
 }
 
-#if CG_PLATFORM_WINDOWS
-int _cg_win_get_window_size(int *rows, int *cols)
+void _cg_point_impl(cg_uint x1, cg_uint y1, const cg_char *c)
 {
-    HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (h == INVALID_HANDLE_VALUE)
+    if (canvas_current == NULL)
     {
-        return -1;
+        return;
     }
-
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(h, &csbi))
+    if (x1 >= canvas_current->width || y1 >= canvas_current->height)
     {
-        return -1;
+        return;
     }
+    cg_glyph_t glyph = (c != NULL) ? _cg_char_to_glyph(*c) : draw_glyph;
+    cg_cell_t *cell = cg_get_cell(canvas_current, x1, y1);
+    _cg_canvas_put(canvas_current, x1, y1, glyph, _cg_stroke_over(cell->fg), _cg_background_packed);
+}
 
-    SMALL_RECT win = csbi.srWindow;
-
-    *cols = win.Right - win.Left + 1;
-    *rows = win.Bottom - win.Top + 1;
+void cg_point(cg_uint x1, cg_uint y1)
+{
+    _cg_point_impl(x1, y1, NULL);
+}
 
-    return 0;
+void cg_point_char(cg_uint x1, cg_uint y1, cg_char c)
+{
+    _cg_point_impl(x1, y1, &c);
 }
-#endif
 
-#if CG_PLATFORM_POSIX
-int _cg_posix_get_window_size(int *rows, int *cols)
+void cg_point_glyph(cg_uint x1, cg_uint y1, cg_glyph_t glyph)
 {
-    struct winsize ws;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    if (canvas_current == NULL)
     {
-        if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
-            return -1;
-        return _cg_get_cursor_position(rows, cols);
+        return;
     }
-    else
+    if (x1 >= canvas_current->width || y1 >= canvas_current->height)
     {
-        *cols = ws.ws_col;
-        *rows = ws.ws_row;
-        return 0;
+        return;
     }
+    cg_cell_t *cell = cg_get_cell(canvas_current, x1, y1);
+    _cg_canvas_put(canvas_current, x1, y1, glyph, _cg_stroke_over(cell->fg), _cg_background_packed);
 }
-#endif
 
-int _cg_get_window_size(int *rows, int *cols)
+void cg_set_draw_char(cg_char c)
 {
-#if CG_PLATFORM_WINDOWS
-    return _cg_win_get_window_size(rows, cols);
-#elif CG_PLATFORM_POSIX
-    return _cg_posix_get_window_size(rows, cols);
-#endif
+    draw_glyph = _cg_char_to_glyph(c);
 }
 
-#if CG_PLATFORM_WINDOWS
-void _cg_win_read_key()
+cg_char cg_get_draw_char()
 {
-    _cg_gfx_context->key_counter = 0;
-    for (int i = 0; i < 128; i++)
+    if (draw_glyph < 128)
     {
-        _cg_gfx_context->keys_pressed[i].key = CG_KEY_NONE;
-        _cg_gfx_context->keys_pressed[i].char_value = '\0';
+        return (cg_char)draw_glyph;
     }
+    return '?';
+}
 
-    DWORD events = 0;
-    GetNumberOfConsoleInputEvents(_cg_gfx_context->_cg_hin, &events);
-
-    if (events > 0)
-    {
-        cg_uint read_count = 0;
-
-        while (events > 0 && read_count < 128)
-        {
-            INPUT_RECORD record;
-            DWORD read = 0;
-            ReadConsoleInput(_cg_gfx_context->_cg_hin, &record, 1, &read);
-            if (read == 0)
-            {
-                break;
-            }
+void cg_set_draw_glyph(cg_glyph_t glyph)
+{
+    draw_glyph = glyph;
+}
 
-            events--;
-            if (record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown)
-            {
-                continue;
-            }
+cg_glyph_t cg_get_draw_glyph()
+{
+    return draw_glyph;
+}
 
-            cg_key_type_t key = CG_KEY_UNKNOWN;
-            cg_char char_value = record.Event.KeyEvent.uChar.AsciiChar;
-            WORD vk = record.Event.KeyEvent.wVirtualKeyCode;
+void cg_line(cg_uint x1, cg_uint y1, cg_uint x2, cg_uint y2)
+{
+    // use bresenham's algorithm to draw the line
+    // will have to use integer values to ensure
+    // negative gradients are handled correctly
+    int dx = abs((int)x2 - (int)x1);
+    int sx = x1 < x2 ? 1 : -1;
 
-            switch (vk)
-            {
-            case VK_ESCAPE:
-                key = CG_KEY_ESCAPE;
-                break;
-            case VK_RETURN:
-                key = CG_KEY_ENTER;
-                break;
-            case VK_UP:
-                key = CG_KEY_UP;
-                break;
-            case VK_DOWN:
-                key = CG_KEY_DOWN;
-                break;
-            case VK_RIGHT:
-                key = CG_KEY_RIGHT;
-                break;
-            case VK_LEFT:
-                key = CG_KEY_LEFT;
-                break;
-            default:
-                if (char_value >= 32 && char_value <= 126)
-                {
-                    key = CG_KEY_ALPHANUM;
-                }
-                break;
-            }
+    int dy = -abs((int)y2 - (int)y1);
+    int sy = y1 < y2 ? 1 : -1;
 
-            _cg_gfx_context->keys_pressed[read_count].key = key;
-            _cg_gfx_context->keys_pressed[read_count].char_value = char_value;
-            read_count++;
-        }
-    }
-}
-#endif
+    int error = dx + dy;
 
-#if CG_PLATFORM_POSIX
-void _cg_posix_read_key()
-{
-    _cg_gfx_context->key_counter = 0;
-    for (int i = 0; i < 128; i++)
+    for (;;)
     {
-        _cg_gfx_context->keys_pressed[i].key = CG_KEY_NONE;
-        _cg_gfx_context->keys_pressed[i].char_value = '\0';
-    }
+        cg_point(x1, y1);
 
-    int read_count = 0;
-    while (1)
-    {
-        char c = '\0';
-        if (read(STDIN_FILENO, &c, 1) == -1 && errno != EAGAIN)
-        {
+        if (x1 == x2 && y1 == y2)
             break;
-        }
 
-        if (c == '\0')
-        {
-            break;
-        }
-        else if (c == _CG_TERM_KEY_ESCAPE)
+        int e2 = 2 * error;
+
+        if (e2 >= dy)
         {
-            char seq[3];
-            cg_key_type_t key = CG_KEY_ESCAPE;
-            cg_char char_value = c;
-            if (read(STDIN_FILENO, &seq[0], 1) == 1)
-            {
-                if (read(STDIN_FILENO, &seq[1], 1) == 1)
-                {
-                    if (seq[0] == '[')
-                    {
-                        switch (seq[1])
-                        {
-                        case 'A':
-                            key = CG_KEY_UP;
-                            break;
-                        case 'B':
-                            key = CG_KEY_DOWN;
-                            break;
-                        case 'C':
-                            key = CG_KEY_RIGHT;
-                            break;
-                        case 'D':
-                            key = CG_KEY_LEFT;
-                            break;
-                        }
-                    }
-                }
-            }
-            _cg_gfx_context->keys_pressed[read_count].key = key;
-            _cg_gfx_context->keys_pressed[read_count].char_value = char_value;
-            read_count++;
+            error += dy;
+            x1 += sx;
         }
-        else
+
+        if (e2 <= dx)
         {
-            if (c >= 32 && c <= 126)
-            {
-                _cg_gfx_context->keys_pressed[read_count].key = CG_KEY_ALPHANUM;
-            }
-            else
-            {
-                _cg_gfx_context->keys_pressed[read_count].key = CG_KEY_UNKNOWN;
-            }
-            _cg_gfx_context->keys_pressed[read_count].char_value = c;
-            read_count++;
+            error += dx;
+            y1 += sy;
         }
     }
 }
-#endif
 
-void _cg_read_key()
+void cg_rect(cg_uint x1, cg_uint y1, cg_uint width, cg_uint height)
 {
-#if CG_PLATFORM_WINDOWS
-    _cg_win_read_key();
-#elif CG_PLATFORM_POSIX
-    _cg_posix_read_key();
-#endif
+    x1 = cg_clamp(x1, 0, canvas_current->width - 1);
+    y1 = cg_clamp(y1, 0, canvas_current->height - 1);
+    width = cg_clamp(width, 0, canvas_current->width - x1);
+    height = cg_clamp(height, 0, canvas_current->height - y1);
+
+    cg_line(x1, y1, x1 + width, y1);
+    cg_line(x1 + width, y1, x1 + width, y1 + height);
+    cg_line(x1 + width, y1 + height, x1, y1 + height);
+    cg_line(x1, y1, x1, y1 + height);
 }
 
-// canvas functions
+void cg_text(cg_char *t, cg_uint x, cg_uint y)
+{
+    cg_text_n(t, strlen(t), x, y);
+}
 
-void cg_create_canvas(cg_uint w, cg_uint h)
+void cg_text_n(const cg_char *t, cg_uint len, cg_uint x, cg_uint y)
 {
-    if (canvas_current != NULL)
+    if (canvas_current == NULL || t == NULL)
     {
-        cg_dispose_canvas(canvas_current);
+        return;
     }
-    canvas_current = cg_make_canvas(w, h);
-    if (canvas_previous != NULL)
+    // clip to the canvas
+    if (y >= canvas_current->height || x >= canvas_current->width)
     {
-        cg_dispose_canvas(canvas_previous);
+        return;
     }
-    canvas_previous = cg_make_canvas(w, h);
 
-    width = w;
-    height = h;
-}
+    cg_uint w = canvas_current->width;
+    cg_cell_t *row = canvas_current->cells + (y * w);
+    cg_colour32_t fg = _cg_stroke_packed;
+    cg_colour32_t bg = _cg_background_packed;
+    bool blend = (stroke_alpha != 255 || blend_mode != CG_BLEND_NORMAL);
+    cg_uint col = x;
+    cg_uint i = 0;
 
-void cg_swap_canvas()
-{
-    cg_canvas_t *temp = canvas_current;
-    canvas_current = canvas_previous;
-    canvas_previous = temp;
-}
+    // a wide glyph cut by the left edge of the span loses its other half
+    _cg_canvas_break_wide(row, col, w);
 
-void cg_background(cg_rgb_t col)
-{
-    background_colour = col;
-    for (cg_uint x = 0; x < canvas_current->width; x++)
+    while (i < len && col < w)
     {
-        for (cg_uint y = 0; y < canvas_current->height; y++)
+        unsigned char c = (unsigned char)t[i];
+        if (c < 0x80 && (i + 1 >= len || (unsigned char)t[i + 1] < 0x80))
         {
-            cg_point_char(x, y, background_char);
+            // ascii goes straight into the row, unless a combining mark
+            // follows it
+            row[col].glyph = c;
+            row[col].fg = blend ? _cg_stroke_over(row[col].fg) : fg;
+            row[col].bg = bg;
+            col++;
+            i++;
+        }
+        else
+        {
+            int gw;
+            cg_uint n = _cg_utf8_grapheme(t + i, len - i, &gw);
+            cg_glyph_t glyph = _cg_intern_glyph_bytes(t + i, n, gw);
+            _cg_canvas_put(canvas_current, col, y, glyph,
+                           blend ? _cg_stroke_over(row[col].fg) : fg, bg);
+            col += cg_glyph_width(glyph);
+            i += n;
         }
     }
-}
 
-void cg_stroke(cg_rgb_t col)
-{
-    stroke_colour = col;
+    // same for a wide glyph cut by the right edge of the span
+    if (col < w && row[col].glyph == CG_GLYPH_CONTINUATION &&
+        cg_glyph_width(row[col - 1].glyph) != 2)
+    {
+        row[col].glyph = ' ';
+    }
 }
 
-void cg_fill(cg_rgb_t col)
+void cg_textf(cg_uint x, cg_uint y, const cg_char *fmt, ...)
 {
-    fill_colour = col;
+    cg_char buf[_CG_TEXTF_STACK_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0)
+    {
+        return;
+    }
+    if ((size_t)n < sizeof(buf))
+    {
+        cg_text_n(buf, (cg_uint)n, x, y);
+        return;
+    }
+
+    // too long for the stack, format again into the scratch buffer
+    if ((size_t)n + 1 > _cg_text_scratch_size)
+    {
+        cg_char *scratch = (cg_char *)_CG_REALLOC(_cg_text_scratch, (size_t)n + 1);
+        if (scratch == NULL)
+        {
+            // draw what fits on the stack
+            cg_text_n(buf, sizeof(buf) - 1, x, y);
+            return;
+        }
+        _cg_text_scratch = scratch;
+        _cg_text_scratch_size = (size_t)n + 1;
+    }
+    va_start(args, fmt);
+    vsnprintf(_cg_text_scratch, _cg_text_scratch_size, fmt, args);
+    va_end(args);
+    cg_text_n(_cg_text_scratch, (cg_uint)n, x, y);
 }
 
-void cg_set_colour(cg_rgb_t col)
+cg_colour32_t cg_rgb32(cg_uint r, cg_uint g, cg_uint b)
 {
-    cg_stroke(col);
-    cg_fill(col);
+    return _cg_pack_colour((cg_rgb_t){r, g, b});
 }
 
-void cg_show_canvas()
+void _cg_row_fix_wide(cg_cell_t *row, cg_uint x, cg_uint n, cg_uint w)
 {
-    _cg_hide_cursor();
-
-    cg_rgb_t current_bg = {300, 300, 300};
-    cg_rgb_t current_fg = {300, 300, 300};
-
-    cg_uint cursor_x, cursor_y;
-    bool cursor_valid;
-
-    if (canvas_current != NULL)
+    for (cg_uint i = x; i < x + n; i++)
     {
-        cursor_x = 0;
-        cursor_y = 0;
-        _cg_term_move_to(cursor_x, cursor_y);
-        cursor_valid = true;
-
-        for (cg_uint i = 0; i < canvas_current->height; i++)
+        cg_glyph_t glyph = row[i].glyph;
+        if (glyph < 128)
+        {
+            continue;
+        }
+        if (glyph == CG_GLYPH_CONTINUATION)
+        {
+            // only valid right after a wide glyph, which skips over it below
+            row[i].glyph = ' ';
+        }
+        else if (cg_glyph_width(glyph) == 2)
         {
-            for (cg_uint j = 0; j < canvas_current->width; j++)
+            if (i + 1 >= w)
             {
-                cg_cell_t *current_cell = cg_get_cell(canvas_current, j, i);
-
-#ifdef __CYGWIN__
-
-                cg_cell_t *previous_cell = cg_get_cell(canvas_previous, j, i);
-                if (cg_compare_cells(current_cell, previous_cell) == 0)
-                {
-                    cursor_valid = false;
-                    continue;
-                }
+                row[i].glyph = ' ';
+                continue;
+            }
+            if (i + 1 >= x + n)
+            {
+                _cg_canvas_break_wide(row, i + 1, w);
+            }
+            row[i + 1].glyph = CG_GLYPH_CONTINUATION;
+            row[i + 1].fg = row[i].fg;
+            row[i + 1].bg = row[i].bg;
+            i++;
+        }
+    }
+}
 
-#endif
+typedef struct
+{
+    cg_uint x, y, w, h;
+    cg_uint band; // rows per task
+    cg_shader_fn cell_fn;
+    cg_row_shader_fn row_fn;
+    void *userdata;
+} _cg_shade_job_t;
+
+void _cg_shade_band(void *ctx, cg_uint index)
+{
+    _cg_shade_job_t *job = (_cg_shade_job_t *)ctx;
+    cg_uint canvas_w = canvas_current->width;
+    cg_uint y0 = job->y + index * job->band;
+    cg_uint y1 = y0 + job->band;
+    if (y1 > job->y + job->h)
+    {
+        y1 = job->y + job->h;
+    }
 
-#if CG_PLATFORM_WINDOWS
-                cg_cell_t *previous_cell = cg_get_cell(canvas_previous, j, i);
-                if (cg_compare_cells(current_cell, previous_cell) == 0)
-                {
-                    cursor_valid = false;
-                    continue;
-                }
-#endif
+    for (cg_uint y = y0; y < y1; y++)
+    {
+        cg_cell_t *row = canvas_current->cells + (y * canvas_w);
 
-                // printf("Cells not equal at [%lu, %lu]\n", j, i);
+        // wide glyphs crossing the edges of the rectangle are cut
+        _cg_canvas_break_wide(row, job->x, canvas_w);
+        _cg_canvas_break_wide(row, job->x + job->w - 1, canvas_w);
 
-                // cg_no_loop();
+        if (job->row_fn != NULL)
+        {
+            job->row_fn(job->x, y, job->w, row + job->x, job->userdata);
+        }
+        else
+        {
+            for (cg_uint x = job->x; x < job->x + job->w; x++)
+            {
+                job->cell_fn(x, y, row + x, job->userdata);
+            }
+        }
 
-                // get the cell colours
-                cg_rgb_t cell_fg = cg_get_cell_fg(current_cell);
-                cg_rgb_t cell_bg = cg_get_cell_bg(current_cell);
-                // get the cell character
-                cg_char c = cg_get_cell_char(current_cell);
+        _cg_row_fix_wide(row, job->x, job->w, canvas_w);
+    }
+}
 
-                // move to the cell position if cursor not valid
-                if (!cursor_valid)
-                {
-                    cursor_x = j;
-                    cursor_y = i;
-                    cursor_valid = true;
-                    _cg_term_move_to(cursor_x, cursor_y);
-                }
+void _cg_shade_impl(cg_uint x, cg_uint y, cg_uint w, cg_uint h,
+                    cg_shader_fn cell_fn, cg_row_shader_fn row_fn, void *userdata)
+{
+    if (canvas_current == NULL || x >= canvas_current->width || y >= canvas_current->height)
+    {
+        return;
+    }
+    if (w > canvas_current->width - x)
+    {
+        w = canvas_current->width - x;
+    }
+    if (h > canvas_current->height - y)
+    {
+        h = canvas_current->height - y;
+    }
+    if (w == 0 || h == 0)
+    {
+        return;
+    }
 
-                // set the colours
-                if (cg_compare_colour(cell_fg, current_fg) != 0)
-                {
-                    _cg_term_set_foreground_colour(cell_fg);
-                    current_fg = cell_fg;
-                }
-                if (cg_compare_colour(cell_bg, current_bg) != 0)
-                {
-                    _cg_term_set_background_colour(cell_bg);
-                    current_bg = cell_bg;
-                }
+    _cg_shade_job_t job = {x, y, w, h, h, cell_fn, row_fn, userdata};
 
-                // write the character
-                _cg_term_write_char(c);
-            }
+    // split into bands of rows, a few per worker so uneven rows balance out
+    cg_uint tasks = 1;
+    if ((size_t)w * h >= _CG_POOL_MIN_PARALLEL_CELLS)
+    {
+        tasks = cg_get_worker_count() * _CG_POOL_TASKS_PER_WORKER;
+        if (tasks > h)
+        {
+            tasks = h;
         }
     }
+    job.band = (h + tasks - 1) / tasks;
+    tasks = (h + job.band - 1) / job.band;
 
-    _cg_term_flush_command_buffer(_cg_buffer);
+    _cg_pool_run(_cg_shade_band, &job, tasks);
+}
 
-    _cg_show_cursor();
+void cg_shade(cg_uint x, cg_uint y, cg_uint w, cg_uint h, cg_shader_fn fn, void *userdata)
+{
+    _cg_shade_impl(x, y, w, h, fn, NULL, userdata);
 }
 
-void cg_clear_canvas()
+void cg_shade_rows(cg_uint x, cg_uint y, cg_uint w, cg_uint h, cg_row_shader_fn fn, void *userdata)
 {
-    cg_background(default_bg_colour);
+    _cg_shade_impl(x, y, w, h, NULL, fn, userdata);
 }
 
-void _cg_point_impl(cg_uint x1, cg_uint y1, const cg_char *c)
+cg_keyboard_input_t cg_get_key_pressed()
 {
-    if (canvas_current == NULL)
+    // pick up keys which arrived since the frame started
+    if (_cg_gfx_context->key_counter == _cg_gfx_context->key_count && _cg_input.started)
     {
-        return;
+        cg_keyboard_input_t input;
+        if (_cg_input_ring_pop(&input))
+        {
+            _cg_input_push(input);
+        }
     }
-    if (x1 >= canvas_current->width || y1 >= canvas_current->height || x1 < 0 || y1 < 0)
+
+    // get key at the key counter
+    if (_cg_gfx_context->key_counter < _cg_gfx_context->key_count)
     {
-        return;
+        cg_keyboard_input_t inp = _cg_gfx_context->keys_pressed[_cg_gfx_context->key_counter];
+        _cg_gfx_context->key_counter++;
+        return inp;
     }
-    cg_cell_t *cell = cg_get_cell(canvas_current, x1, y1);
-    cg_char ch = (c != NULL) ? *c : draw_char;
-    cg_set_cell_char(cell, ch);
-    cg_set_cell_bg(cell, background_colour);
-    cg_set_cell_fg(cell, stroke_colour);
-    // printf("\033[%lu;%luf", y1, x1);
-    // printf("%c", ch);
+
+    // return a key with none value
+    return (cg_keyboard_input_t){.key = CG_KEY_NONE, .char_value = '\0'};
 }
 
-void cg_point(cg_uint x1, cg_uint y1)
+int cg_is_key_pressed(cg_key_type_t key)
 {
-    _cg_point_impl(x1, y1, NULL);
+    return _cg_keys_test(_cg_keys.pressed, _cg_key_type_code(key));
 }
 
-void cg_point_char(cg_uint x1, cg_uint y1, cg_char c)
+int cg_is_key_held(cg_key_type_t key)
 {
-    _cg_point_impl(x1, y1, &c);
+    return _cg_keys_test(_cg_keys.held, _cg_key_type_code(key));
 }
 
-void cg_set_draw_char(cg_char c)
+int cg_is_key_released(cg_key_type_t key)
 {
-    draw_char = c;
+    return _cg_keys_test(_cg_keys.released, _cg_key_type_code(key));
 }
 
-cg_char cg_get_draw_char()
+int cg_is_char_pressed(cg_char c)
 {
-    return draw_char;
+    cg_keyboard_input_t input = {.key = CG_KEY_ALPHANUM, .char_value = c};
+    return _cg_keys_test(_cg_keys.pressed, _cg_key_code(input));
 }
 
-void cg_line(cg_uint x1, cg_uint y1, cg_uint x2, cg_uint y2)
+int cg_is_char_held(cg_char c)
 {
-    // use bresenham's algorithm to draw the line
-    // will have to use integer values to ensure
-    // negative gradients are handled correctly
-    int dx = abs((int)x2 - (int)x1);
-    int sx = x1 < x2 ? 1 : -1;
+    cg_keyboard_input_t input = {.key = CG_KEY_ALPHANUM, .char_value = c};
+    return _cg_keys_test(_cg_keys.held, _cg_key_code(input));
+}
 
-    int dy = -abs((int)y2 - (int)y1);
-    int sy = y1 < y2 ? 1 : -1;
+int cg_is_char_released(cg_char c)
+{
+    cg_keyboard_input_t input = {.key = CG_KEY_ALPHANUM, .char_value = c};
+    return _cg_keys_test(_cg_keys.released, _cg_key_code(input));
+}
 
-    int error = dx + dy;
+void cg_set_key_repeat(cg_uint delay_ms, cg_uint interval_ms)
+{
+    _cg_keys.repeat_delay = (uint64_t)delay_ms * 1000000ULL;
+    _cg_keys.repeat_interval = (uint64_t)interval_ms * 1000000ULL;
+}
 
-    for (;;)
+int _cg_key_code(cg_keyboard_input_t input)
+{
+    if (input.key == CG_KEY_ALPHANUM)
     {
-        cg_point(x1, y1);
-
-        if (x1 == x2 && y1 == y2)
-            break;
-
-        int e2 = 2 * error;
-
-        if (e2 >= dy)
+        unsigned char c = (unsigned char)input.char_value;
+        if (c >= 128)
         {
-            error += dy;
-            x1 += sx;
+            return -1;
         }
+        return _CG_KEY_CHAR_BASE + tolower(c);
+    }
+    if (input.key == CG_KEY_NONE || input.key == CG_KEY_UNKNOWN || input.key == CG_KEY_MOUSE)
+    {
+        return -1;
+    }
+    return (int)input.key;
+}
 
-        if (e2 <= dx)
-        {
-            error += dx;
-            y1 += sy;
-        }
+int _cg_key_type_code(cg_key_type_t key)
+{
+    if (key == CG_KEY_ALPHANUM)
+    {
+        return (int)key;
     }
+    cg_keyboard_input_t input = {.key = key};
+    return _cg_key_code(input);
 }
 
-void cg_rect(cg_uint x1, cg_uint y1, cg_uint width, cg_uint height)
+int _cg_keys_test(const uint64_t *bits, int code)
 {
-    x1 = cg_clamp(x1, 0, canvas_current->width - 1);
-    y1 = cg_clamp(y1, 0, canvas_current->height - 1);
-    width = cg_clamp(width, 0, canvas_current->width - x1);
-    height = cg_clamp(height, 0, canvas_current->height - y1);
+    if (code < 0)
+    {
+        return 0;
+    }
+    return (bits[code >> 6] >> (code & 63)) & 1;
+}
 
-    cg_line(x1, y1, x1 + width, y1);
-    cg_line(x1 + width, y1, x1 + width, y1 + height);
-    cg_line(x1 + width, y1 + height, x1, y1 + height);
-    cg_line(x1, y1, x1, y1 + height);
+int _cg_ctz64(uint64_t bits)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
 }
 
-void cg_text(cg_char *t, cg_uint x, cg_uint y)
+void _cg_keys_update(cg_keyboard_input_t *input)
 {
-    cg_uint len = strlen(t);
-    if (len > 0)
+    int code = _cg_key_code(*input);
+    if (code < 0)
+    {
+        return;
+    }
+    uint64_t bit = 1ULL << (code & 63);
+    cg_uint word = (cg_uint)code >> 6;
+    bool held = (_cg_keys.held[word] & bit) != 0;
+
+    int any = (int)CG_KEY_ALPHANUM;
+    uint64_t any_bit = 1ULL << (any & 63);
+    cg_uint any_word = (cg_uint)any >> 6;
+    bool is_char = (input->key == CG_KEY_ALPHANUM);
+
+    if (input->action == CG_KEY_RELEASE)
+    {
+        if (held)
+        {
+            _cg_keys.held[word] &= ~bit;
+            _cg_keys.released[word] |= bit;
+        }
+        if (is_char && (_cg_keys.held[any_word] & any_bit) != 0 && !_cg_keys_chars_held())
+        {
+            _cg_keys.held[any_word] &= ~any_bit;
+            _cg_keys.released[any_word] |= any_bit;
+        }
+        return;
+    }
+
+    if (held && input->action == CG_KEY_PRESS)
+    {
+        input->action = CG_KEY_REPEAT;
+    }
+    if (!_cg_keys.releases)
     {
-        for (cg_uint i = 0; i < len; i++)
+        // held until the next repeat is overdue, any character key
+        // until the last one is
+        uint64_t wait = held ? _cg_keys.repeat_interval : _cg_keys.repeat_delay;
+        _cg_keys.deadline[code] = _cg_now_nanos() + wait;
+        if (is_char && _cg_keys.deadline[any] < _cg_keys.deadline[code])
         {
-            _cg_point_impl(x + i, y, &t[i]);
+            _cg_keys.deadline[any] = _cg_keys.deadline[code];
         }
     }
+    _cg_keys.held[word] |= bit;
+    _cg_keys.pressed[word] |= bit;
+    if (is_char)
+    {
+        _cg_keys.held[any_word] |= any_bit;
+        _cg_keys.pressed[any_word] |= any_bit;
+    }
 }
 
-cg_keyboard_input_t cg_get_key_pressed()
+bool _cg_keys_chars_held()
 {
-    // get key at the key counter
-    if (_cg_gfx_context->key_counter < 128)
+    for (int c = 0; c < 128; c++)
     {
-        cg_keyboard_input_t inp = _cg_gfx_context->keys_pressed[_cg_gfx_context->key_counter];
-        _cg_gfx_context->key_counter++;
-        return inp;
+        if (_cg_keys_test(_cg_keys.held, _CG_KEY_CHAR_BASE + c))
+        {
+            return true;
+        }
     }
-
-    // return a key with none value
-    return (cg_keyboard_input_t){CG_KEY_NONE, '\0'};
+    return false;
 }
 
-int cg_is_key_pressed(cg_key_type_t key)
+void _cg_keys_begin_frame()
 {
-    if (_cg_gfx_context == NULL)
+    memset(_cg_keys.pressed, 0, sizeof(_cg_keys.pressed));
+    memset(_cg_keys.released, 0, sizeof(_cg_keys.released));
+
+    // the terminal supports the kitty protocol, ask it for releases
+    if (!_cg_keys.kitty && atomic_load(&_cg_keys.kitty_detected))
     {
-        return 0;
+        _cg_term_buffer_command(_cg_buffer, "\033[>" _CG_KITTY_FLAGS "u", 0);
+        _cg_keys.kitty = true;
+        _cg_keys.releases = true;
     }
-    cg_uint count = 0;
-    while (count < 128)
+    if (_cg_keys.releases)
     {
-        cg_keyboard_input_t inp = _cg_gfx_context->keys_pressed[count];
-        if (inp.key == CG_KEY_NONE)
-        {
-            break;
-        }
-        if (inp.key == key)
+        return;
+    }
+
+    uint64_t now = _cg_now_nanos();
+    for (cg_uint w = 0; w < _CG_KEY_WORDS; w++)
+    {
+        uint64_t bits = _cg_keys.held[w];
+        while (bits != 0)
         {
-            return 1;
+            int b = _cg_ctz64(bits);
+            bits &= bits - 1;
+            cg_uint code = w * 64 + (cg_uint)b;
+            if (_cg_keys.deadline[code] <= now)
+            {
+                _cg_keys.held[w] &= ~(1ULL << b);
+                _cg_keys.released[w] |= 1ULL << b;
+            }
         }
-        count++;
     }
-    return 0;
 }
 
 void _cg_clock_get_time(struct timespec *t)
@@ -1902,6 +8648,9 @@ int cg_create_graphics(cg_uint w, cg_uint h)
     // initialize number to string lookup table
     _cg_init_num_lookup();
 
+    // initialize the glyph table
+    _cg_init_glyph_table();
+
     // allocate the graphics context
     _cg_gfx_context = (_cg_graphics_context_t *)_CG_CALLOC(1, sizeof(_cg_graphics_context_t));
 
@@ -1919,12 +8668,20 @@ int cg_create_graphics(cg_uint w, cg_uint h)
     _cg_clock_get_time(&(_cg_gfx_context->start_time));
     _cg_gfx_context->prev_time = _cg_gfx_context->start_time;
     _cg_gfx_context->current_time = _cg_gfx_context->start_time;
-    _cg_gfx_context->should_exit = 0;
+    atomic_store(&_cg_gfx_context->should_exit, 0);
 
-    _cg_gfx_context->delta_time_ideal = 1000000 / _fps; // in microseconds
+    _cg_gfx_context->frame_period = (_fps > 0) ? 1000000000ULL / _fps : 0;
+    _cg_gfx_context->frame_deadline = _cg_time_nanos(_cg_gfx_context->start_time);
+    _cg_gfx_context->step_period = (_step_hz > 0) ? 1000000000ULL / _step_hz : 0;
 
     // init random numbers
     srand(time(NULL));
+    if (!_cg_rand_seeded)
+    {
+        // not reproducible unless seeded with cg_seed_random
+        _cg_rand_seed = (uint64_t)time(NULL) ^ _cg_now_nanos();
+        atomic_fetch_add(&_cg_rand_generation, 1);
+    }
 
     // create the command buffer
     if (_cg_term_create_command_buffer(&_cg_buffer) == -1)
@@ -1933,8 +8690,24 @@ int cg_create_graphics(cg_uint w, cg_uint h)
         return -1;
     }
 
-    // enable raw mode for terminal
-    _cg_term_enable_raw_mode();
+    // the channel which wakes the event driven loop
+    if (_cg_events_open() == -1)
+    {
+        printf("FATAL Error: Unable to create the event loop wake up channel.\n");
+        return -1;
+    }
+
+    // enable raw mode for terminal, or make the stream non-blocking
+    atomic_store(&_cg_backend.hung_up, false);
+    if (_cg_backend.ops->begin() == -1)
+    {
+        printf("FATAL Error: Unable to set up the output.\n");
+        return -1;
+    }
+    if (_cg_mouse.mode != CG_MOUSE_OFF)
+    {
+        _cg_mouse_apply(_cg_mouse.mode);
+    }
 
     // get the window size
     int rows, cols;
@@ -1956,6 +8729,14 @@ int cg_create_graphics(cg_uint w, cg_uint h)
     setlocale(LC_ALL, "");
     // fwide(stdout, 1);
 
+    // set default background and forground, and clear the screen before
+    // the first canvas is drawn over it
+    _cg_term_reset();
+    _cg_term_set_foreground_colour(_cg_pack_colour(default_fg_colour));
+
+    cg_cls();
+    cg_home();
+
     // if there is no canvas created, create a default one
     if (canvas_current == NULL)
     {
@@ -1982,12 +8763,13 @@ int cg_create_graphics(cg_uint w, cg_uint h)
         cg_set_colour(default_fg_colour);
     }
 
-    // set default background and forground
-    _cg_term_reset();
-    _cg_term_set_foreground_colour(default_fg_colour);
+#if CG_PLATFORM_POSIX
+    // ask for the kitty keyboard protocol, turned on when it answers
+    _cg_term_buffer_command(_cg_buffer, "\033[?u", 0);
 
-    cg_cls();
-    cg_home();
+    // have pastes marked, so they come as one input
+    _cg_term_buffer_command(_cg_buffer, "\033[?2004h", 0);
+#endif
 
     return 0;
 }
@@ -1999,15 +8781,36 @@ int cg_create_graphics_fullscreen()
 
 void cg_begin_draw()
 {
+    _cg_stats.mark = _cg_now_nanos();
     _cg_gfx_context->dt = _diff_time_micros(_cg_gfx_context->current_time, _cg_gfx_context->prev_time);
 
+    // hand the frame time out in fixed steps
+    if (_cg_gfx_context->step_period > 0)
+    {
+        uint64_t max = _cg_gfx_context->step_period * _CG_MAX_STEPS_PER_FRAME;
+        _cg_gfx_context->step_accumulator += _cg_time_nanos(_cg_gfx_context->current_time) - _cg_time_nanos(_cg_gfx_context->prev_time);
+        if (_cg_gfx_context->step_accumulator > max)
+        {
+            _cg_gfx_context->step_accumulator = max;
+        }
+    }
+
+    if (_cg_input.enabled)
+    {
+        _cg_input_start();
+    }
     _cg_read_key();
 
+    // data which arrived on the watched fds
+    _cg_events_dispatch(0);
+
     // if the key pressed is ESC, then return -1 to exit
     if (cg_is_key_pressed(CG_KEY_ESCAPE))
     {
         cg_exit_graphics();
     }
+
+    _cg_stats_phase(CG_STAT_BEGIN);
 }
 
 void cg_end_draw()
@@ -2023,34 +8826,86 @@ void cg_end_draw()
     //     cg_text(key_str, 0, key_count);
     // }
 
-    // show the canvas
-    cg_show_canvas();
+    _cg_stats_phase(CG_STAT_DRAW);
+
+    // every job of this frame must be done before it is shown
+    cg_wait_jobs();
+    _cg_stats_phase(CG_STAT_JOBS);
+
+    // show the canvas, or hand it to the presentation thread
+    bool presented = false;
+    bool skipped = false;
+    if (_cg_presenter.enabled && _cg_present_start() == 0)
+    {
+        _cg_present_handoff();
+        presented = true;
+    }
+    else
+    {
+        skipped = !_cg_present_frame(canvas_current, canvas_previous, _cg_stats.frame_input);
+    }
+    _cg_stats.frame_input = 0;
 
     // how much time spent
     _cg_clock_get_time(&(_cg_gfx_context->after_draw_time));
-    cg_uint dt_done = _diff_time_micros(_cg_gfx_context->after_draw_time, _cg_gfx_context->current_time);
-    // printf("Delta ideal %lu, Delta done %lu\n", delta_time_ideal, dt_done);
-    if (_cg_gfx_context->delta_time_ideal > dt_done)
-    {
-        struct timespec dt_diff, dt_diff_rem;
-        dt_diff.tv_sec = 0;
-        dt_diff.tv_nsec = (_cg_gfx_context->delta_time_ideal - dt_done) * 1000;
-        // sleep for the difference
-        //  printf("sleep for -> [%ld]nanos\n", dt_diff.tv_nsec);
-#if CG_PLATFORM_WINDOWS
-        _cg_win_nanosleep(&dt_diff, &dt_diff_rem);
-#elif CG_PLATFORM_POSIX
-        nanosleep(&dt_diff, &dt_diff_rem);
-#endif
+    _cg_stats.mark = _cg_time_nanos(_cg_gfx_context->after_draw_time);
+    if (_cg_gfx_context->frame_period > 0)
+    {
+        // the frame ends one period after the last one was due, not one
+        // period after it actually ended, so oversleeping does not add up
+        uint64_t now = _cg_time_nanos(_cg_gfx_context->after_draw_time);
+        uint64_t deadline = _cg_gfx_context->frame_deadline + _cg_gfx_context->frame_period;
+        if (deadline + _cg_gfx_context->frame_period < now)
+        {
+            // more than a frame behind, start over rather than rush
+            deadline = now;
+        }
+        _cg_gfx_context->frame_deadline = deadline;
+
+        if (deadline > now && !presented && cg_get_output_pending() > 0)
+        {
+            // feed a backed up terminal while waiting for the next frame
+            _cg_output_drain((int)((deadline - now) / 1000000));
+        }
+        // serve the watched fds while waiting, once, an fd which stays
+        // ready is served again in cg_begin_draw. Poll only has
+        // millisecond precision, so sleep the rest of the way
+        while (_cg_events.watch_count > 0)
+        {
+            now = _cg_now_nanos();
+            if (now + 1000000 > deadline)
+            {
+                break;
+            }
+            if (_cg_events_dispatch((int)((deadline - now) / 1000000)) > 0)
+            {
+                // the event driven loop has something new to draw
+                atomic_store(&_cg_events.redraw, true);
+                break;
+            }
+        }
+        _cg_sleep_until(deadline);
+    }
+
+    // in the event driven loop, wait for something to draw
+    if (!_loop)
+    {
+        _cg_events_wait();
     }
 
     _cg_gfx_context->prev_time = _cg_gfx_context->current_time;
     _cg_clock_get_time(&(_cg_gfx_context->current_time));
+    _cg_stats_phase(CG_STAT_SLEEP);
+    _cg_stats_record(CG_STAT_FRAME, _cg_time_nanos(_cg_gfx_context->current_time) - _cg_time_nanos(_cg_gfx_context->prev_time));
     // dt_done = _diff_time_micros(current_time, prev_time);
     // printf("After sleep: Delta ideal %lu, Delta done %lu\n", delta_time_ideal, dt_done);
 
-    // swap canvas
-    cg_swap_canvas();
+    // swap canvas, the presentation thread already gave us a new one,
+    // a skipped frame keeps the previous canvas as the one last written
+    if (!presented && !skipped)
+    {
+        cg_swap_canvas();
+    }
 
     // flush the command buffer
     _cg_term_flush_command_buffer(_cg_buffer);
@@ -2058,22 +8913,140 @@ void cg_end_draw()
 
 void cg_destroy_graphics()
 {
-    // free the graphics context
-    if (_cg_gfx_context != NULL)
+    // write the last frames and stop the presentation thread
+    _cg_present_stop();
+
+    // stop reading input
+    _cg_input_stop();
+    _cg_events_close();
+
+    // stop the terminal reporting the mouse
+    if (_cg_mouse.mode != CG_MOUSE_OFF)
     {
-        _CG_FREE(_cg_gfx_context);
+        _cg_mouse_apply(CG_MOUSE_OFF);
     }
 
-    // flush the command buffer
+#if CG_PLATFORM_POSIX
+    _cg_term_buffer_command(_cg_buffer, "\033[?2004l", 0);
+    if (_cg_input_parser.paste != NULL)
+    {
+        _CG_FREE(_cg_input_parser.paste);
+        _cg_input_parser.paste = NULL;
+        _cg_input_parser.paste_capacity = 0;
+    }
+    _cg_input_parser.in_paste = false;
+#endif
+
+    // go back to the keyboard protocol the terminal had
+    if (_cg_keys.kitty)
+    {
+        _cg_term_buffer_command(_cg_buffer, "\033[<u", 0);
+        _cg_keys.kitty = false;
+        _cg_keys.releases = false;
+        atomic_store(&_cg_keys.kitty_detected, false);
+    }
+
+    // flush the command buffer, and wait for the terminal to take it
+    // all, output it does not take in time is dropped with the buffers
     _cg_term_flush_command_buffer(_cg_buffer);
+    if (_cg_output_drain(_CG_SHUTDOWN_DRAIN_MS) == 1)
+    {
+        _cg_output_abandon();
+    }
+
+    // give the terminal or the stream its settings back now, it may be
+    // a pty which is closed before the program exits
+    _cg_backend.ops->end();
+
+    // free the graphics context, only now as writing to the console
+    // on Windows goes through its handle
+    if (_cg_gfx_context != NULL)
+    {
+        if (_cg_gfx_context->keys_pressed != NULL)
+        {
+            _cg_input_free_pastes(_cg_gfx_context->keys_pressed, _cg_gfx_context->key_count);
+            _CG_FREE(_cg_gfx_context->keys_pressed);
+        }
+        _CG_FREE(_cg_gfx_context);
+        _cg_gfx_context = NULL;
+    }
 
-    // dispose of the command buffer
+    // dispose of the command buffers
     _cg_term_dispose_command_buffer(_cg_buffer);
+    if (_cg_output.pending != NULL)
+    {
+        _cg_term_dispose_command_buffer(_cg_output.pending);
+        _cg_output.pending = NULL;
+    }
+
+    // finish the remaining jobs and stop the worker threads
+    cg_wait_jobs();
+    _cg_pool_stop();
+    if (_cg_pool.inject.tasks != NULL)
+    {
+        _CG_FREE(_cg_pool.inject.tasks);
+        _cg_pool.inject.tasks = NULL;
+        _cg_pool.inject.capacity = 0;
+    }
+    for (cg_uint i = 0; i < _cg_jobs.page_count; i++)
+    {
+        for (cg_uint k = 0; k < _CG_JOB_PAGE_SIZE; k++)
+        {
+            if (_cg_jobs.pages[i][k].dependents != NULL)
+            {
+                _CG_FREE(_cg_jobs.pages[i][k].dependents);
+            }
+        }
+        _CG_FREE(_cg_jobs.pages[i]);
+    }
+    _cg_jobs.page_count = 0;
+    _cg_jobs.free_head = 0;
+
+    // free the frame encoder buffers
+    for (cg_uint i = 0; i < _cg_band_buffer_count; i++)
+    {
+        _cg_term_dispose_command_buffer(_cg_band_buffers[i]);
+    }
+    if (_cg_band_buffers != NULL)
+    {
+        _CG_FREE(_cg_band_buffers);
+    }
+    _cg_band_buffers = NULL;
+    _cg_band_buffer_count = 0;
+    if (_cg_frame_iov != NULL)
+    {
+        _CG_FREE(_cg_frame_iov);
+    }
+    _cg_frame_iov = NULL;
+
+    // free the formatted text scratch buffer
+    if (_cg_text_scratch != NULL)
+    {
+        _CG_FREE(_cg_text_scratch);
+        _cg_text_scratch = NULL;
+        _cg_text_scratch_size = 0;
+    }
+
+    // the next graphics may be for another terminal, of another size
+    if (canvas_current != NULL)
+    {
+        cg_dispose_canvas(canvas_current);
+        canvas_current = NULL;
+    }
+    if (canvas_previous != NULL)
+    {
+        cg_dispose_canvas(canvas_previous);
+        canvas_previous = NULL;
+    }
+
+    // the recording ends with the last output
+    cg_record_stop();
 }
 
 void cg_exit_graphics()
 {
-    _cg_gfx_context->should_exit = 1;
+    atomic_store(&_cg_gfx_context->should_exit, 1);
+    _cg_events_wake();
 }
 
 int cg_should_exit()
@@ -2082,7 +9055,7 @@ int cg_should_exit()
     {
         return 1;
     }
-    return _cg_gfx_context->should_exit;
+    return (int)atomic_load(&_cg_gfx_context->should_exit);
 }
 
 cg_uint cg_get_deltatime_micros()
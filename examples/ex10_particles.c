@@ -0,0 +1,137 @@
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
+
+#define NUM_PARTICLES 50000
+
+typedef struct
+{
+    float x, y;
+    float vx, vy;
+} particle_t;
+
+typedef struct
+{
+    particle_t *particles;
+    cg_uint count;
+    float dt;              // frame time in seconds
+    cg_uint *density;      // particles in every cell
+    cg_uint w, h;          // size of the density grid
+} world_t;
+
+// move a range of particles, runs on the worker threads
+void update_particles(cg_uint begin, cg_uint end, void *userdata)
+{
+    world_t *world = (world_t *)userdata;
+
+    for (cg_uint i = begin; i < end; i++)
+    {
+        particle_t *p = &world->particles[i];
+        p->vy += 20.0f * world->dt;
+        p->x += p->vx * world->dt;
+        p->y += p->vy * world->dt;
+
+        if (p->x < 0.0f || p->x >= world->w)
+        {
+            p->vx = -p->vx;
+            p->x = (p->x < 0.0f) ? 0.0f : world->w - 0.01f;
+        }
+        if (p->y < 0.0f || p->y >= world->h)
+        {
+            p->vy = -p->vy * 0.9f;
+            p->y = (p->y < 0.0f) ? 0.0f : world->h - 0.01f;
+        }
+    }
+}
+
+// the update job, splits the particles over all the workers
+void update_job(void *userdata)
+{
+    world_t *world = (world_t *)userdata;
+    cg_parallel_for(world->count, 0, update_particles, world);
+}
+
+// count the particles in every cell, runs once the update is done
+void density_job(void *userdata)
+{
+    world_t *world = (world_t *)userdata;
+
+    memset(world->density, 0, world->w * world->h * sizeof(cg_uint));
+    for (cg_uint i = 0; i < world->count; i++)
+    {
+        cg_uint cx = (cg_uint)world->particles[i].x;
+        cg_uint cy = (cg_uint)world->particles[i].y;
+        world->density[cy * world->w + cx]++;
+    }
+}
+
+// colour a cell by the number of particles in it
+void density_shader(cg_uint x, cg_uint y, cg_cell_t *cell, void *userdata)
+{
+    world_t *world = (world_t *)userdata;
+    cg_uint n = world->density[y * world->w + x];
+    cg_uint heat = (n * 16 > 255) ? 255 : n * 16;
+
+    cell->glyph = (n > 0) ? '*' : ' ';
+    cell->fg = cg_rgb32(255, 255 - heat, 64);
+    cell->bg = cg_rgb32(heat / 4, 0, heat / 2);
+}
+
+int main(int argc, char *argv[])
+{
+    world_t world = {0};
+
+    cg_frame_rate(60);
+
+    // create the graphics engine
+    int err = cg_create_graphics_fullscreen();
+    if (err != 0)
+    {
+        return err;
+    }
+
+    world.w = width;
+    world.h = height - 1;
+    world.count = NUM_PARTICLES;
+    world.particles = (particle_t *)calloc(world.count, sizeof(particle_t));
+    world.density = (cg_uint *)calloc(world.w * world.h, sizeof(cg_uint));
+    if (world.particles == NULL || world.density == NULL)
+    {
+        printf("Unable to allocate particles.\n");
+        exit(-1);
+    }
+
+    for (cg_uint i = 0; i < world.count; i++)
+    {
+        world.particles[i].x = cg_rand_int(0, world.w - 1);
+        world.particles[i].y = cg_rand_int(0, world.h / 2);
+        world.particles[i].vx = cg_rand_int(-20, 20);
+        world.particles[i].vy = cg_rand_int(-10, 10);
+    }
+
+    while (!cg_should_exit())
+    {
+        // begin the draw
+        cg_begin_draw();
+
+        // update the particles, then count them per cell
+        world.dt = cg_get_deltatime() / 1000.0f;
+        cg_job_t update = cg_job_submit(update_job, &world, NULL, 0);
+        cg_job_t density = cg_job_submit(density_job, &world, &update, 1);
+
+        // draw once the counts are in
+        cg_job_wait(density);
+        cg_shade(0, 0, world.w, world.h, density_shader, &world);
+
+        // print press escape to exit
+        cg_textf(0, height - 1, "Press ESC to exit, %lu particles, %lu threads", world.count, cg_get_worker_count());
+
+        // end the draw
+        cg_end_draw();
+    }
+
+    // destroy the graphics engine
+    cg_destroy_graphics();
+
+    free(world.particles);
+    free(world.density);
+}
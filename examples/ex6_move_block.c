@@ -7,8 +7,6 @@ int main(int argc, char *argv[])
     cg_uint block_y = 0;
     cg_uint block_width = 5;
     cg_uint block_height = 5;
-    cg_string block_location_str = cg_make_string(1024);
-    block_location_str[0] = '\0';
 
     // create the graphics engine
     int err = cg_create_graphics_fullscreen();
@@ -20,8 +18,6 @@ int main(int argc, char *argv[])
     block_x = width / 2 - block_width / 2;
     block_y = height / 2 - block_height / 2;
 
-    snprintf(block_location_str, 1024, "Block Location: (%lu, %lu)", block_x, block_y);
-
     while (!cg_should_exit())
     {
         // begin the draw
@@ -37,7 +33,7 @@ int main(int argc, char *argv[])
         cg_text("Press ESC to exit", 0, height - 1);
 
         // print the block location
-        cg_text(block_location_str, 0, height - 2);
+        cg_textf(0, height - 2, "Block Location: (%lu, %lu)", block_x, block_y);
 
         // show usage message
         cg_text("Use arrow keys to move the block, 'r' to reset.", 0, 0);
@@ -78,9 +74,6 @@ int main(int argc, char *argv[])
                 block_x = width / 2 - block_width / 2;
                 block_y = height / 2 - block_height / 2;
             }
-
-            // print the block location
-            snprintf(block_location_str, 1024, "Block Location: (%lu, %lu)", block_x, block_y);
         }
     }
 
@@ -2,12 +2,6 @@
 #define CONGFX_IMPLEMENTATION
 #include "congfx.h"
 
-// get random int between min and max inclusive
-int rand_between(int min, int max)
-{
-    return (rand() % (max - min + 1)) + min;
-}
-
 int main(int argc, char *argv[])
 {
     cg_rgb_t bg_colour = {0, 0, 0};
@@ -21,6 +15,14 @@ int main(int argc, char *argv[])
         return err;
     }
 
+    // random colours for the whole screen, made in one go every frame
+    uint32_t *noise = (uint32_t *)calloc(width * height, sizeof(uint32_t));
+    if (noise == NULL)
+    {
+        printf("Unable to allocate noise buffer.\n");
+        exit(-1);
+    }
+
     while (!cg_should_exit())
     {
         // begin the draw
@@ -29,11 +31,13 @@ int main(int argc, char *argv[])
         // clear the background
         cg_background(bg_colour);
 
-        for (int i = 0; i < width; i++)
+        cg_rand_fill(noise, width * height);
+        for (int j = 0; j < height; j++)
         {
-            for (int j = 0; j < height; j++)
+            for (int i = 0; i < width; i++)
             {
-                cg_stroke((cg_rgb_t){rand_between(0, 255), rand_between(0, 255), rand_between(0, 255)});
+                uint32_t c = noise[j * width + i];
+                cg_stroke((cg_rgb_t){c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF});
                 cg_point(i, j);
             }
         }
@@ -50,4 +54,6 @@ int main(int argc, char *argv[])
 
     // destroy the graphics engine
     cg_destroy_graphics();
+
+    free(noise);
 }
@@ -0,0 +1,79 @@
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
+
+int main(int argc, char *argv[])
+{
+    cg_uint total_time = 0; // total time in millis
+    cg_uint frame = 0;      // animation frame of the spinner
+
+    // braille spinner frames
+    const cg_char *spinner[] = {"⠋", "⠙", "⠹", "⠸", "⠼", "⠴", "⠦", "⠧", "⠇", "⠏"};
+
+    // create the graphics engine
+    int err = cg_create_graphics_fullscreen();
+    if (err != 0)
+    {
+        return err;
+    }
+
+    // intern the box drawing glyphs once
+    cg_glyph_t horizontal = cg_intern_glyph("─");
+    cg_glyph_t vertical = cg_intern_glyph("│");
+    cg_glyph_t top_left = cg_intern_glyph("┌");
+    cg_glyph_t top_right = cg_intern_glyph("┐");
+    cg_glyph_t bottom_left = cg_intern_glyph("└");
+    cg_glyph_t bottom_right = cg_intern_glyph("┘");
+    cg_glyph_t shade = cg_intern_glyph("▒");
+
+    while (!cg_should_exit())
+    {
+        // begin the draw
+        cg_begin_draw();
+
+        cg_clear_canvas();
+
+        // draw a frame around the screen
+        for (cg_uint x = 1; x < width - 1; x++)
+        {
+            cg_point_glyph(x, 0, horizontal);
+            cg_point_glyph(x, height - 2, horizontal);
+        }
+        for (cg_uint y = 1; y < height - 2; y++)
+        {
+            cg_point_glyph(0, y, vertical);
+            cg_point_glyph(width - 1, y, vertical);
+        }
+        cg_point_glyph(0, 0, top_left);
+        cg_point_glyph(width - 1, 0, top_right);
+        cg_point_glyph(0, height - 2, bottom_left);
+        cg_point_glyph(width - 1, height - 2, bottom_right);
+
+        // a shaded block
+        for (cg_uint y = 2; y < 6; y++)
+        {
+            for (cg_uint x = 2; x < 12; x++)
+            {
+                cg_point_glyph(x, y, shade);
+            }
+        }
+
+        // spinner, wide glyphs and text
+        if (total_time > 80)
+        {
+            frame = (frame + 1) % 10;
+            total_time = 0;
+        }
+        total_time += cg_get_deltatime();
+        cg_text((cg_char *)spinner[frame], 2, 7);
+        cg_text("Loading… 漢字 ▲▼ █▓▒░", 4, 7);
+
+        // print press escape to exit
+        cg_text("Press ESC to exit", 0, height - 1);
+
+        // end the draw
+        cg_end_draw();
+    }
+
+    // destroy the graphics engine
+    cg_destroy_graphics();
+}
@@ -0,0 +1,60 @@
+#define CONGFX_IMPLEMENTATION
+#include "congfx.h"
+
+typedef struct
+{
+    float t;         // animation time in seconds
+    cg_glyph_t dots; // glyph drawn over the plasma
+} plasma_t;
+
+// compute the colour of one cell, runs on the worker threads
+void plasma_shader(cg_uint x, cg_uint y, cg_cell_t *cell, void *userdata)
+{
+    plasma_t *p = (plasma_t *)userdata;
+    float fx = x * 0.08f;
+    float fy = y * 0.16f;
+    float v = sinf(fx + p->t) + sinf(fy + p->t * 0.7f) + sinf((fx + fy) * 0.5f + p->t * 1.3f);
+
+    cg_uint r = (cg_uint)(127.0f + 127.0f * sinf(v * 3.14159f));
+    cg_uint g = (cg_uint)(127.0f + 127.0f * sinf(v * 3.14159f + 2.094f));
+    cg_uint b = (cg_uint)(127.0f + 127.0f * sinf(v * 3.14159f + 4.188f));
+
+    cell->glyph = p->dots;
+    cell->bg = cg_rgb32(r, g, b);
+    cell->fg = cg_rgb32(255 - r, 255 - g, 255 - b);
+}
+
+int main(int argc, char *argv[])
+{
+    plasma_t plasma = {0};
+
+    cg_frame_rate(60);
+
+    // create the graphics engine
+    int err = cg_create_graphics_fullscreen();
+    if (err != 0)
+    {
+        return err;
+    }
+
+    plasma.dots = cg_intern_glyph("⠿");
+
+    while (!cg_should_exit())
+    {
+        // begin the draw
+        cg_begin_draw();
+
+        // shade the whole screen in parallel
+        plasma.t += cg_get_deltatime() / 1000.0f;
+        cg_shade(0, 0, width, height - 1, plasma_shader, &plasma);
+
+        // print press escape to exit
+        cg_textf(0, height - 1, "Press ESC to exit, %lu threads", cg_get_worker_count());
+
+        // end the draw
+        cg_end_draw();
+    }
+
+    // destroy the graphics engine
+    cg_destroy_graphics();
+}